@@ -4,703 +4,8295 @@
 #include <memory>
 #include <fstream>
 #include <vector>
+#include <set>
+#include <tuple>
 #include <algorithm>
+#include <numeric>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+#include <iomanip>
+#include <functional>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <array>
+#include <random>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <charconv>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/futex.h>
+#include <unistd.h>
 
 using namespace std;
 
+// Account numbers are digit strings (validated by BankSystem::isValid), stored inline instead of
+// in a heap string. Each one is also packed into a 64-bit key: strings of length L map onto
+// [offset(L), offset(L) + 10^L), so "007" and "7" stay distinct and equal keys mean equal numbers.
+class AccountNumber {
+public:
+    static const size_t MAX_DIGITS = 18;
+
+    AccountNumber() = default;
+    AccountNumber(string_view digits) {
+        if (!pack(digits, packedKey)) return; // invalid numbers are left empty
+        memcpy(buffer, digits.data(), digits.size());
+        length = static_cast<uint8_t>(digits.size());
+    }
+
+    string_view view() const { return string_view(buffer, length); }
+    uint64_t key() const { return packedKey; }
+    bool empty() const { return length == 0; }
+
+    // Packs a digit string into its key without allocating; false if it is not a valid number
+    static bool pack(string_view digits, uint64_t& key) {
+        if (digits.size() > MAX_DIGITS) return false;
+        uint64_t offset = 0, span = 1, value = 0;
+        for (size_t i = 0; i < digits.size(); i++) {
+            unsigned d = static_cast<unsigned char>(digits[i]) - '0';
+            if (d > 9) return false;
+            value = value * 10 + d;
+            offset += span;
+            span *= 10;
+        }
+        key = offset + value;
+        return true;
+    }
+
+private:
+    char buffer[MAX_DIGITS] = {};
+    uint8_t length = 0;
+    uint64_t packedKey = 0;
+};
+
+// Word-at-a-time (SWAR) character-class checks: eight bytes are tested per step with plain 64-bit
+// arithmetic, and the tail is padded with a byte that passes. ASCII only, like isdigit/isalpha in
+// the "C" locale. Used as the fast path of BankSystem::validationError.
+const uint64_t SWAR_ONES = 0x0101010101010101ULL, SWAR_HIGHS = 0x8080808080808080ULL;
+
+inline uint64_t swarLoad(const char* p, size_t n, char pad) {
+    uint64_t word = SWAR_ONES * static_cast<unsigned char>(pad);
+    memcpy(&word, p, n); // n <= 8
+    return word;
+}
+
+// High bit set in each byte of word that is zero (exact: no false positives from borrows)
+inline uint64_t swarZeroBytes(uint64_t word) {
+    return ~(((word & ~SWAR_HIGHS) + ~SWAR_HIGHS) | word) & SWAR_HIGHS;
+}
+
+// True if every byte is '0'..'9'
+inline bool swarAllDigits(string_view s) {
+    for (size_t i = 0; i < s.size(); i += 8) {
+        uint64_t word = swarLoad(s.data() + i, min<size_t>(8, s.size() - i), '0');
+        // '0'..'9' is 0x30..0x39: high nibble 3, and adding 6 must not carry into it
+        if ((word & 0xF0F0F0F0F0F0F0F0ULL) != SWAR_ONES * 0x30
+            || ((word + SWAR_ONES * 0x06) & 0xF0F0F0F0F0F0F0F0ULL) != SWAR_ONES * 0x30) return false;
+    }
+    return true;
+}
+
+// True if every byte is an ASCII letter or a space and at least one is a letter
+inline bool swarIsName(string_view s) {
+    uint64_t letters = 0;
+    for (size_t i = 0; i < s.size(); i += 8) {
+        uint64_t word = swarLoad(s.data() + i, min<size_t>(8, s.size() - i), ' ');
+        if (word & SWAR_HIGHS) return false;
+        uint64_t lower = word | SWAR_ONES * 0x20; // folds 'A'..'Z' onto 'a'..'z'
+        // Bytes are below 0x80, so these per-byte sums never carry into the next byte
+        uint64_t atLeastA = (lower + SWAR_ONES * (0x80 - 'a')) & SWAR_HIGHS;
+        uint64_t aboveZ = (lower + SWAR_ONES * (0x80 - 'z' - 1)) & SWAR_HIGHS;
+        uint64_t letter = atLeastA & ~aboveZ;
+        if ((letter | swarZeroBytes(word ^ SWAR_ONES * ' ')) != SWAR_HIGHS) return false;
+        letters |= letter;
+    }
+    return letters != 0;
+}
+
+// Money is held as a whole number of cents and interest rates as parts per million per year
+// (2.5% = 25000), so balances never pick up binary rounding error.
+using Cents = int64_t;
+using RatePpm = int64_t;
+
+const RatePpm DEFAULT_INTEREST_RATE = 25000;   // 2.5%
+const Cents DEFAULT_OVERDRAFT_LIMIT = 50000;   // $500
+
+// Bounds on what an account may hold: the most parseMoney and parseRate read (9999999999999999.99
+// and 999999.9999%). Two amounts within MAX_BALANCE add without overflowing a Cents.
+const Cents MAX_BALANCE = 999999999999999999LL;
+const RatePpm MAX_RATE = 9999999999LL;
+
+// Whether values that did not come through parseMoney or parseRate (e.g. off the wire) are ones
+// they could have produced
+inline bool moneyInRange(Cents cents) { return cents >= -MAX_BALANCE && cents <= MAX_BALANCE; }
+inline bool rateInRange(RatePpm ppm) { return ppm >= -MAX_RATE && ppm <= MAX_RATE; }
+
+// sum = balance + amount; false if that overflows or passes MAX_BALANCE
+inline bool addToBalance(Cents balance, Cents amount, Cents& sum) {
+    return !__builtin_add_overflow(balance, amount, &sum) && sum <= MAX_BALANCE;
+}
+
+inline Cents toCents(double amount) { return llround(amount * 100); }
+inline RatePpm toRatePpm(double percent) { return llround(percent * 10000); }
+
+// "1234.50", "-0.07"
+inline string formatMoney(Cents cents) {
+    uint64_t magnitude = cents < 0 ? 0 - static_cast<uint64_t>(cents) : static_cast<uint64_t>(cents);
+    string text = (cents < 0 ? "-" : "") + to_string(magnitude / 100) + ".";
+    text += static_cast<char>('0' + magnitude % 100 / 10);
+    text += static_cast<char>('0' + magnitude % 10);
+    return text;
+}
+
+// "2.5", "2.125" (percent, trailing zeros dropped)
+inline string formatRate(RatePpm ppm) {
+    uint64_t magnitude = ppm < 0 ? 0 - static_cast<uint64_t>(ppm) : static_cast<uint64_t>(ppm);
+    string text = (ppm < 0 ? "-" : "") + to_string(magnitude / 10000);
+    string fraction = to_string(10000 + magnitude % 10000).substr(1);
+    fraction.erase(fraction.find_last_not_of('0') + 1);
+    if (!fraction.empty()) text += "." + fraction;
+    return text;
+}
+
+// Parses "12", "12.5" or "-3.07" exactly; anything else a double can read (e.g. "1.5e+06" written
+// by older versions of the text file) is rounded to the nearest cent.
+inline bool parseMoney(string_view text, Cents& cents) {
+    const char* p = text.data();
+    const char* end = p + text.size();
+    bool negative = p != end && *p == '-';
+    if (negative) p++;
+    uint64_t whole = 0, fraction = 0;
+    size_t wholeDigits = 0, fractionDigits = 0;
+    while (p != end && *p >= '0' && *p <= '9' && wholeDigits < 16) whole = whole * 10 + (*p++ - '0'), wholeDigits++;
+    if (p != end && *p == '.') {
+        p++;
+        while (p != end && *p >= '0' && *p <= '9' && fractionDigits < 2) fraction = fraction * 10 + (*p++ - '0'), fractionDigits++;
+    }
+    if (p == end && (wholeDigits || fractionDigits)) {
+        if (fractionDigits == 1) fraction *= 10;
+        cents = static_cast<Cents>(whole * 100 + fraction);
+        if (negative) cents = -cents;
+        return true;
+    }
+
+    double value;
+    auto result = from_chars(text.data(), end, value);
+    if (result.ec != errc() || result.ptr != end || !(fabs(value) < 9e15)) return false;
+    cents = toCents(value);
+    return true;
+}
+
+// Parses a percentage ("2.5") into parts per million
+inline bool parseRate(string_view text, RatePpm& ppm) {
+    double percent;
+    auto result = from_chars(text.data(), text.data() + text.size(), percent);
+    if (result.ec != errc() || result.ptr != text.data() + text.size() || !(fabs(percent) < 1e6)) return false;
+    ppm = toRatePpm(percent);
+    return rateInRange(ppm);
+}
+
+// Interest earned in one of periodsPerYear periods, rounded half up to the cent and kept within
+// +-MAX_BALANCE
+inline Cents interestFor(Cents balance, RatePpm rate, int periodsPerYear) {
+    __int128 numerator = static_cast<__int128>(balance) * rate;
+    __int128 divisor = static_cast<__int128>(1000000) * periodsPerYear;
+    __int128 quotient = (numerator + divisor / 2) / divisor;
+    if ((numerator + divisor / 2) % divisor < 0) quotient--; // floor for negative balances
+    return static_cast<Cents>(max<__int128>(-MAX_BALANCE, min<__int128>(quotient, MAX_BALANCE)));
+}
+
+// Compounding periods accepted by BankSystem::tryAccrueInterest (daily or coarser is the normal use)
+const int MAX_PERIODS_PER_YEAR = 1000000;
+
+// Largest balance the accrual kernel handles (balance * rate must fit in 63 bits at rates up to 100%)
+const Cents MAX_KERNEL_BALANCE = 9000000000000LL;
+
+// Adds one period's interest to each balance, same rounding as interestFor. The quotient is
+// estimated in double and then corrected with integer arithmetic, so the result is exact while
+// the loop has no branches or integer division and vectorizes (int64<->double lanes need
+// AVX-512DQ, e.g. -O3 -march=native). Requires 0 <= balances[i] <= MAX_KERNEL_BALANCE and
+// 0 <= rates[i] <= 1000000.
+inline void accrueInterestKernel(Cents* __restrict balances, const RatePpm* __restrict rates, size_t n,
+                                 int periodsPerYear) {
+    const int64_t divisor = 1000000LL * periodsPerYear;
+    const int64_t half = divisor / 2;
+    const double inverse = 1.0 / static_cast<double>(divisor);
+    for (size_t i = 0; i < n; i++) {
+        int64_t numerator = balances[i] * rates[i] + half;
+        int64_t quotient = static_cast<int64_t>(static_cast<double>(numerator) * inverse);
+        int64_t remainder = numerator - quotient * divisor;
+        quotient += (remainder >= divisor) - (remainder < 0);
+        balances[i] += quotient;
+    }
+}
+
+// Stable type codes used by the binary formats (and anywhere a type switch beats dynamic_cast).
+// None marks a deleted row in AccountStore.
+enum class AccountKind : uint8_t { None = 0, Basic = 1, Savings = 2, Checking = 3 };
+
+inline const char* accountTypeName(AccountKind kind) {
+    switch (kind) {
+    case AccountKind::Savings: return "Savings Account";
+    case AccountKind::Checking: return "Checking Account";
+    default: return "Basic Account";
+    }
+}
+
+// Checks the rate (savings) or overdraft limit (checking) a request supplies for a new account,
+// with the rules the menu and batch files use: a savings rate that is not positive or an overdraft
+// limit that is negative gets the default. False for an unknown kind, or a basic account given one.
+inline bool resolveAccountParameter(AccountKind kind, int64_t& parameter) {
+    switch (kind) {
+    case AccountKind::Basic: return parameter == 0;
+    case AccountKind::Savings:
+        if (parameter <= 0) parameter = DEFAULT_INTEREST_RATE;
+        return true;
+    case AccountKind::Checking:
+        if (parameter < 0) parameter = DEFAULT_OVERDRAFT_LIMIT;
+        return true;
+    default: return false;
+    }
+}
+
+// Per-type account rules as compile-time policies. The Account classes, AccountStore and the batch
+// paths of BankSystem take their rules from here, and withPolicy() turns a runtime AccountKind into
+// one call with the matching policy type, so the code inside is compiled once per type with every
+// rule inlined. `limit` is the overdraft limit and `rate` the interest rate; a policy ignores what its
+// type does not have.
+struct BasicPolicy {
+    static constexpr AccountKind kind = AccountKind::Basic;
+    static constexpr bool hasOverdraft = false, earnsInterest = false;
+    static Cents available(Cents balance, Cents /*limit*/) { return balance; }
+    static Cents periodInterest(Cents /*balance*/, RatePpm /*rate*/, int /*periodsPerYear*/) { return 0; }
+};
+
+struct SavingsPolicy {
+    static constexpr AccountKind kind = AccountKind::Savings;
+    static constexpr bool hasOverdraft = false, earnsInterest = true;
+    static Cents available(Cents balance, Cents /*limit*/) { return balance; }
+    static Cents periodInterest(Cents balance, RatePpm rate, int periodsPerYear) { return interestFor(balance, rate, periodsPerYear); }
+};
+
+struct CheckingPolicy {
+    static constexpr AccountKind kind = AccountKind::Checking;
+    static constexpr bool hasOverdraft = true, earnsInterest = false;
+    // Capped at MAX_BALANCE, which is more than any one withdrawal may take
+    static Cents available(Cents balance, Cents limit) {
+        Cents sum;
+        return addToBalance(balance, limit, sum) ? sum : MAX_BALANCE;
+    }
+    static Cents periodInterest(Cents /*balance*/, RatePpm /*rate*/, int /*periodsPerYear*/) { return 0; }
+};
+
+// Calls fn with the policy object for kind (dead rows, kind None, get BasicPolicy)
+template <class Fn>
+decltype(auto) withPolicy(AccountKind kind, Fn&& fn) {
+    switch (kind) {
+    case AccountKind::Savings: return fn(SavingsPolicy{});
+    case AccountKind::Checking: return fn(CheckingPolicy{});
+    default: return fn(BasicPolicy{});
+    }
+}
+
+// Shared by the Account classes and AccountView so both print the same text.
+// `parameter` is the interest rate (savings) or overdraft limit (checking).
+inline void printAccountDetails(AccountKind kind, string_view number, string_view name, Cents balance, int64_t parameter) {
+    cout << "Account Type: " << accountTypeName(kind) << "\nAccount Number: " << number
+         << "\nCustomer Name: " << name << "\nBalance: $" << formatMoney(balance) << endl;
+    if (kind == AccountKind::Savings) cout << "Interest Rate: " << formatRate(parameter) << "%" << endl;
+    else if (kind == AccountKind::Checking) cout << "Overdraft Limit: $" << formatMoney(parameter) << endl;
+}
+
+inline void printSpecialFeatures(AccountKind kind, Cents balance, int64_t parameter) {
+    if (kind == AccountKind::Savings) {
+        cout << "Annual interest on current balance: $" << formatMoney(interestFor(balance, parameter, 1))
+             << "\nInterest Rate: " << formatRate(parameter) << "%" << endl;
+    } else if (kind == AccountKind::Checking) {
+        cout << "Overdraft Limit: $" << formatMoney(parameter)
+             << "\nAvailable Balance (including overdraft): $" << formatMoney(CheckingPolicy::available(balance, parameter)) << endl;
+    } else {
+        cout << "No special features for basic account." << endl;
+    }
+}
+
 class Account {
 protected:
-    string accountNumber, customerName;
-    double balance;
+    AccountNumber accountNumber;
+    string customerName;
+    Cents balance;
 
 public:
-    Account(const string& accNum = "", const string& custName = "", double initialBalance = 0.0)
+    Account(string_view accNum = "", string_view custName = "", Cents initialBalance = 0)
         : accountNumber(accNum), customerName(custName), balance(initialBalance) {}
 
     virtual ~Account() = default;
 
     // Getters
-    string getAccountNumber() const { return accountNumber; }
-    string getCustomerName() const { return customerName; }
-    double getBalance() const { return balance; }
+    string_view getAccountNumber() const { return accountNumber.view(); }
+    uint64_t getAccountKey() const { return accountNumber.key(); }
+    string_view getCustomerName() const { return customerName; }
+    Cents getBalance() const { return balance; }
 
     // Setters
-    void setBalance(double newBalance) { balance = newBalance; }
+    void setBalance(Cents newBalance) { balance = newBalance; }
 
     virtual void displayDetails() const {
-        cout << "Account Type: " << getAccountType() << "\nAccount Number: " << accountNumber
-             << "\nCustomer Name: " << customerName << "\nBalance: $" << balance << endl;
+        printAccountDetails(AccountKind::Basic, accountNumber.view(), customerName, balance, 0);
     }
 
-    virtual string getAccountType() const { return "Basic Account"; }
-    virtual bool canWithdraw(double amount) const { return amount <= balance; }
-    virtual double getAvailableBalance() const { return balance; }
-    virtual void showSpecialFeatures() const { cout << "No special features for basic account." << endl; }
+    virtual AccountKind getKind() const { return AccountKind::Basic; }
+    virtual string getAccountType() const { return accountTypeName(getKind()); }
+    virtual bool canWithdraw(Cents amount) const { return amount <= BasicPolicy::available(balance, 0); }
+    virtual Cents getAvailableBalance() const { return BasicPolicy::available(balance, 0); }
+    virtual Cents periodInterest(int periodsPerYear) const { return BasicPolicy::periodInterest(balance, 0, periodsPerYear); }
+    virtual void showSpecialFeatures() const { printSpecialFeatures(AccountKind::Basic, balance, 0); }
 };
 
 class SavingsAccount : public Account {
 private:
-    double interestRate;
+    RatePpm interestRate;
 
 public:
-    SavingsAccount(const string& accNum = "", const string& custName = "", double initialBalance = 0.0, double rate = 2.5)
+    SavingsAccount(string_view accNum = "", string_view custName = "", Cents initialBalance = 0,
+                   RatePpm rate = DEFAULT_INTEREST_RATE)
         : Account(accNum, custName, initialBalance), interestRate(rate) {}
 
-    double getInterestRate() const { return interestRate; }
+    RatePpm getInterestRate() const { return interestRate; }
 
     void displayDetails() const override {
-        Account::displayDetails();
-        cout << "Interest Rate: " << interestRate << "%" << endl;
+        printAccountDetails(AccountKind::Savings, accountNumber.view(), customerName, balance, interestRate);
     }
 
-    string getAccountType() const override { return "Savings Account"; }
-
-    void showSpecialFeatures() const override {
-        cout << "Annual interest on current balance: $" << balance * (interestRate / 100)
-             << "\nInterest Rate: " << interestRate << "%" << endl;
-    }
+    AccountKind getKind() const override { return AccountKind::Savings; }
+    Cents periodInterest(int periodsPerYear) const override { return SavingsPolicy::periodInterest(balance, interestRate, periodsPerYear); }
+    void showSpecialFeatures() const override { printSpecialFeatures(AccountKind::Savings, balance, interestRate); }
 };
 
 class CheckingAccount : public Account {
 private:
-    double overdraftLimit;
+    Cents overdraftLimit;
 
 public:
-    CheckingAccount(const string& accNum = "", const string& custName = "", double initialBalance = 0.0, double overdraft = 500.0)
+    CheckingAccount(string_view accNum = "", string_view custName = "", Cents initialBalance = 0,
+                    Cents overdraft = DEFAULT_OVERDRAFT_LIMIT)
         : Account(accNum, custName, initialBalance), overdraftLimit(overdraft) {}
 
-    double getOverdraftLimit() const { return overdraftLimit; }
+    Cents getOverdraftLimit() const { return overdraftLimit; }
 
     void displayDetails() const override {
-        Account::displayDetails();
-        cout << "Overdraft Limit: $" << overdraftLimit << endl;
+        printAccountDetails(AccountKind::Checking, accountNumber.view(), customerName, balance, overdraftLimit);
     }
 
-    string getAccountType() const override { return "Checking Account"; }
-    bool canWithdraw(double amount) const override { return amount <= (balance + overdraftLimit); }
-    double getAvailableBalance() const override { return balance + overdraftLimit; }
-
-    void showSpecialFeatures() const override {
-        cout << "Overdraft Limit: $" << overdraftLimit
-             << "\nAvailable Balance (including overdraft): $" << getAvailableBalance() << endl;
-    }
+    AccountKind getKind() const override { return AccountKind::Checking; }
+    bool canWithdraw(Cents amount) const override { return amount <= CheckingPolicy::available(balance, overdraftLimit); }
+    Cents getAvailableBalance() const override { return CheckingPolicy::available(balance, overdraftLimit); }
+    void showSpecialFeatures() const override { printSpecialFeatures(AccountKind::Checking, balance, overdraftLimit); }
 };
 
-struct Node {
-    unique_ptr<Account> account;
-    Node* next;
-    Node(unique_ptr<Account> acc) : account(std::move(acc)), next(nullptr) {}
-};
+// Slab allocator for customer names. Bytes are carved from 64 KB slabs (one malloc per few
+// thousand names), a freed name goes on a free list for its 8-byte size class and is reused by
+// the next name of that class in O(1), and every slab is released together by clear().
+class NameArena {
+public:
+    struct Ref {
+        const char* data = nullptr;
+        uint32_t length = 0;
+    };
 
-class BankSystem {
 private:
-    Node* head = nullptr;
-    const string DATA_FILE = "./bank_accounts.txt";
+    static constexpr size_t SLAB_BYTES = 64 * 1024;
+    vector<unique_ptr<char[]>> slabs;
+    char* cursor = nullptr;          // free space at the end of the newest slab
+    size_t remaining = 0;
+    vector<vector<char*>> freeLists; // indexed by size class (bytes / 8)
+    size_t liveBytes = 0, slabBytes = 0;
 
-    bool isValid(const string& str, bool isName) const {
-        if (str.empty() || str.length() < (isName ? 2 : 3)) {
-            cout << "Error: " << (isName ? "Name" : "Account number")
-                 << " must be at least " << (isName ? 2 : 3) << " characters long." << endl;
-            return false;
-        }
+    static size_t sizeClass(size_t length) { return (length + 7) / 8; }
 
-        bool valid;
-        if (isName) {
-            valid = all_of(str.begin(), str.end(), [](char c) { return isalpha(c) || c == ' '; });
-        } else {
-            valid = all_of(str.begin(), str.end(), [](char c) { return isdigit(c); });
+    char* carve(size_t bytes) {
+        if (bytes > remaining) {
+            if (bytes > SLAB_BYTES / 4) { // big names get a slab to themselves
+                slabs.emplace_back(new char[bytes]);
+                slabBytes += bytes;
+                return slabs.back().get();
+            }
+            reserve(SLAB_BYTES);
         }
+        char* p = cursor;
+        cursor += bytes;
+        remaining -= bytes;
+        return p;
+    }
 
-        if (!valid) {
-            cout << "Error: " << (isName ? "Name can only contain letters and spaces"
-                                        : "Account number can only contain numbers") << endl;
-            return false;
-        }
+public:
+    // Makes sure the next `bytes` worth of names fit in one slab
+    void reserve(size_t bytes) {
+        if (bytes <= remaining) return;
+        size_t size = max(bytes, SLAB_BYTES);
+        slabs.emplace_back(new char[size]);
+        slabBytes += size;
+        cursor = slabs.back().get();
+        remaining = size;
+    }
 
-        if (isName && !any_of(str.begin(), str.end(), [](char c) { return isalpha(c); })) {
-            cout << "Error: Name must contain at least one letter." << endl;
-            return false;
+    Ref store(string_view name) {
+        Ref ref;
+        ref.length = static_cast<uint32_t>(name.size());
+        if (name.empty()) return ref;
+        size_t cls = sizeClass(name.size());
+        char* p;
+        if (cls < freeLists.size() && !freeLists[cls].empty()) {
+            p = freeLists[cls].back();
+            freeLists[cls].pop_back();
+        } else {
+            p = carve(cls * 8);
         }
+        memcpy(p, name.data(), name.size());
+        ref.data = p;
+        liveBytes += cls * 8;
+        return ref;
+    }
 
-        return true;
+    void release(Ref ref) {
+        if (!ref.data) return;
+        size_t cls = sizeClass(ref.length);
+        if (cls >= freeLists.size()) freeLists.resize(cls + 1);
+        freeLists[cls].push_back(const_cast<char*>(ref.data));
+        liveBytes -= cls * 8;
     }
 
+    void clear() {
+        slabs.clear();
+        freeLists.clear();
+        cursor = nullptr;
+        remaining = liveBytes = slabBytes = 0;
+    }
+
+    size_t bytesInUse() const { return liveBytes; }
+    size_t bytesReserved() const { return slabBytes; }
+};
+
+// Interned customer names: each distinct name is stored once in a NameArena and rows refer to it
+// by a 32-bit handle, so a customer with several accounts costs 4 bytes per extra account.
+// Names are reference counted and freed with their last account. An open-addressing table of
+// handles (linear probing, tombstones) finds an existing copy of a name.
+class NamePool {
 public:
-    BankSystem() { loadAccountsFromFile(); }
-    BankSystem(const BankSystem&) = delete;
-    BankSystem& operator=(const BankSystem&) = delete;
+    using Handle = uint32_t;
+    static constexpr Handle NONE = UINT32_MAX;  // the empty name
 
-    ~BankSystem() {
-        saveAccountsToFile();
-        while (head) {
-            Node* temp = head;
-            head = head->next;
-            delete temp;
+private:
+    static constexpr Handle EMPTY_SLOT = UINT32_MAX, DELETED_SLOT = UINT32_MAX - 1;
+    struct Entry {
+        const char* data = nullptr;
+        uint32_t length = 0;
+        uint32_t refs = 0;  // 0: the handle is free
+    };
+
+    NameArena arena;
+    vector<Entry> entries;          // indexed by handle
+    vector<Handle> freeHandles;
+    vector<Handle> slots;           // hash table of handles
+    size_t liveCount = 0, usedCount = 0, references = 0; // usedCount includes tombstones
+
+    // Eight bytes at a time, each mixed in with the splitmix64 finalizer
+    static size_t hashOf(string_view name) {
+        uint64_t h = name.size();
+        for (size_t i = 0; i < name.size(); i += 8) {
+            uint64_t word = 0;
+            memcpy(&word, name.data() + i, min<size_t>(8, name.size() - i));
+            h ^= word;
+            h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+            h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+            h ^= h >> 31;
         }
+        return static_cast<size_t>(h);
     }
 
-    void saveAccountsToFile() {
-        ofstream outFile(DATA_FILE);
-        if (!outFile) {
-            cout << "Error: Could not save to file." << endl;
-            return;
-        }
+    string_view entryName(Handle h) const { return string_view(entries[h].data, entries[h].length); }
 
-        int count = 0;
-        for (Node* current = head; current; current = current->next) {
-            Account* acc = current->account.get();
-            outFile << "TYPE:" << acc->getAccountType() << "\nNUMBER:" << acc->getAccountNumber()
-                    << "\nNAME:" << acc->getCustomerName() << "\nBALANCE:" << acc->getBalance() << "\n";
+    void place(Handle h) {
+        size_t mask = slots.size() - 1;
+        size_t i = hashOf(entryName(h)) & mask;
+        while (slots[i] != EMPTY_SLOT && slots[i] != DELETED_SLOT) i = (i + 1) & mask;
+        if (slots[i] == EMPTY_SLOT) usedCount++;
+        slots[i] = h;
+        liveCount++;
+    }
 
-            if (auto* savings = dynamic_cast<SavingsAccount*>(acc))
-                outFile << "INTEREST_RATE:" << savings->getInterestRate() << "\n";
-            else if (auto* checking = dynamic_cast<CheckingAccount*>(acc))
-                outFile << "OVERDRAFT_LIMIT:" << checking->getOverdraftLimit() << "\n";
+    void rehash(size_t capacity) {
+        vector<Handle> old(capacity, EMPTY_SLOT);
+        old.swap(slots);
+        liveCount = usedCount = 0;
+        for (Handle h : old) {
+            if (h != EMPTY_SLOT && h != DELETED_SLOT) place(h);
+        }
+    }
 
-            outFile << "----------\n";
-            count++;
+    // The slot holding name, or -1
+    long findSlot(string_view name) const {
+        if (slots.empty()) return -1;
+        size_t mask = slots.size() - 1;
+        for (size_t i = hashOf(name) & mask; slots[i] != EMPTY_SLOT; i = (i + 1) & mask) {
+            if (slots[i] != DELETED_SLOT && entryName(slots[i]) == name) return static_cast<long>(i);
         }
-        outFile.close();
-        cout << count << " accounts saved." << endl;
+        return -1;
     }
 
-    void loadAccountsFromFile() {
-        ifstream inFile(DATA_FILE);
-        if (!inFile) {
-            cout << "No existing data found. Starting fresh." << endl;
-            return;
+public:
+    // The handle of name, adding it if this is its first account
+    Handle intern(string_view name) {
+        if (name.empty()) return NONE;
+        references++;
+        long slot = findSlot(name);
+        if (slot >= 0) {
+            entries[slots[slot]].refs++;
+            return slots[slot];
         }
+        if ((usedCount + 1) * 10 > slots.size() * 7) {
+            size_t capacity = slots.empty() ? 16 : slots.size();
+            while ((liveCount + 1) * 10 > capacity * 5) capacity *= 2;
+            rehash(capacity);
+        }
+        Handle h;
+        if (!freeHandles.empty()) {
+            h = freeHandles.back();
+            freeHandles.pop_back();
+        } else {
+            h = static_cast<Handle>(entries.size());
+            entries.emplace_back();
+        }
+        NameArena::Ref ref = arena.store(name);
+        entries[h] = { ref.data, ref.length, 1 };
+        place(h);
+        return h;
+    }
 
-        string line, type, number, name;
-        double balance, rate, limit;
-        int count = 0;
+    // Drops one account's reference; the name is freed with its last one
+    void release(Handle h) {
+        if (h == NONE) return;
+        references--;
+        if (--entries[h].refs > 0) return;
+        slots[findSlot(entryName(h))] = DELETED_SLOT;
+        liveCount--;
+        arena.release({ entries[h].data, entries[h].length });
+        entries[h] = Entry();
+        freeHandles.push_back(h);
+    }
 
-        while (getline(inFile, line) && line.substr(0, 5) == "TYPE:") {
-            type = line.substr(5);
+    string_view view(Handle h) const { return h == NONE ? string_view() : entryName(h); }
 
-            if (getline(inFile, line) && line.substr(0, 7) == "NUMBER:")
-                number = line.substr(7);
-            if (getline(inFile, line) && line.substr(0, 5) == "NAME:")
-                name = line.substr(5);
-            if (getline(inFile, line) && line.substr(0, 8) == "BALANCE:")
-                balance = stod(line.substr(8));
+    void clear() {
+        arena.clear();
+        entries.clear();
+        freeHandles.clear();
+        slots.clear();
+        liveCount = usedCount = references = 0;
+    }
 
-            unique_ptr<Account> acc;
-            if (type == "Basic Account") {
-                acc = make_unique<Account>(number, name, balance);
-            } else if (type == "Savings Account") {
-                if (getline(inFile, line) && line.substr(0, 14) == "INTEREST_RATE:")
-                    rate = stod(line.substr(14));
-                acc = make_unique<SavingsAccount>(number, name, balance, rate);
-            } else if (type == "Checking Account") {
-                if (getline(inFile, line) && line.substr(0, 16) == "OVERDRAFT_LIMIT:")
-                    limit = stod(line.substr(16));
-                acc = make_unique<CheckingAccount>(number, name, balance, limit);
-            }
+    size_t size() const { return liveCount; }          // distinct names
+    size_t referenceCount() const { return references; } // accounts with a name
+    size_t memoryBytes() const {
+        return arena.bytesReserved() + entries.capacity() * sizeof(Entry) + freeHandles.capacity() * sizeof(Handle)
+            + slots.capacity() * sizeof(Handle);
+    }
+};
 
-            if (acc) {
-                addAccount(std::move(acc));
-                count++;
-            }
-            getline(inFile, line); // Skip separator
-        }
-        cout << count << " accounts loaded." << endl;
+// Column-oriented account storage: row i of every column describes one account, so scans over
+// balances or rates walk contiguous arrays instead of chasing pointers to heap objects.
+// Rows are appended in creation order, which is also display/save order. Deleting a row marks
+// it dead (kind None, money columns zeroed) and compact() squeezes dead rows out once they pile up.
+// A column that does not apply to a row's kind holds 0 (basic accounts have rate 0 and overdraft
+// 0), so "available = balance + overdraft" and interest runs need no per-kind branches.
+class AccountStore {
+    vector<AccountKind> kinds;
+    vector<AccountNumber> numbers;
+    vector<NamePool::Handle> names; // interned in namePool
+    vector<Cents> balances;
+    vector<RatePpm> rates;       // savings interest rate
+    vector<Cents> overdrafts;    // checking overdraft limit
+    vector<uint8_t> dirty;       // changed since the last save; one byte per row so threads can flag different rows
+    vector<uint32_t> ledgerHeads; // newest ledger entry of the account, in its stripe's ledger
+    NamePool namePool;
+    size_t liveCount = 0;
+    array<size_t, 4> kindCounts = {};
+
+public:
+    static constexpr uint32_t NO_ROW = UINT32_MAX;
+
+    AccountStore() = default;
+    AccountStore(const AccountStore&) = delete; // names point into this store's pool
+    AccountStore& operator=(const AccountStore&) = delete;
+
+    size_t rowCount() const { return kinds.size(); } // including dead rows
+    size_t size() const { return liveCount; }
+    size_t countOf(AccountKind kind) const { return kindCounts[static_cast<size_t>(kind)]; }
+    size_t distinctNames() const { return namePool.size(); }
+
+    // Bytes held by the columns (by capacity) and by the interned names
+    size_t columnBytes() const {
+        return kinds.capacity() * sizeof(AccountKind) + numbers.capacity() * sizeof(AccountNumber)
+            + names.capacity() * sizeof(NamePool::Handle) + (balances.capacity() + overdrafts.capacity()) * sizeof(Cents)
+            + rates.capacity() * sizeof(RatePpm) + dirty.capacity() + ledgerHeads.capacity() * sizeof(uint32_t);
     }
+    size_t nameBytes() const { return namePool.memoryBytes(); }
+    bool isLive(uint32_t row) const { return kinds[row] != AccountKind::None; }
 
-    bool addAccount(unique_ptr<Account> newAccount) {
-        if (searchByAccountNumber(newAccount->getAccountNumber())) {
-            cout << "Error: Account already exists." << endl;
-            return false;
-        }
+    AccountKind kind(uint32_t row) const { return kinds[row]; }
+    const AccountNumber& number(uint32_t row) const { return numbers[row]; }
+    string_view name(uint32_t row) const { return namePool.view(names[row]); }
+    Cents balance(uint32_t row) const { return balances[row]; }
+    Cents& balance(uint32_t row) { return balances[row]; }
+    RatePpm rate(uint32_t row) const { return rates[row]; }
+    Cents overdraft(uint32_t row) const { return overdrafts[row]; }
+    // What the row's type lets it withdraw, by the same policy rule as the batch paths and Account
+    Cents available(uint32_t row) const { return availableAt(row, balances[row]); }
+    // The same, were the row's balance `balance` (for batches that keep balances aside)
+    Cents availableAt(uint32_t row, Cents balance) const {
+        return withPolicy(kinds[row], [&](auto policy) { return decltype(policy)::available(balance, overdrafts[row]); });
+    }
+    int64_t parameter(uint32_t row) const { return kinds[row] == AccountKind::Savings ? rates[row] : overdrafts[row]; }
+    uint32_t ledgerHead(uint32_t row) const { return ledgerHeads[row]; }
+    void setLedgerHead(uint32_t row, uint32_t entry) { ledgerHeads[row] = entry; }
 
-        Node* newNode = new Node(std::move(newAccount));
-        if (!head) {
-            head = newNode;
-        } else {
-            Node* current = head;
-            while (current->next) current = current->next;
-            current->next = newNode;
-        }
+    // Flags the row as changed; true if it was not flagged already. Rows are flagged under their
+    // account's stripe lock, so the check needs no atomics.
+    bool markDirty(uint32_t row) {
+        if (dirty[row]) return false;
+        dirty[row] = 1;
         return true;
     }
+    bool isDirty(uint32_t row) const { return dirty[row] != 0; }
+    void clearDirty(uint32_t row) { dirty[row] = 0; }
+    void clearDirty() { fill(dirty.begin(), dirty.end(), 0); }
 
-    Account* searchByAccountNumber(const string& accNum) {
-        for (Node* current = head; current; current = current->next) {
-            if (current->account->getAccountNumber() == accNum)
-                return current->account.get();
-        }
-        return nullptr;
+    // Whole columns, for vectorized passes
+    Cents* balanceData() { return balances.data(); }
+    const RatePpm* rateData() const { return rates.data(); }
+
+    // Room for `rows` more accounts. The name pool grows on its own: with interning, the bytes
+    // of the incoming names say little about how many are new.
+    void reserve(size_t rows) {
+        rows += kinds.size();
+        kinds.reserve(rows);
+        numbers.reserve(rows);
+        names.reserve(rows);
+        balances.reserve(rows);
+        rates.reserve(rows);
+        overdrafts.reserve(rows);
+        dirty.reserve(rows);
+        ledgerHeads.reserve(rows);
     }
 
-    void displayAllAccounts() const {
-        if (!head) {
-            cout << "No accounts in the system." << endl;
-            return;
-        }
-        int count = 1;
-        for (Node* current = head; current; current = current->next) {
-            cout << "\n--- Account " << count++ << " ---" << endl;
-            current->account->displayDetails();
-        }
+    // Caller has validated the number and kind
+    uint32_t append(AccountKind kind, const AccountNumber& number, string_view name, Cents balance, int64_t parameter) {
+        kinds.push_back(kind);
+        numbers.push_back(number);
+        names.push_back(namePool.intern(name));
+        balances.push_back(balance);
+        rates.push_back(kind == AccountKind::Savings ? parameter : 0);
+        overdrafts.push_back(kind == AccountKind::Checking ? parameter : 0);
+        dirty.push_back(0);
+        ledgerHeads.push_back(NO_ROW);
+        liveCount++;
+        kindCounts[static_cast<size_t>(kind)]++;
+        return static_cast<uint32_t>(kinds.size() - 1);
     }
 
-    bool deleteAccount(const string& accNum) {
-        if (!head) return false;
+    void erase(uint32_t row) {
+        kindCounts[static_cast<size_t>(kinds[row])]--;
+        liveCount--;
+        kinds[row] = AccountKind::None;
+        numbers[row] = AccountNumber();
+        namePool.release(names[row]);
+        names[row] = NamePool::NONE;
+        balances[row] = rates[row] = overdrafts[row] = 0;
+        dirty[row] = 0;
+        ledgerHeads[row] = NO_ROW;
+    }
 
-        if (head->account->getAccountNumber() == accNum) {
-            Node* temp = head;
-            head = head->next;
-            delete temp;
-            cout << "Account deleted successfully." << endl;
-            return true;
+    // Overwrites a live row in place (a saved change being applied on load)
+    void assign(uint32_t row, AccountKind kind, string_view name, Cents balance, int64_t parameter) {
+        kindCounts[static_cast<size_t>(kinds[row])]--;
+        kindCounts[static_cast<size_t>(kind)]++;
+        kinds[row] = kind;
+        if (name != this->name(row)) {
+            namePool.release(names[row]);
+            names[row] = namePool.intern(name);
         }
+        balances[row] = balance;
+        rates[row] = kind == AccountKind::Savings ? parameter : 0;
+        overdrafts[row] = kind == AccountKind::Checking ? parameter : 0;
+    }
 
-        for (Node* current = head; current->next; current = current->next) {
-            if (current->next->account->getAccountNumber() == accNum) {
-                Node* temp = current->next;
-                current->next = temp->next;
-                delete temp;
-                cout << "Account deleted successfully." << endl;
-                return true;
+    // Dead rows are worth squeezing out once they are at least half the table
+    bool needsCompaction() const {
+        size_t dead = rowCount() - liveCount;
+        return dead >= 1024 && dead * 2 >= rowCount();
+    }
+
+    // Removes dead rows, keeping live rows in order. Row numbers change, so indexes must be rebuilt.
+    void compact() {
+        size_t out = 0;
+        for (size_t row = 0; row < kinds.size(); row++) {
+            if (kinds[row] == AccountKind::None) continue;
+            if (out != row) {
+                kinds[out] = kinds[row];
+                numbers[out] = numbers[row];
+                names[out] = names[row];
+                balances[out] = balances[row];
+                rates[out] = rates[row];
+                overdrafts[out] = overdrafts[row];
+                dirty[out] = dirty[row];
+                ledgerHeads[out] = ledgerHeads[row];
             }
+            out++;
         }
-        cout << "Account not found." << endl;
-        return false;
+        kinds.resize(out);
+        numbers.resize(out);
+        names.resize(out);
+        balances.resize(out);
+        rates.resize(out);
+        overdrafts.resize(out);
+        dirty.resize(out);
+        ledgerHeads.resize(out);
     }
 
-    bool deposit(const string& accNum, double amount) {
-        if (amount <= 0) { cout << "Error: Amount must be positive." << endl; return false; }
+    void clear() {
+        kinds.clear();
+        numbers.clear();
+        names.clear();
+        balances.clear();
+        rates.clear();
+        overdrafts.clear();
+        dirty.clear();
+        ledgerHeads.clear();
+        namePool.clear();
+        liveCount = 0;
+        kindCounts = {};
+    }
+};
 
-        Account* acc = searchByAccountNumber(accNum);
-        if (!acc) { cout << "Error: Account not found." << endl; return false; }
+// The read side of the Account interface over one AccountStore row, without a heap object or
+// virtual calls. Valid until the store is compacted (which a delete may trigger) or cleared.
+class AccountView {
+    const AccountStore* store = nullptr;
+    uint32_t row = AccountStore::NO_ROW;
 
-        double oldBalance = acc->getBalance();
-        acc->setBalance(oldBalance + amount);
-        cout << "Deposit successful! Previous: $" << oldBalance
-             << ", Deposited: $" << amount << ", New: $" << acc->getBalance() << endl;
-        return true;
+public:
+    AccountView() = default;
+    AccountView(const AccountStore& accounts, uint32_t accountRow) : store(&accounts), row(accountRow) {}
+
+    explicit operator bool() const { return store != nullptr; }
+
+    string_view getAccountNumber() const { return store->number(row).view(); }
+    uint64_t getAccountKey() const { return store->number(row).key(); }
+    string_view getCustomerName() const { return store->name(row); }
+    Cents getBalance() const { return store->balance(row); }
+    AccountKind getKind() const { return store->kind(row); }
+    string getAccountType() const { return accountTypeName(getKind()); }
+    RatePpm getInterestRate() const { return store->rate(row); }
+    Cents getOverdraftLimit() const { return store->overdraft(row); }
+    bool canWithdraw(Cents amount) const { return amount <= store->available(row); }
+    Cents getAvailableBalance() const { return store->available(row); }
+    Cents periodInterest(int periodsPerYear) const { return interestFor(getBalance(), getInterestRate(), periodsPerYear); }
+
+    void displayDetails() const {
+        printAccountDetails(getKind(), getAccountNumber(), getCustomerName(), getBalance(), store->parameter(row));
+    }
+    void showSpecialFeatures() const { printSpecialFeatures(getKind(), getBalance(), store->parameter(row)); }
+};
+
+// Open-addressing hash index (linear probing) from packed account key to AccountStore row.
+// Slots carry the key itself, so probing never touches the store or a string.
+class AccountIndex {
+public:
+    // splitmix64 finalizer; packed keys are dense so they need mixing before masking
+    static size_t hashOf(uint64_t key) {
+        key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+        return static_cast<size_t>(key ^ (key >> 31));
     }
 
-    bool withdraw(const string& accNum, double amount) {
-        if (amount <= 0) { cout << "Error: Amount must be positive." << endl; return false; }
+private:
+    enum SlotState : unsigned char { EMPTY, USED, DELETED };
+    struct Slot {
+        uint64_t key = 0;
+        uint32_t row = AccountStore::NO_ROW;
+        SlotState state = EMPTY;
+    };
 
-        Account* acc = searchByAccountNumber(accNum);
-        if (!acc) { cout << "Error: Account not found." << endl; return false; }
+    vector<Slot> slots;
+    size_t liveCount = 0, usedCount = 0; // usedCount includes tombstones
 
-        if (!acc->canWithdraw(amount)) {
-            cout << "Error: Insufficient funds! Available: $" << acc->getAvailableBalance() << endl;
-            return false;
+
+    void rehash(size_t newCapacity) {
+        vector<Slot> old(newCapacity);
+        old.swap(slots);
+        liveCount = usedCount = 0;
+        for (const Slot& slot : old) {
+            if (slot.state == USED) place(slot.key, slot.row);
         }
+    }
 
-        double oldBalance = acc->getBalance();
-        acc->setBalance(oldBalance - amount);
-        cout << "Withdrawal successful! Previous: $" << oldBalance
-             << ", Withdrawn: $" << amount << ", New: $" << acc->getBalance() << endl;
-        return true;
+    void place(uint64_t key, uint32_t row) {
+        size_t mask = slots.size() - 1;
+        size_t i = hashOf(key) & mask;
+        while (slots[i].state == USED) i = (i + 1) & mask;
+        if (slots[i].state == EMPTY) usedCount++;
+        slots[i] = { key, row, USED };
+        liveCount++;
     }
 
-    void showAccountInfo(const string& accNum) {
-        Account* acc = searchByAccountNumber(accNum);
-        if (!acc) { cout << "Error: Account not found." << endl; return; }
+    // Returns the slot holding key, or -1 if absent
+    long findSlot(uint64_t key) const {
+        if (slots.empty()) return -1;
+        size_t mask = slots.size() - 1;
+        for (size_t i = hashOf(key) & mask; slots[i].state != EMPTY; i = (i + 1) & mask) {
+            if (slots[i].state == USED && slots[i].key == key) return static_cast<long>(i);
+        }
+        return -1;
+    }
 
-        cout << "\n=== Account Information ===" << endl;
-        acc->displayDetails();
-        cout << "\n=== Special Features ===" << endl;
-        acc->showSpecialFeatures();
+public:
+    // Returns the row for key, or AccountStore::NO_ROW
+    uint32_t find(uint64_t key) const {
+        long i = findSlot(key);
+        return i < 0 ? AccountStore::NO_ROW : slots[i].row;
     }
 
-    unique_ptr<Account> createAccount(int type, const string& accNum, const string& custName, double balance) {
-        if (!isValid(accNum, false) || !isValid(custName, true) || balance < 0) return nullptr;
+    // Caller guarantees the key is not already indexed
+    void insert(uint64_t key, uint32_t row) {
+        // Keep load (live + tombstones) under 70%; grow only if live entries need the room
+        if ((usedCount + 1) * 10 > slots.size() * 7) {
+            size_t capacity = slots.empty() ? 16 : slots.size();
+            while ((liveCount + 1) * 10 > capacity * 5) capacity *= 2;
+            rehash(capacity);
+        }
+        place(key, row);
+    }
 
-        switch (type) {
-        case 1: return make_unique<Account>(accNum, custName, balance);
-        case 2: {
-            double rate;
-            cout << "Enter interest rate (default 2.5%): ";
-            cin >> rate;
-            return make_unique<SavingsAccount>(accNum, custName, balance, rate > 0 ? rate : 2.5);
+    // Points key at row, indexing it first if need be
+    void assign(uint64_t key, uint32_t row) {
+        long i = findSlot(key);
+        if (i >= 0) slots[i].row = row;
+        else insert(key, row);
+    }
+
+    uint32_t erase(uint64_t key) {
+        long i = findSlot(key);
+        if (i < 0) return AccountStore::NO_ROW;
+        uint32_t row = slots[i].row;
+        slots[i].row = AccountStore::NO_ROW;
+        slots[i].state = DELETED;
+        liveCount--;
+        return row;
+    }
+
+    // Pulls the first slot key probes into cache; batches that know their keys ahead issue this a
+    // few keys early so the misses overlap
+    void prefetch(uint64_t key) const {
+        if (!slots.empty()) __builtin_prefetch(&slots[hashOf(key) & (slots.size() - 1)]);
+    }
+
+    size_t size() const { return liveCount; }
+    size_t memoryBytes() const { return slots.capacity() * sizeof(Slot); }
+
+    // Sizes the table for `count` live keys up front so bulk loads never rehash
+    void reserve(size_t count) {
+        size_t capacity = slots.empty() ? 16 : slots.size();
+        while (count * 10 > capacity * 5) capacity *= 2;
+        if (capacity != slots.size()) rehash(capacity);
+    }
+
+    void clear() {
+        slots.clear();
+        liveCount = usedCount = 0;
+    }
+};
+
+// Fixed-size nodes for the secondary index trees, carved from slabs (16 nodes at first, doubling up
+// to 64 KB) and recycled through a free list, so moving an account in an index never hits the
+// heap. The first allocation fixes the node size; anything else goes to operator new.
+// Not thread-safe: each pool is guarded by the lock of the tree that uses it.
+class NodePool {
+    static constexpr size_t SLAB_BYTES = 64 * 1024;
+    vector<unique_ptr<char[]>> slabs;
+    char* cursor = nullptr;
+    size_t remaining = 0, nodeBytes = 0, nextSlabNodes = 16;
+    void* freeList = nullptr; // each free node starts with the next one's address
+
+public:
+    NodePool() = default;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate(size_t bytes) {
+        if (nodeBytes == 0) nodeBytes = max((bytes + 7) & ~size_t(7), sizeof(void*));
+        if (bytes > nodeBytes) return ::operator new(bytes);
+        if (freeList) {
+            void* node = freeList;
+            memcpy(&freeList, node, sizeof(freeList));
+            return node;
         }
-        case 3: {
-            double overdraft;
-            cout << "Enter overdraft limit (default $500): $";
-            cin >> overdraft;
-            return make_unique<CheckingAccount>(accNum, custName, balance, overdraft >= 0 ? overdraft : 500);
+        if (remaining < nodeBytes) {
+            size_t slabBytes = nextSlabNodes * nodeBytes;
+            slabs.emplace_back(new char[slabBytes]);
+            cursor = slabs.back().get();
+            remaining = slabBytes;
+            if (slabBytes * 2 <= SLAB_BYTES) nextSlabNodes *= 2;
         }
+        void* node = cursor;
+        cursor += nodeBytes;
+        remaining -= nodeBytes;
+        return node;
+    }
+
+    void deallocate(void* node, size_t bytes) {
+        if (bytes > nodeBytes) {
+            ::operator delete(node);
+            return;
         }
-        return nullptr;
+        memcpy(node, &freeList, sizeof(freeList));
+        freeList = node;
     }
 };
 
-// Function to clear input buffer
-void clearInputBuffer() {
-    cin.clear();
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-}
+// Standard allocator front end for NodePool (single-node requests only go to the pool)
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+    NodePool* pool;
 
-// Function to ask for retry with specific error messages
-bool askForRetry(const string& errorType) {
-    string choice;
-    cout << "Error in " << errorType << ". Do you want to retry? (y/n): ";
-    getline(cin, choice);
-    return (choice == "y" || choice == "Y");
-}
+    explicit PoolAllocator(NodePool* nodePool) : pool(nodePool) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
 
-// menu selection with error handling
-int getMenuChoice() {
-    int choice;
-    while (true) {
-        cout << "\n===== Bank Account Management System =====\n"
-             << "1. Add account\n2. Display all accounts\n3. Search by account number\n"
-             << "4. Deposit\n5. Withdraw\n6. Delete account\n7. Show account info\n8. Exit\n";
-        cout << "Enter choice: ";
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= 8, "NodePool hands out 8-byte aligned nodes");
+        return static_cast<T*>(n == 1 ? pool->allocate(sizeof(T)) : ::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) {
+        if (n == 1) pool->deallocate(p, sizeof(T));
+        else ::operator delete(p);
+    }
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return pool == other.pool; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return pool != other.pool; }
+};
 
-        if (!(cin >> choice) || choice < 1 || choice > 8) {
-            cout << "Error: Invalid input. Please enter a number between 1 and 8." << endl;
-            clearInputBuffer();
-            if (!askForRetry("menu selection")) {
-                return -1; // User chose not to retry
-            }
-            continue;
+// One shard of accounts ordered by balance and by (type, available balance), as account keys.
+// BankSystem guards each shard with its own mutex and merges the shards to answer a query.
+class BalanceIndex {
+public:
+    struct ByBalance {
+        Cents balance;
+        uint64_t key;
+        bool operator<(const ByBalance& other) const { return tie(balance, key) < tie(other.balance, other.key); }
+    };
+    struct ByAvailable {
+        AccountKind kind;
+        Cents available;
+        uint64_t key;
+        bool operator<(const ByAvailable& other) const {
+            return tie(kind, available, key) < tie(other.kind, other.available, other.key);
         }
-        cin.ignore(); // Clear the newline after numeric input
-        return choice;
+    };
+    using BalanceSet = set<ByBalance, less<ByBalance>, PoolAllocator<ByBalance>>;
+    using AvailableSet = set<ByAvailable, less<ByAvailable>, PoolAllocator<ByAvailable>>;
+
+private:
+    NodePool balancePool, availablePool; // declared first: the trees return nodes to them
+    BalanceSet byBalance;
+    AvailableSet byAvailable;
+
+public:
+    BalanceIndex()
+        : byBalance(PoolAllocator<ByBalance>(&balancePool)), byAvailable(PoolAllocator<ByAvailable>(&availablePool)) {}
+
+    const BalanceSet& balances() const { return byBalance; }
+    const AvailableSet& available() const { return byAvailable; }
+
+    // `available` is always the account's policy value (AccountStore::available/availableAt), so an
+    // entry is found again under the key it was filed with
+    void insert(uint64_t key, AccountKind kind, Cents balance, Cents available) {
+        byBalance.insert({ balance, key });
+        byAvailable.insert({ kind, available, key });
     }
-}
 
-// account number input with validation
+    void erase(uint64_t key, AccountKind kind, Cents balance, Cents available) {
+        byBalance.erase({ balance, key });
+        byAvailable.erase({ kind, available, key });
+    }
+
+    // Moves an account to its new balance, reusing its tree nodes
+    void update(uint64_t key, AccountKind kind, Cents oldBalance, Cents oldAvailable, Cents newBalance, Cents newAvailable) {
+        auto balanceNode = byBalance.extract({ oldBalance, key });
+        if (!balanceNode.empty()) {
+            balanceNode.value().balance = newBalance;
+            byBalance.insert(std::move(balanceNode));
+        }
+        auto availableNode = byAvailable.extract({ kind, oldAvailable, key });
+        if (!availableNode.empty()) {
+            availableNode.value().available = newAvailable;
+            byAvailable.insert(std::move(availableNode));
+        }
+    }
+
+    // Replaces the contents with the given entries (sorted here, then appended in order)
+    void assign(vector<ByBalance>& balanceEntries, vector<ByAvailable>& availableEntries) {
+        clear();
+        sort(balanceEntries.begin(), balanceEntries.end());
+        sort(availableEntries.begin(), availableEntries.end());
+        for (const ByBalance& entry : balanceEntries) byBalance.insert(byBalance.end(), entry);
+        for (const ByAvailable& entry : availableEntries) byAvailable.insert(byAvailable.end(), entry);
+    }
+
+    void clear() {
+        byBalance.clear();
+        byAvailable.clear();
+    }
+};
+
+// Negative, zero or positive as a sorts before, with or after b, ignoring ASCII case
+inline int compareIgnoreCase(string_view a, string_view b) {
+    auto fold = [](char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : static_cast<unsigned char>(c); };
+    size_t n = min(a.size(), b.size());
+    for (size_t i = 0; i < n; i++) {
+        int x = fold(a[i]), y = fold(b[i]);
+        if (x != y) return x - y;
+    }
+    return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
+// Customer names in case-insensitive order, as account keys, for prefix searches. Names point into
+// the store's arena, so an entry is erased before its account. Guarded by the exclusive lock.
+class NameIndex {
+public:
+    struct Entry {
+        string_view name;
+        uint64_t key;
+        bool operator<(const Entry& other) const {
+            int order = compareIgnoreCase(name, other.name);
+            return order != 0 ? order < 0 : key < other.key;
+        }
+    };
+
+private:
+    NodePool pool;
+    set<Entry, less<Entry>, PoolAllocator<Entry>> entries;
+
+public:
+    NameIndex() : entries(PoolAllocator<Entry>(&pool)) {}
+
+    void insert(string_view name, uint64_t key) { entries.insert({ name, key }); }
+    void erase(string_view name, uint64_t key) { entries.erase({ name, key }); }
+    void clear() { entries.clear(); }
+
+    void assign(vector<Entry>& sorted) {
+        clear();
+        sort(sorted.begin(), sorted.end());
+        for (const Entry& entry : sorted) entries.insert(entries.end(), entry);
+    }
+
+    // Calls fn(key) for up to limit names starting with prefix, in name order: O(log n + k)
+    template <typename Fn>
+    void forEachWithPrefix(string_view prefix, size_t limit, Fn fn) const {
+        for (auto it = entries.lower_bound({ prefix, 0 }); it != entries.end() && limit > 0; ++it, limit--) {
+            if (it->name.size() < prefix.size() || compareIgnoreCase(it->name.substr(0, prefix.size()), prefix) != 0) break;
+            fn(it->key);
+        }
+    }
+};
+
+enum class LedgerKind : uint8_t { Open = 1, Deposit = 2, Withdraw = 3, TransferIn = 4, TransferOut = 5, Interest = 6, Close = 7 };
+
+inline const char* ledgerKindName(LedgerKind kind) {
+    switch (kind) {
+    case LedgerKind::Open: return "Opening balance";
+    case LedgerKind::Deposit: return "Deposit";
+    case LedgerKind::Withdraw: return "Withdrawal";
+    case LedgerKind::TransferIn: return "Transfer in";
+    case LedgerKind::TransferOut: return "Transfer out";
+    case LedgerKind::Interest: return "Interest";
+    case LedgerKind::Close: return "Account closed";
+    default: return "Unknown";
+    }
+}
+
+// Microseconds since the Unix epoch, the ledger's timestamps
+inline int64_t wallClockMicros() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// One balance change of an account
+struct LedgerEntry {
+    int64_t time;      // microseconds since the Unix epoch
+    LedgerKind kind;
+    Cents amount;      // signed: what the change added to the balance
+    Cents balance;     // after the change
+};
+
+// Append-only history of balance changes, stored as columns in blocks of BLOCK_ROWS entries. Each
+// entry links to the same account's previous entry and to a jump pointer further back (a skew-binary
+// jump list), so the newest entry at or before a given time is found in O(log n) steps over the
+// account's own n entries, and a statement then reads only its rows. Times are kept non-decreasing
+// (a clock step backwards is clamped) so the search holds. The caller keeps each account's newest
+// entry (its head) and passes it in. Not thread-safe: BankSystem keeps one per lock stripe and
+// appends under the stripe lock.
+class Ledger {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+private:
+    static const size_t BLOCK_ROWS = 1024;
+    // Side by side so computing a new entry's jump touches one cache line per entry it reads
+    struct Links {
+        uint32_t prev;   // the account's previous entry, or NONE
+        uint32_t jump;   // an earlier entry of the account (the first one points at itself)
+        uint32_t depth;  // entries of the account before this one
+    };
+    struct Block {
+        uint64_t key[BLOCK_ROWS];
+        int64_t time[BLOCK_ROWS];
+        Cents amount[BLOCK_ROWS];
+        Cents balance[BLOCK_ROWS];
+        Links links[BLOCK_ROWS];
+        LedgerKind kind[BLOCK_ROWS];
+    };
+
+    vector<unique_ptr<Block>> blocks;
+    uint32_t count = 0;
+    int64_t lastTime = INT64_MIN;
+
+    Block& blockOf(uint32_t entry) const { return *blocks[entry / BLOCK_ROWS]; }
+    const Links& linksAt(uint32_t entry) const { return blockOf(entry).links[entry % BLOCK_ROWS]; }
+
+    // The newest entry from head back that is at or before time, or NONE
+    uint32_t newestAtOrBefore(uint32_t head, int64_t time) const {
+        uint32_t entry = head;
+        while (entry != NONE && timeAt(entry) > time) {
+            const Links& links = linksAt(entry);
+            // Everything from the jump target up is newer than time too, so skip it
+            entry = links.jump != entry && timeAt(links.jump) > time ? links.jump : links.prev;
+        }
+        return entry;
+    }
+
+public:
+    uint32_t size() const { return count; }
+
+    uint64_t keyAt(uint32_t entry) const { return blockOf(entry).key[entry % BLOCK_ROWS]; }
+    int64_t timeAt(uint32_t entry) const { return blockOf(entry).time[entry % BLOCK_ROWS]; }
+    LedgerKind kindAt(uint32_t entry) const { return blockOf(entry).kind[entry % BLOCK_ROWS]; }
+    Cents amountAt(uint32_t entry) const { return blockOf(entry).amount[entry % BLOCK_ROWS]; }
+    Cents balanceAt(uint32_t entry) const { return blockOf(entry).balance[entry % BLOCK_ROWS]; }
+
+    // Adds an entry after head (NONE for the account's first) and returns it, the new head
+    uint32_t append(uint64_t key, uint32_t head, LedgerKind kind, Cents amount, Cents balance, int64_t time) {
+        if (count % BLOCK_ROWS == 0) blocks.emplace_back(new Block); // columns are filled as entries arrive
+        uint32_t entry = count++;
+        Links links = { head, entry, 0 };
+        if (head != NONE) {
+            // Jump twice as far as the previous entry does when its two jumps span equal distances
+            const Links& p = linksAt(head);
+            const Links& j = linksAt(p.jump);
+            links.depth = p.depth + 1;
+            links.jump = p.depth - j.depth == j.depth - linksAt(j.jump).depth ? j.jump : head;
+        }
+        lastTime = max(lastTime, time);
+
+        Block& b = blockOf(entry);
+        size_t i = entry % BLOCK_ROWS;
+        b.key[i] = key;
+        b.time[i] = lastTime;
+        b.amount[i] = amount;
+        b.balance[i] = balance;
+        b.links[i] = links;
+        b.kind[i] = kind;
+        return entry;
+    }
+
+    // Appends the entries from head back with from <= time <= to to out, oldest first
+    void statement(uint32_t head, int64_t from, int64_t to, vector<LedgerEntry>& out) const {
+        size_t start = out.size();
+        for (uint32_t entry = newestAtOrBefore(head, to); entry != NONE && timeAt(entry) >= from; entry = linksAt(entry).prev)
+            out.push_back({ timeAt(entry), kindAt(entry), amountAt(entry), balanceAt(entry) });
+        reverse(out.begin() + start, out.end());
+    }
+
+    // Calls fn(entry) for the entries from head back, newest first, until it returns false
+    template <typename Fn>
+    void forEachNewestFirst(uint32_t head, Fn fn) const {
+        for (uint32_t entry = head; entry != NONE && fn(entry); entry = linksAt(entry).prev) {}
+    }
+
+    size_t memoryBytes() const { return blocks.size() * sizeof(Block); }
+};
+
+// Fixed set of worker threads for data-parallel passes. run(tasks, fn) calls fn(0) .. fn(tasks - 1)
+// spread over the workers and the calling thread, and returns once every call has finished. Tasks
+// are claimed from a shared counter, so which thread runs a task varies but the tasks do not.
+class WorkerPool {
+private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, done;
+    const function<void(size_t)>* job = nullptr;
+    size_t taskCount = 0;
+    atomic<size_t> nextTask{ 0 };
+    uint64_t generation = 0;   // bumped by each run so parked workers see new work
+    size_t busy = 0;           // workers still in the current run
+    bool stopping = false;
+
+    void drain() {
+        for (size_t task; (task = nextTask.fetch_add(1, memory_order_relaxed)) < taskCount;) (*job)(task);
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            guard.unlock();
+            drain();
+            guard.lock();
+            if (--busy == 0) done.notify_one();
+        }
+    }
+
+public:
+    // threads counts the caller, so WorkerPool(1) starts no threads and runs everything inline
+    explicit WorkerPool(size_t threads) {
+        for (size_t i = 1; i < threads; i++) workers.emplace_back(&WorkerPool::work, this);
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    size_t size() const { return workers.size() + 1; }
+
+    // One run at a time: callers serialize on a lock of their own
+    void run(size_t tasks, const function<void(size_t)>& fn) {
+        if (workers.empty() || tasks <= 1) {
+            for (size_t task = 0; task < tasks; task++) fn(task);
+            return;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            job = &fn;
+            taskCount = tasks;
+            nextTask.store(0, memory_order_relaxed);
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        drain();
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0; });
+        job = nullptr;
+    }
+};
+
+// Read-only memory mapping of a whole file (POSIX); empty() if the file is missing or empty
+class MappedFile {
+    const char* base = nullptr;
+    size_t length = 0;
+
+public:
+    explicit MappedFile(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                base = static_cast<const char*>(p);
+                length = static_cast<size_t>(st.st_size);
+                madvise(p, length, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { if (base) munmap(const_cast<char*>(base), length); }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+    bool empty() const { return base == nullptr; }
+};
+
+// Binary snapshot layout: header, fixed-size records, then a heap holding all customer names.
+// Records reference names by offset into the heap, so loading is a straight walk over the mapping.
+const char SNAPSHOT_MAGIC[8] = { 'B', 'A', 'N', 'K', 'S', 'N', 'A', 'P' };
+const uint32_t SNAPSHOT_VERSION = 4;
+const size_t SNAPSHOT_V1_HEADER_SIZE = 32; // version 1 had no journalGeneration
+const size_t SNAPSHOT_V3_HEADER_SIZE = 40; // versions 2-3 had no journalSkip
+const uint32_t SNAPSHOT_FIRST_CENTS_VERSION = 3; // versions 1-2 stored balance/parameter as double
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t recordCount;
+    uint64_t heapSize;
+    uint64_t journalGeneration; // journal that continues from this snapshot
+    uint64_t journalSkip;       // records at the start of that journal already in this snapshot
+};
+
+struct SnapshotRecord {
+    char number[AccountNumber::MAX_DIGITS];
+    uint8_t numberLength;
+    uint8_t kind;           // AccountKind
+    uint32_t nameOffset;    // into the name heap
+    uint32_t nameLength;
+    uint32_t reserved;
+    int64_t balance;        // cents
+    int64_t parameter;      // interest rate in ppm (savings) or overdraft limit in cents (checking)
+};
+
+static_assert(sizeof(SnapshotHeader) == 48, "snapshot header layout changed");
+static_assert(sizeof(SnapshotRecord) == 48, "snapshot record layout changed");
+
+// Delta file: incremental saves append the accounts changed since the previous save as one batch of
+// snapshot records (kind None marks a deleted account) followed by their names. Each batch moves the
+// journal to the next generation, so on load the batches that continue the snapshot's generation are
+// applied in order. Compaction folds them into a new snapshot and drops them from the file.
+const char DELTA_MAGIC[8] = { 'B', 'A', 'N', 'K', 'D', 'L', 'T', 'A' };
+const uint32_t DELTA_VERSION = 1;
+
+struct DeltaHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct DeltaBatchHeader {
+    uint32_t checksum;      // FNV-1a over the bytes after this field
+    uint32_t reserved;
+    uint64_t size;          // whole batch, including this header and the names
+    uint64_t generation;    // journal generation that continues from this batch
+    uint64_t recordCount;
+};
+
+static_assert(sizeof(DeltaHeader) == 16, "delta header layout changed");
+static_assert(sizeof(DeltaBatchHeader) == 32, "delta batch layout changed");
+
+// Ledger file: each checkpoint appends the ledger entries added since the previous one as a segment
+// of columns (keys, times, amounts, balances, then kinds padded to 8 bytes). A segment is tagged with
+// the journal position it saves through, so on load the segments beyond the loaded snapshot and
+// delta batches, whose changes the journal replays again, are cut off.
+const char LEDGER_MAGIC[8] = { 'B', 'A', 'N', 'K', 'L', 'D', 'G', 'R' };
+const uint32_t LEDGER_VERSION = 1;
+
+struct LedgerHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct LedgerSegmentHeader {
+    uint32_t checksum;      // FNV-1a over the bytes after this field
+    uint32_t reserved;
+    uint64_t size;          // whole segment, including this header
+    uint64_t generation;    // journal generation and records of it the segment covers
+    uint64_t journalSkip;
+    uint64_t entryCount;
+};
+
+static_assert(sizeof(LedgerHeader) == 16, "ledger header layout changed");
+static_assert(sizeof(LedgerSegmentHeader) == 40, "ledger segment layout changed");
+
+inline uint64_t ledgerSegmentSize(uint64_t entries) {
+    return sizeof(LedgerSegmentHeader) + entries * 4 * sizeof(int64_t) + ((entries + 7) & ~uint64_t(7));
+}
+
+// Write-ahead journal: every mutation is appended as a checksummed binary record.
+// A journal belongs to one generation; a checkpoint writes a snapshot naming the next
+// generation and then restarts the journal with it, so replay never applies a record twice.
+// TransferOut/TransferIn are one account's half of a transfer whose other account is on another shard
+// (as journaled before such halves were prepared); PrepareLeg/SettleLeg hold a half between the two
+// phases of a cross-shard commit.
+enum class JournalOp : uint8_t { Create = 1, Deposit = 2, Withdraw = 3, Delete = 4, Transfer = 5, AccrueInterest = 6,
+                                 TransferOut = 7, TransferIn = 8, PrepareLeg = 9, SettleLeg = 10 };
+
+// Flags of PrepareLeg/SettleLeg records, kept in JournalRecord::kind. A carried leg was prepared
+// before the last checkpoint: the checkpoint already holds its debit.
+const uint8_t LEG_OUTGOING = 1, LEG_CARRIED = 2, LEG_COMMIT = 1;
+
+const char JOURNAL_MAGIC[8] = { 'B', 'A', 'N', 'K', 'J', 'R', 'N', 'L' };
+const uint32_t JOURNAL_VERSION = 3;
+const uint32_t JOURNAL_FIRST_CENTS_VERSION = 2; // version 1 stored amounts and parameters as double
+const size_t JOURNAL_V2_RECORD_SIZE = 40;        // versions 1-2 had no time
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t generation;
+};
+
+// Records may carry a tail: creates append an int64 (interest rate / overdraft limit) and the
+// customer name; transfers append the destination account number (`number` is the source).
+// AccrueInterest records carry periods per year in `amount` and no account. PrepareLeg/SettleLeg
+// records append the router's 8-byte transfer id.
+struct JournalRecord {
+    uint32_t size;          // whole record, including the tail
+    uint32_t checksum;      // FNV-1a over the bytes after this field
+    uint8_t op;             // JournalOp
+    uint8_t kind;           // AccountKind for creates, LEG_* flags for transfer legs
+    uint8_t numberLength;
+    char number[AccountNumber::MAX_DIGITS];
+    uint8_t reserved[3];
+    int64_t amount;         // cents: deposit/withdraw/transfer amount, or the opening balance of a create
+    int64_t time;           // microseconds since the Unix epoch, for the ledger
+};
+
+static_assert(sizeof(JournalHeader) == 24, "journal header layout changed");
+static_assert(sizeof(JournalRecord) == 48, "journal record layout changed");
+
+inline uint32_t fnv1a(const char* data, size_t n, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < n; i++) hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    return hash;
+}
+
+// Writes all n bytes at offset, retrying short writes
+inline bool writeAllAt(int fd, const char* data, size_t n, off_t offset) {
+    while (n > 0) {
+        ssize_t written = ::pwrite(fd, data, n, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        n -= static_cast<size_t>(written);
+        offset += written;
+    }
+    return true;
+}
+
+// Flushes a written file's data to disk, so renaming it over an older file cannot leave an empty
+// or partial file behind after a power loss
+inline bool syncFileData(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool synced = fdatasync(fd) == 0;
+    return ::close(fd) == 0 && synced;
+}
+
+// The directory holding path ("." for a bare file name)
+inline string directoryOf(const string& path) {
+    size_t slash = path.rfind('/');
+    return slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Syncs a directory so the renames and unlinks made in it survive a power loss. Allocates
+// nothing, so a forked child can call it.
+inline bool syncDirectory(const char* directory) {
+    int fd = ::open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool synced = fsync(fd) == 0;
+    return ::close(fd) == 0 && synced;
+}
+
+// Renames a synced temporary file over path and syncs the directory, so the old file is only
+// gone for good once the new one is in place on disk. Returns whether the rename happened: from
+// then on the new file is what a restart reads, so a failed directory sync is only reported.
+inline bool renameDurably(const string& tempPath, const string& path) {
+    if (rename(tempPath.c_str(), path.c_str()) != 0) return false;
+    if (!syncDirectory(directoryOf(path).c_str())) cout << "Error: Could not sync the directory of " << path << "." << endl;
+    return true;
+}
+
+class Journal {
+    int fd = -1;
+    string path;
+    uint64_t generation = 0;
+    chrono::milliseconds window{ 5 };
+
+    // Group commit: appends land in `pending`; the flusher thread writes and fdatasyncs
+    // everything that accumulated, so one fsync covers every record since the last one.
+    mutex mtx;
+    condition_variable wake, durable;
+    vector<char> pending;
+    uint64_t appendedSeq = 0, durableSeq = 0;
+    size_t waiters = 0;
+    atomic<size_t> recordsSinceReset{ 0 };
+    atomic<bool> failed{ false };
+    bool stopping = false;
+    thread flusher;
+
+    static const size_t FLUSH_BYTES = 1 << 20;
+
+    static bool writeAll(int target, const char* data, size_t n) {
+        while (n > 0) {
+            ssize_t written = ::write(target, data, n);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            n -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    static void encode(JournalRecord rec, string_view tail, vector<char>& out) {
+        rec.size = static_cast<uint32_t>(sizeof(rec) + tail.size());
+        rec.checksum = fnv1a(tail.data(), tail.size(), fnv1a(reinterpret_cast<const char*>(&rec) + 8, sizeof(rec) - 8));
+        const char* bytes = reinterpret_cast<const char*>(&rec);
+        out.insert(out.end(), bytes, bytes + sizeof(rec));
+        out.insert(out.end(), tail.begin(), tail.end());
+    }
+
+    static vector<char> headerBytes(uint64_t gen) {
+        JournalHeader header = {};
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.version = JOURNAL_VERSION;
+        header.generation = gen;
+        const char* bytes = reinterpret_cast<const char*>(&header);
+        return vector<char>(bytes, bytes + sizeof(header));
+    }
+
+    void flushLoop() {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            wake.wait_for(lock, window, [this] {
+                return stopping || (!pending.empty() && (waiters > 0 || pending.size() >= FLUSH_BYTES));
+            });
+            if (pending.empty()) {
+                if (stopping) break;
+                continue;
+            }
+            vector<char> batch;
+            batch.swap(pending);
+            uint64_t seq = appendedSeq;
+
+            lock.unlock();
+            bool written = writeAll(fd, batch.data(), batch.size()) && fdatasync(fd) == 0;
+            lock.lock();
+
+            // A failed batch never becomes durable, and neither does anything after it
+            if (written) durableSeq = seq;
+            else failed = true;
+            durable.notify_all();
+        }
+    }
+
+    bool writeHeader() {
+        vector<char> header = headerBytes(generation);
+        if (writeAll(fd, header.data(), header.size()) && fdatasync(fd) == 0) return true;
+        failed = true;
+        return false;
+    }
+
+public:
+    Journal() = default;
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    ~Journal() { close(); }
+
+    bool isOpen() const { return fd >= 0; }
+    bool hasFailed() const { return failed; }
+    size_t recordCount() const { return recordsSinceReset; }
+
+    // Opens the journal for appending. An existing file is kept (from validLength on) only if it
+    // carries the expected generation; anything else is restarted empty. On failure the journal
+    // stays closed.
+    bool open(const string& journalPath, uint64_t gen, uint64_t validLength, size_t existingRecords,
+              chrono::milliseconds groupCommitWindow) {
+        fd = ::open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) return false;
+        path = journalPath;
+        generation = gen;
+        window = groupCommitWindow;
+        bool ready = validLength >= sizeof(JournalHeader)
+            ? ftruncate(fd, static_cast<off_t>(validLength)) == 0 // drop a torn tail
+            : ftruncate(fd, 0) == 0 && writeHeader();
+        if (!ready) {
+            ::close(fd);
+            fd = -1;
+            failed = false; // writeHeader's; a closed journal is not a failed one
+            return false;
+        }
+        recordsSinceReset = validLength >= sizeof(JournalHeader) ? existingRecords : 0;
+        flusher = thread(&Journal::flushLoop, this);
+        return true;
+    }
+
+    void close() {
+        if (fd < 0) return;
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (flusher.joinable()) flusher.join();
+        ::close(fd);
+        fd = -1;
+    }
+
+    // Appends one record (plus optional tail) and returns its sequence number (0 once failed)
+    uint64_t append(JournalRecord rec, string_view tail = string_view()) {
+        lock_guard<mutex> lock(mtx);
+        if (failed) return 0;
+        encode(rec, tail, pending);
+        recordsSinceReset++;
+        if (pending.size() >= FLUSH_BYTES) wake.notify_one();
+        return ++appendedSeq;
+    }
+
+    // Blocks until the record with sequence number seq has been fdatasync'ed; false if it never
+    // will be because the journal failed first
+    bool waitDurable(uint64_t seq) {
+        unique_lock<mutex> lock(mtx);
+        if (durableSeq >= seq) return true;
+        waiters++;
+        wake.notify_one();
+        durable.wait(lock, [&] { return durableSeq >= seq || failed; });
+        waiters--;
+        return durableSeq >= seq;
+    }
+
+    bool sync() {
+        uint64_t seq;
+        {
+            lock_guard<mutex> lock(mtx);
+            seq = appendedSeq;
+        }
+        return waitDurable(seq);
+    }
+
+    // Restarts the journal under a new generation (after a checkpoint), holding only the `carried`
+    // records. The new file is written and synced beside the old one and renamed over it, so a
+    // crash leaves one journal or the other, never one cut short. Appends must be held off.
+    bool reset(uint64_t gen, const vector<pair<JournalRecord, string>>& carried = {}) {
+        sync();
+        lock_guard<mutex> lock(mtx);
+        vector<char> bytes = headerBytes(gen);
+        for (const auto& record : carried) encode(record.first, record.second, bytes);
+        string tempPath = path + ".tmp";
+        int next = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        bool written = next >= 0 && writeAll(next, bytes.data(), bytes.size()) && fdatasync(next) == 0;
+        if (!written || !renameDurably(tempPath, path)) {
+            if (next >= 0) ::close(next);
+            ::unlink(tempPath.c_str());
+            failed = true; // appends would land in the generation the checkpoint replaced
+            return false;
+        }
+        ::close(fd);
+        fd = next;
+        generation = gen;
+        recordsSinceReset = carried.size();
+        return true;
+    }
+
+    // Walks the valid records of a journal of the given generation. Stops at the first torn or
+    // corrupt record and reports how many bytes were good so the caller can cut the tail off.
+    // Applies the records of generation `gen` after the first `skip` and hands the first `skip` to
+    // `skipped` (if any); `records` counts them all
+    static bool replay(const string& path, uint64_t gen, size_t skip, uint64_t& validLength, size_t& records,
+                       const function<void(const JournalRecord&, string_view, uint32_t version)>& apply,
+                       const function<void(const JournalRecord&, string_view)>& skipped = nullptr) {
+        validLength = 0;
+        records = 0;
+        MappedFile file(path);
+        const JournalHeader* header = reinterpret_cast<const JournalHeader*>(file.data());
+        if (file.empty() || file.size() < sizeof(JournalHeader)
+            || memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) != 0
+            || header->version < 1 || header->version > JOURNAL_VERSION || header->generation != gen)
+            return false;
+
+        size_t recordSize = header->version >= 3 ? sizeof(JournalRecord) : JOURNAL_V2_RECORD_SIZE;
+        size_t offset = sizeof(JournalHeader);
+        while (offset + recordSize <= file.size()) {
+            JournalRecord rec = {};
+            memcpy(&rec, file.data() + offset, recordSize);
+            if (rec.size < recordSize || offset + rec.size > file.size() || rec.numberLength > AccountNumber::MAX_DIGITS
+                || fnv1a(file.data() + offset + 8, rec.size - 8) != rec.checksum)
+                break;
+
+            string_view tail(file.data() + offset + recordSize, rec.size - recordSize);
+            if (records >= skip)
+                apply(rec, tail, header->version);
+            else if (skipped)
+                skipped(rec, tail);
+            offset += rec.size;
+            records++;
+        }
+        validLength = offset;
+        return true;
+    }
+};
+
+// Options controlling where a BankSystem keeps its data and whether it persists automatically
+struct BankOptions {
+    string textFile = "./bank_accounts.txt";          // legacy TYPE:/NUMBER:/NAME:/BALANCE: format
+    string snapshotFile = "./bank_accounts.snap";     // binary snapshot, preferred when present
+    string journalFile = "./bank_accounts.journal";   // write-ahead journal replayed over the snapshot
+    string deltaFile = "./bank_accounts.delta";       // accounts changed since the snapshot, applied over it
+    bool autoLoad = true;      // load on construction
+    bool saveOnExit = true;    // checkpoint in the destructor
+    bool journaling = true;    // append every mutation to the journal
+    bool readOnly = false;     // load everything, journal included, but never write the data files back
+    bool durableAcks = true;   // mutations return only once their journal record is on disk
+    size_t checkpointInterval = 10000;            // journal records between automatic checkpoints
+    chrono::milliseconds groupCommitWindow{ 5 };  // longest a record waits for a batched fsync
+    size_t loaderThreads = 0;  // text-file parser threads; 0 = one per core
+    size_t interestThreads = 0; // interest-run threads, started by the first run; 0 = one per core
+    double compactionRatio = 0.5; // compact in the background once the delta file is this share of the snapshot; 0 = never
+    bool forkSnapshots = true; // full snapshots are written by a forked copy-on-write child while updates continue
+    bool ledger = true;        // keep every balance change for statements
+    string ledgerFile = "./bank_accounts.ledger";     // ledger entries saved at checkpoints; "" = keep in memory only
+    string metricsFile = "./bank_metrics.csv";        // SIGUSR1 writes the operation metrics here; "" = ignore the signal
+};
+
+// Outcome of a BankSystem operation, for callers that report errors themselves
+enum class TxnStatus { Ok, InvalidAmount, InvalidAccount, NotFound, Duplicate, InsufficientFunds, SameAccount, IoError, Busy };
+
+// One leg of a batched transfer; the strings must outlive the tryTransferBatch call
+struct TransferRequest {
+    string_view from, to;
+    Cents amount;
+};
+
+// How often fastForwardInterest credits savings accounts
+enum class InterestSchedule { Daily, Monthly };
+
+// One withdrawal of a batch; the number must outlive the tryWithdrawBatch call
+struct WithdrawRequest {
+    string_view number;
+    Cents amount;
+};
+
+// One account of a bulk import; the strings must outlive the tryAddAccounts call
+struct AccountRequest {
+    AccountKind kind;
+    string_view number, name;
+    Cents balance;
+    int64_t parameter; // interest rate (savings) or overdraft limit (checking)
+};
+
+// One account found by a query, copied while updates were held off
+struct AccountDetails {
+    AccountKind kind;
+    string number, name;
+    Cents balance;
+    int64_t parameter; // interest rate (savings) or overdraft limit (checking)
+
+    void displayDetails() const { printAccountDetails(kind, number, name, balance, parameter); }
+};
+
+// Balances around a deposit/withdrawal (available is filled in when funds are insufficient)
+struct BalanceChange {
+    Cents before = 0, after = 0, available = 0;
+};
+
+// Heap bytes behind the accounts themselves (see BankSystem::memoryUsage); the ledger and the
+// secondary indexes are reported separately
+struct MemoryUsage {
+    size_t accounts = 0, distinctNames = 0;
+    size_t columnBytes = 0, nameBytes = 0, indexBytes = 0;
+};
+
+// Bank-wide totals that BankSystem keeps current on every change (see BankSystem::portfolio).
+// Per-type arrays are indexed by AccountKind. The running sums are 128-bit; a total past the
+// int64 range (a dozen accounts near MAX_BALANCE reach it) is reported as INT64_MAX or -INT64_MAX.
+struct Portfolio {
+    size_t accounts[4] = {};
+    Cents liabilities[4] = {};   // net balance held per account type
+    Cents deposits = 0;          // all positive balances
+    Cents overdrawn = 0;         // checking balances below zero, as a positive amount
+    Cents overdraftLimits = 0;   // overdraft granted to checking accounts, drawn or not
+    Cents projectedInterest = 0; // savings: one year of simple interest at today's balances and rates
+
+    bool operator==(const Portfolio& other) const {
+        return equal(begin(accounts), end(accounts), begin(other.accounts))
+            && equal(begin(liabilities), end(liabilities), begin(other.liabilities)) && deposits == other.deposits
+            && overdrawn == other.overdrawn && overdraftLimits == other.overdraftLimits
+            && projectedInterest == other.projectedInterest;
+    }
+};
+
+// A deposit, withdrawal or transfer queued for BankSystem::applyBatch (see TxnEngine). The numbers
+// are packed by the submitting thread, so the applier only looks keys up.
+enum class TxnOp : uint8_t { Deposit, Withdraw, Transfer };
+struct TxnRequest {
+    TxnOp op;
+    AccountNumber account;
+    AccountNumber target; // transfers only
+    Cents amount;
+};
+
+// Outcome of a TxnRequest; `change` describes `account`
+struct TxnResult {
+    TxnStatus status = TxnStatus::Ok;
+    BalanceChange change;
+};
+
+inline const char* describeStatus(TxnStatus status) {
+    switch (status) {
+    case TxnStatus::Ok: return "OK";
+    case TxnStatus::InvalidAmount: return "Amount must be positive and keep the balance within limits";
+    case TxnStatus::InvalidAccount: return "Invalid account number";
+    case TxnStatus::NotFound: return "Account not found";
+    case TxnStatus::Duplicate: return "Account already exists";
+    case TxnStatus::InsufficientFunds: return "Insufficient funds";
+    case TxnStatus::SameAccount: return "Cannot transfer to the same account";
+    case TxnStatus::IoError: return "File could not be read or written";
+    case TxnStatus::Busy: return "Account has a transfer in progress";
+    }
+    return "Unknown error";
+}
+
+// Operation metrics: every BankSystem counts its operations by outcome and keeps a latency
+// histogram per operation type. Build with -DBANK_METRICS=0 to compile all of it out.
+#ifndef BANK_METRICS
+#define BANK_METRICS 1
+#endif
+
+// Snapshot latency is how long writers were held off to start a full snapshot
+enum class BankOp : uint8_t { Lookup, Add, Delete, Deposit, Withdraw, Transfer, Save, Load, Compact, Snapshot };
+const size_t BANK_OP_COUNT = 10;
+const size_t TXN_STATUS_COUNT = 9;
+
+inline const char* bankOpName(BankOp op) {
+    static const char* const names[BANK_OP_COUNT] = { "lookup", "add", "delete", "deposit", "withdraw",
+                                                      "transfer", "save", "load", "compact", "snapshot" };
+    return names[static_cast<size_t>(op)];
+}
+
+#if BANK_METRICS
+// HDR-style latency histogram: one bucket per nanosecond below 16 ns, then 16 linear sub-buckets
+// per power of two, so a bucket's bounds are within 6.25% of each other. Values past 2^40 ns
+// (18 minutes) share the last bucket. Recording is one relaxed atomic increment.
+class LatencyHistogram {
+public:
+    static const unsigned SUB_BITS = 4, SUB_BUCKETS = 1u << SUB_BITS, MAX_EXPONENT = 40;
+    static const size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < SUB_BUCKETS) return static_cast<size_t>(ns);
+        unsigned exponent = 63 - __builtin_clzll(ns);
+        if (exponent > MAX_EXPONENT) return BUCKETS - 1;
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + ((ns >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    // Largest value that falls in the bucket
+    static uint64_t bucketLimit(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS) - 1;
+        return ((SUB_BUCKETS + bucket % SUB_BUCKETS + uint64_t(1)) << shift) - 1;
+    }
+
+    void record(uint64_t ns) { counts[bucketOf(ns)].fetch_add(1, memory_order_relaxed); }
+
+    void addTo(vector<uint64_t>& totals) const {
+        for (size_t b = 0; b < BUCKETS; b++) totals[b] += counts[b].load(memory_order_relaxed);
+    }
+
+private:
+    array<atomic<uint64_t>, BUCKETS> counts{};
+};
+
+// Every call is counted by outcome, but two clock reads cost about as much as a lookup, so each
+// thread times only one in LATENCY_SAMPLE_EVERY lookups, adds, deletes, deposits, withdrawals and
+// transfers; saves, loads and compactions are always timed. Counters are sharded: each thread
+// records into one of SHARDS copies (assigned round-robin on its first operation), so threads
+// working in parallel rarely share a cache line. Reading sums the shards without stopping writers.
+class BankMetrics {
+public:
+    static const uint32_t LATENCY_SAMPLE_EVERY = 8;
+
+    bool shouldTime(BankOp op) {
+        return op >= BankOp::Save || ++threadSlot().tick % LATENCY_SAMPLE_EVERY == 0;
+    }
+
+    void count(BankOp op, TxnStatus status) {
+        Shard& shard = shards[threadSlot().shard];
+        shard.outcomes[static_cast<size_t>(op)][static_cast<size_t>(status)].fetch_add(1, memory_order_relaxed);
+    }
+
+    void record(BankOp op, TxnStatus status, uint64_t ns) {
+        Shard& shard = shards[threadSlot().shard];
+        size_t o = static_cast<size_t>(op);
+        shard.outcomes[o][static_cast<size_t>(status)].fetch_add(1, memory_order_relaxed);
+        shard.totalNs[o].fetch_add(ns, memory_order_relaxed);
+        shard.latency[o].record(ns);
+    }
+
+    // One CSV line per operation type: calls, calls by outcome, calls timed, then the mean and
+    // percentiles of the timed calls
+    void print(ostream& out) const {
+        out << "operation,count";
+        for (const char* outcome : OUTCOME_COLUMNS) out << ',' << outcome;
+        out << ",timed,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n";
+        vector<uint64_t> buckets(LatencyHistogram::BUCKETS);
+        for (size_t o = 0; o < BANK_OP_COUNT; o++) {
+            uint64_t outcomes[TXN_STATUS_COUNT] = {}, totalNs = 0;
+            fill(buckets.begin(), buckets.end(), 0);
+            for (const Shard& shard : shards) {
+                for (size_t s = 0; s < TXN_STATUS_COUNT; s++) outcomes[s] += shard.outcomes[o][s].load(memory_order_relaxed);
+                totalNs += shard.totalNs[o].load(memory_order_relaxed);
+                shard.latency[o].addTo(buckets);
+            }
+            uint64_t count = 0, timed = 0, seen = 0;
+            for (uint64_t n : outcomes) count += n;
+            for (uint64_t n : buckets) timed += n;
+            out << bankOpName(static_cast<BankOp>(o)) << ',' << count;
+            for (uint64_t n : outcomes) out << ',' << n;
+            out << ',' << timed << ',' << (timed ? totalNs / timed : 0);
+            size_t bucket = 0;
+            for (double p : { 0.5, 0.9, 0.99, 0.999, 1.0 }) {
+                uint64_t rank = static_cast<uint64_t>(ceil(p * timed));
+                while (bucket < buckets.size() && (seen + buckets[bucket] < rank || buckets[bucket] == 0)) {
+                    seen += buckets[bucket];
+                    bucket++;
+                }
+                out << ',' << (timed ? LatencyHistogram::bucketLimit(bucket) : 0);
+            }
+            out << '\n';
+        }
+    }
+
+private:
+    static const size_t SHARDS = 8;
+    // Outcome column names, in TxnStatus order
+    static constexpr const char* OUTCOME_COLUMNS[TXN_STATUS_COUNT] = {
+        "ok", "invalid_amount", "invalid_account", "not_found", "duplicate", "insufficient_funds", "same_account", "io_error", "busy"
+    };
+
+    struct alignas(64) Shard {
+        array<array<atomic<uint64_t>, TXN_STATUS_COUNT>, BANK_OP_COUNT> outcomes{};
+        array<atomic<uint64_t>, BANK_OP_COUNT> totalNs{};
+        array<LatencyHistogram, BANK_OP_COUNT> latency;
+    };
+
+    struct ThreadSlot {
+        size_t shard;
+        uint32_t tick;
+    };
+
+    // Constant-initialized, so reaching it costs no thread_local guard check
+    static ThreadSlot& threadSlot() {
+        static atomic<size_t> nextShard{ 0 };
+        thread_local ThreadSlot slot = { SHARDS, 0 };
+        if (slot.shard == SHARDS) slot.shard = nextShard.fetch_add(1, memory_order_relaxed) % SHARDS;
+        return slot;
+    }
+
+    array<Shard, SHARDS> shards;
+};
+
+// Times one operation (if it is sampled) from construction until finish(), which records the
+// outcome and passes it on
+class OpTimer {
+public:
+    OpTimer(BankMetrics& metrics, BankOp op) : metrics(metrics), op(op), timed(metrics.shouldTime(op)) {
+        if (timed) start = chrono::steady_clock::now();
+    }
+
+    TxnStatus finish(TxnStatus status) {
+        if (!timed) {
+            metrics.count(op, status);
+            return status;
+        }
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        metrics.record(op, status, static_cast<uint64_t>(elapsed.count()));
+        return status;
+    }
+    bool finish(bool ok) {
+        finish(ok ? TxnStatus::Ok : TxnStatus::IoError);
+        return ok;
+    }
+
+private:
+    BankMetrics& metrics;
+    BankOp op;
+    bool timed;
+    chrono::steady_clock::time_point start;
+};
+
+// SIGUSR1 handling: a handler may only make async-signal-safe calls, so it writes a byte to a pipe
+// and a thread of the bank that claimed the signal reads it and writes the metrics file
+int metricsSignalPipe[2] = { -1, -1 };
+atomic<bool> metricsSignalClaimed{ false };
+
+extern "C" void onMetricsSignal(int) {
+    int savedErrno = errno;
+    char request = 'd';
+    if (write(metricsSignalPipe[1], &request, 1) < 0) {} // a full pipe already has a dump queued
+    errno = savedErrno;
+}
+#else
+// Compiled out: nothing is recorded and timers are empty objects
+class BankMetrics {
+public:
+    void print(ostream& out) const { out << "# metrics compiled out (BANK_METRICS=0)\n"; }
+};
+
+class OpTimer {
+public:
+    OpTimer(BankMetrics&, BankOp) {}
+    TxnStatus finish(TxnStatus status) { return status; }
+    bool finish(bool ok) { return ok; }
+};
+#endif
+
+class BankSystem {
+private:
+    AccountStore accounts;
+    AccountIndex index;
+    BankOptions options;
+    mutable BankMetrics metrics;
+    Journal journal;
+    uint64_t journalGeneration = 0;
+    uint64_t journalSkip = 0;          // records at the start of that journal the loaded files already hold
+    size_t unloadedTextRecords = 0;    // text-file records that could not be loaded; no snapshot is saved while any
+    atomic_flag journalErrorReported = ATOMIC_FLAG_INIT;
+    unique_ptr<WorkerPool> interestPool; // runs interest postings; started by the first one
+
+    // Concurrency: structural changes (add/delete/load/save) hold structureMutex exclusively;
+    // everything else holds it shared and serializes per account on a striped lock
+    // chosen by the account key's hash, so transactions on different stripes run in parallel.
+    // Each stripe also queues the keys of its accounts that changed since the last save, keeps
+    // their ledger and their share of the portfolio totals.
+    static const size_t LOCK_STRIPES = 256;
+
+    // One stripe's partial portfolio totals. An account's share is kept in its own stripe's sums,
+    // except that interest runs add their net effect to stripe 0: only the total over all stripes
+    // means anything.
+    struct PortfolioSums {
+        __int128 liabilities[4] = {};
+        __int128 deposits = 0, overdrawn = 0, overdraftLimits = 0;
+        __int128 balanceRate = 0; // balance x rate (ppm) summed over savings accounts
+    };
+
+    static Cents saturateCents(__int128 total) {
+        const __int128 limit = numeric_limits<Cents>::max();
+        return static_cast<Cents>(max(-limit, min(total, limit)));
+    }
+
+    struct alignas(64) LockStripe {
+        mutex lock;
+        vector<uint64_t> changedKeys;
+        Ledger ledger;
+        uint32_t ledgerSaved = 0;      // entries already in the ledger file
+        AccountIndex closedHeads;      // deleted account key -> its newest ledger entry (live ones keep it in their row)
+        PortfolioSums portfolio;
+    };
+    mutable shared_mutex structureMutex;
+    mutable array<LockStripe, LOCK_STRIPES> stripes;
+
+    static size_t stripeIndex(uint64_t key) { return AccountIndex::hashOf(key) & (LOCK_STRIPES - 1); }
+    mutex& stripeFor(uint64_t key) const { return stripes[stripeIndex(key)].lock; }
+
+    // Secondary indexes (balance and available balance per stripe, names overall) are built by the
+    // first query and kept up to date from then on. Loads and interest runs, which move many
+    // accounts at once, drop them until the next query rebuilds them.
+    // The balance indexes are split into shards of 16 stripes, each locked inside the stripe lock:
+    // a range query searches every shard's tree once, so fewer shards answer faster, while more
+    // would let concurrent balance updates collide less.
+    static const size_t INDEX_SHARDS = 16;
+    struct alignas(64) IndexShard {
+        mutex lock;
+        BalanceIndex balances;
+    };
+    array<IndexShard, INDEX_SHARDS> indexShards;
+    NameIndex names;
+    bool secondaryIndexed = false;
+
+    static size_t shardIndex(uint64_t key) { return stripeIndex(key) % INDEX_SHARDS; }
+
+    // Incremental saves. Changes are tracked only while the snapshot and delta file hold everything
+    // else (deltaBase); until then, or after a change too broad to track, the next save is a full one.
+    bool deltaBase = false;
+    bool allChanged = false;           // interest touched every savings account
+    bool ledgerReady = false;          // the constructor has loaded the ledger; later loads seed their accounts
+    vector<AccountNumber> deletedNumbers;
+    int deltaFd = -1;
+    uint64_t deltaLength = 0;          // intact bytes in the delta file; new batches go here
+    uint64_t snapshotLength = 0;
+    mutex snapshotMutex;               // one snapshot writer at a time: full saves and compaction
+    int ledgerFd = -1;
+    uint64_t ledgerLength = 0;         // intact bytes in the ledger file; new segments go here
+
+    // Prepared legs of cross-shard transfers (see tryPrepareLeg), by the router's transfer id. They
+    // live in the journal: each checkpoint carries the undecided ones into the next generation.
+    // Changed under the account's stripe lock and legMutex; each pins its account against deletion.
+    struct PreparedLeg {
+        AccountNumber number;
+        Cents amount;
+        bool outgoing;
+    };
+    mutex legMutex;
+    unordered_map<uint64_t, PreparedLeg> preparedLegs;
+    unordered_map<uint64_t, uint32_t> legPins; // account key -> prepared legs on it
+    // Ids aborted while no leg was prepared under them: the router gave up on a prepare whose reply
+    // it lost, and that prepare may still arrive on its old connection, so it is refused. The last
+    // ABORTED_KEPT such ids are kept in memory (under legMutex); abortedOrder is their ring.
+    static const size_t ABORTED_KEPT = 1 << 16;
+    unordered_set<uint64_t> abortedTxns;
+    vector<uint64_t> abortedOrder;
+    size_t abortedNext = 0;
+
+    // Background compaction folds the delta file into a new snapshot once it grows large
+    static const uint64_t MIN_COMPACTION_BYTES = 64 << 10;
+    thread compactor;
+    mutex compactMutex;
+    condition_variable compactWake;
+    bool compactRequested = false, compactStopping = false;
+
+    // With forkSnapshots, full snapshots are taken by the compaction thread: it forks a child that
+    // writes the accounts from its copy-on-write image, so writers pause only for the fork, then
+    // waits for the child and switches to the new snapshot. Guarded by compactMutex; snapshotRunning
+    // (from request to switch-over) may be read without it.
+    bool snapshotRequested = false;
+    atomic<bool> snapshotRunning{ false };
+    bool snapshotSaved = true;         // outcome of the last forked snapshot
+    bool reportSnapshot = false;
+    condition_variable snapshotDone;
+
+    // Returns the account's row, or AccountStore::NO_ROW
+    uint32_t findRow(string_view accNum) const {
+        uint64_t key;
+        return AccountNumber::pack(accNum, key) ? index.find(key) : AccountStore::NO_ROW;
+    }
+
+    // Copies a row out for a caller that reads it after the locks are dropped
+    AccountDetails detailsOf(uint32_t row) const {
+        return { accounts.kind(row), string(accounts.number(row).view()), string(accounts.name(row)),
+                 accounts.balance(row), accounts.parameter(row) };
+    }
+
+    bool isValid(const string& str, bool isName) const {
+        string error = validationError(str, isName);
+        if (!error.empty()) cout << "Error: " << error << endl;
+        return error.empty();
+    }
+
+    static int64_t accountParameter(const Account& acc) {
+        switch (acc.getKind()) {
+        case AccountKind::Savings: return static_cast<const SavingsAccount&>(acc).getInterestRate();
+        case AccountKind::Checking: return static_cast<const CheckingAccount&>(acc).getOverdraftLimit();
+        default: return 0;
+        }
+    }
+
+    // One account parsed from the text format; the strings point into the mapped file
+    struct ParsedAccount {
+        AccountKind kind;
+        string_view number, name;
+        Cents balance;
+        int64_t parameter;
+        const char* badField; // the field that could not be parsed ("balance" etc.), or null
+        size_t line;          // of the NUMBER: line, counted from 0 at the start of its chunk
+    };
+
+    // Parses records from [p, end), each laid out line by line as TYPE:, NUMBER:, NAME:, BALANCE:,
+    // then INTEREST_RATE: (savings) or OVERDRAFT_LIMIT: (checking), then a separator line.
+    // A balance, rate or limit that does not parse marks the record with badField. `lines` receives
+    // the number of lines read. Returns false if it stopped at a line that does not start a record.
+    static bool parseTextChunk(const char* p, const char* end, vector<ParsedAccount>& out, size_t& lines) {
+        lines = 0;
+        auto nextLine = [&](string_view& line) {
+            if (p >= end) return false;
+            lines++;
+            const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char* lineEnd = newline ? newline : end;
+            line = string_view(p, lineEnd - p);
+            p = newline ? newline + 1 : end;
+            return true;
+        };
+        // True if the next line starts with prefix; value is the rest of it
+        auto nextField = [&](string_view prefix, string_view& value) {
+            string_view line;
+            if (!nextLine(line) || line.substr(0, prefix.size()) != prefix) return false;
+            value = line.substr(prefix.size());
+            return true;
+        };
+
+        out.reserve(out.size() + (end - p) / 80);
+        string_view line, value;
+        while (nextLine(line)) {
+            if (line.substr(0, 5) != "TYPE:") return false;
+            string_view type = line.substr(5);
+            ParsedAccount acc = { AccountKind::None, string_view(), string_view(), 0, 0, nullptr, lines };
+            if (type == "Basic Account") acc.kind = AccountKind::Basic;
+            else if (type == "Savings Account") acc.kind = AccountKind::Savings;
+            else if (type == "Checking Account") acc.kind = AccountKind::Checking;
+
+            if (nextField("NUMBER:", value)) acc.number = value;
+            if (nextField("NAME:", value)) acc.name = value;
+            if (nextField("BALANCE:", value) && !parseMoney(value, acc.balance)) acc.badField = "balance";
+            if (acc.kind == AccountKind::Savings) {
+                acc.parameter = DEFAULT_INTEREST_RATE;
+                if (nextField("INTEREST_RATE:", value) && !parseRate(value, acc.parameter) && !acc.badField)
+                    acc.badField = "interest rate";
+            } else if (acc.kind == AccountKind::Checking) {
+                acc.parameter = DEFAULT_OVERDRAFT_LIMIT;
+                if (nextField("OVERDRAFT_LIMIT:", value) && !parseMoney(value, acc.parameter) && !acc.badField)
+                    acc.badField = "overdraft limit";
+            }
+            nextLine(line); // separator
+
+            if (acc.kind != AccountKind::None) out.push_back(acc);
+        }
+        return true;
+    }
+
+    // Queues a changed row for the next incremental save. The caller holds the account's stripe
+    // lock or structureMutex exclusively.
+    void markChanged(uint32_t row) {
+        if (!deltaBase || allChanged || !accounts.markDirty(row)) return;
+        uint64_t key = accounts.number(row).key();
+        stripes[stripeIndex(key)].changedKeys.push_back(key);
+    }
+
+    // Adds (sign 1) or takes away (sign -1) the row's share of the portfolio totals, counted at
+    // `balance`. The caller holds the account's stripe lock or structureMutex exclusively.
+    void countInPortfolio(uint32_t row, Cents balance, int sign) {
+        PortfolioSums& sums = stripes[stripeIndex(accounts.number(row).key())].portfolio;
+        AccountKind kind = accounts.kind(row);
+        sums.liabilities[static_cast<size_t>(kind)] += sign * balance;
+        sums.deposits += sign * max<Cents>(balance, 0);
+        if (kind == AccountKind::Checking) {
+            sums.overdrawn += sign * max<Cents>(-balance, 0);
+            sums.overdraftLimits += sign * accounts.overdraft(row);
+        }
+        sums.balanceRate += static_cast<__int128>(sign * balance) * accounts.rate(row);
+    }
+
+    // Caller holds structureMutex (either way)
+    Portfolio makePortfolio(const PortfolioSums& total) const {
+        Portfolio result;
+        for (AccountKind kind : { AccountKind::Basic, AccountKind::Savings, AccountKind::Checking })
+            result.accounts[static_cast<size_t>(kind)] = accounts.countOf(kind);
+        transform(begin(total.liabilities), end(total.liabilities), begin(result.liabilities), saturateCents);
+        result.deposits = saturateCents(total.deposits);
+        result.overdrawn = saturateCents(total.overdrawn);
+        result.overdraftLimits = saturateCents(total.overdraftLimits);
+        result.projectedInterest = saturateCents((total.balanceRate + (total.balanceRate >= 0 ? 500000 : -500000)) / 1000000);
+        return result;
+    }
+
+    // Bookkeeping after a row's balance moved: queue it for saving, move it in the portfolio totals
+    // and re-sort it in the balance indexes. The caller holds the account's stripe lock or
+    // structureMutex exclusively.
+    void balanceChanged(uint32_t row, Cents oldBalance) {
+        markChanged(row);
+        countInPortfolio(row, oldBalance, -1);
+        countInPortfolio(row, accounts.balance(row), 1);
+        if (!secondaryIndexed) return;
+        uint64_t key = accounts.number(row).key();
+        IndexShard& shard = indexShards[shardIndex(key)];
+        lock_guard<mutex> lock(shard.lock);
+        shard.balances.update(key, accounts.kind(row), oldBalance, accounts.availableAt(row, oldBalance), accounts.balance(row),
+                              accounts.available(row));
+    }
+
+    // Caller holds structureMutex exclusively
+    void buildSecondaryIndexes() {
+        if (secondaryIndexed) return;
+        vector<vector<BalanceIndex::ByBalance>> byBalance(INDEX_SHARDS);
+        vector<vector<BalanceIndex::ByAvailable>> byAvailable(INDEX_SHARDS);
+        vector<NameIndex::Entry> byName;
+        byName.reserve(accounts.size());
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (!accounts.isLive(row)) continue;
+            uint64_t key = accounts.number(row).key();
+            size_t shard = shardIndex(key);
+            byBalance[shard].push_back({ accounts.balance(row), key });
+            byAvailable[shard].push_back({ accounts.kind(row), accounts.available(row), key });
+            byName.push_back({ accounts.name(row), key });
+        }
+        for (size_t shard = 0; shard < INDEX_SHARDS; shard++)
+            indexShards[shard].balances.assign(byBalance[shard], byAvailable[shard]);
+        names.assign(byName);
+        secondaryIndexed = true;
+    }
+
+    // Caller holds structureMutex exclusively
+    void dropSecondaryIndexes() {
+        if (!secondaryIndexed) return;
+        for (IndexShard& shard : indexShards) shard.balances.clear();
+        names.clear();
+        secondaryIndexed = false;
+    }
+
+    // Merges sorted ranges, calling emit on elements in `before` order until limit elements were
+    // emitted or emit returns false: O(r + k log r) for r ranges and k results
+    template <typename It, typename Before, typename Emit>
+    static void mergeRanges(vector<pair<It, It>> ranges, size_t limit, Before before, Emit emit) {
+        auto later = [&](const pair<It, It>& a, const pair<It, It>& b) { return before(*b.first, *a.first); };
+        ranges.erase(remove_if(ranges.begin(), ranges.end(), [](const pair<It, It>& r) { return r.first == r.second; }),
+                     ranges.end());
+        make_heap(ranges.begin(), ranges.end(), later);
+        while (!ranges.empty() && limit-- > 0) {
+            pop_heap(ranges.begin(), ranges.end(), later);
+            if (!emit(*ranges.back().first)) break;
+            if (++ranges.back().first == ranges.back().second) ranges.pop_back();
+            else push_heap(ranges.begin(), ranges.end(), later);
+        }
+    }
+
+    // Core mutations: no journaling, no console output. Used directly by loading and replay.
+    TxnStatus insertAccount(AccountKind kind, string_view number, string_view name, Cents balance, int64_t parameter) {
+        AccountNumber accountNumber(number);
+        if (accountNumber.empty()) return TxnStatus::InvalidAccount;
+        if (kind != AccountKind::Basic && kind != AccountKind::Savings && kind != AccountKind::Checking)
+            return TxnStatus::InvalidAccount;
+        if (!moneyInRange(balance) || !(kind == AccountKind::Savings ? rateInRange(parameter) : moneyInRange(parameter)))
+            return TxnStatus::InvalidAmount;
+        if (index.find(accountNumber.key()) != AccountStore::NO_ROW) return TxnStatus::Duplicate;
+
+        uint32_t row = accounts.append(kind, accountNumber, name, balance, parameter);
+        index.insert(accountNumber.key(), row);
+        markChanged(row);
+        countInPortfolio(row, balance, 1);
+        if (secondaryIndexed) {
+            indexShards[shardIndex(accountNumber.key())].balances.insert(accountNumber.key(), kind, balance, accounts.available(row));
+            names.insert(accounts.name(row), accountNumber.key());
+        }
+        return TxnStatus::Ok;
+    }
+
+    // Appends a balance change to the history of the account at row. The caller holds the account's
+    // stripe lock or structureMutex exclusively.
+    void recordLedger(uint32_t row, LedgerKind kind, Cents amount, Cents balance, int64_t time) {
+        if (!options.ledger) return;
+        uint64_t key = accounts.number(row).key();
+        LockStripe& stripe = stripes[stripeIndex(key)];
+        uint32_t head = accounts.ledgerHead(row);
+        if (head == Ledger::NONE) head = stripe.closedHeads.erase(key); // a reused number continues its history
+        accounts.setLedgerHead(row, stripe.ledger.append(key, head, kind, amount, balance, time));
+    }
+
+    // The newest ledger entry of key, live at row (or NO_ROW) or deleted, or Ledger::NONE
+    uint32_t ledgerHeadOf(uint64_t key, uint32_t row) const {
+        uint32_t head = row != AccountStore::NO_ROW ? accounts.ledgerHead(row) : Ledger::NONE;
+        return head != Ledger::NONE ? head : stripes[stripeIndex(key)].closedHeads.find(key);
+    }
+
+    // Adds an account (not from a file) with its opening balance as the first ledger entry
+    TxnStatus openAccount(AccountKind kind, string_view number, string_view name, Cents balance, int64_t parameter,
+                          int64_t time) {
+        TxnStatus status = insertAccount(kind, number, name, balance, parameter);
+        if (status == TxnStatus::Ok) recordLedger(index.find(AccountNumber(number).key()), LedgerKind::Open, balance, balance, time);
+        return status;
+    }
+
+    // Deletes an account, closing its history by paying out the balance
+    TxnStatus closeAccount(uint64_t key, int64_t time) {
+        uint32_t row = index.find(key);
+        if (row != AccountStore::NO_ROW) recordLedger(row, LedgerKind::Close, -accounts.balance(row), 0, time);
+        return removeAccount(key);
+    }
+
+    TxnStatus removeAccount(uint64_t key) {
+        uint32_t row = index.erase(key);
+        if (row == AccountStore::NO_ROW) return TxnStatus::NotFound;
+
+        if (deltaBase && !allChanged) deletedNumbers.push_back(accounts.number(row));
+        if (secondaryIndexed) {
+            indexShards[shardIndex(key)].balances.erase(key, accounts.kind(row), accounts.balance(row), accounts.available(row));
+            names.erase(accounts.name(row), key);
+        }
+        if (accounts.ledgerHead(row) != Ledger::NONE) stripes[stripeIndex(key)].closedHeads.assign(key, accounts.ledgerHead(row));
+        countInPortfolio(row, accounts.balance(row), -1);
+        accounts.erase(row);
+        if (accounts.needsCompaction()) {
+            accounts.compact();
+            index.clear();
+            for (uint32_t r = 0; r < accounts.rowCount(); r++) index.insert(accounts.number(r).key(), r);
+        }
+        return TxnStatus::Ok;
+    }
+
+    TxnStatus applyDeposit(uint32_t row, Cents amount, int64_t time, LedgerKind kind, BalanceChange* change) {
+        if (amount <= 0) return TxnStatus::InvalidAmount;
+        if (row == AccountStore::NO_ROW) return TxnStatus::NotFound;
+
+        Cents oldBalance = accounts.balance(row), newBalance;
+        if (!addToBalance(oldBalance, amount, newBalance)) return TxnStatus::InvalidAmount;
+        accounts.balance(row) = newBalance;
+        balanceChanged(row, oldBalance);
+        recordLedger(row, kind, amount, accounts.balance(row), time);
+        if (change) *change = { oldBalance, accounts.balance(row), accounts.available(row) };
+        return TxnStatus::Ok;
+    }
+
+    // False if depositing amount would take the account at row past MAX_BALANCE
+    bool canCredit(uint32_t row, Cents amount) const {
+        Cents sum;
+        return addToBalance(accounts.balance(row), amount, sum);
+    }
+
+    TxnStatus applyWithdraw(uint32_t row, Cents amount, int64_t time, LedgerKind kind, BalanceChange* change) {
+        if (amount <= 0) return TxnStatus::InvalidAmount;
+        if (row == AccountStore::NO_ROW) return TxnStatus::NotFound;
+
+        Cents oldBalance = accounts.balance(row);
+        if (amount > accounts.available(row)) {
+            if (change) *change = { oldBalance, oldBalance, accounts.available(row) };
+            return TxnStatus::InsufficientFunds;
+        }
+
+        accounts.balance(row) = oldBalance - amount;
+        balanceChanged(row, oldBalance);
+        recordLedger(row, kind, -amount, accounts.balance(row), time);
+        if (change) *change = { oldBalance, accounts.balance(row), accounts.available(row) };
+        return TxnStatus::Ok;
+    }
+
+    // A journaled deposit (JournalOp::Deposit, TransferIn) or withdrawal (Withdraw, TransferOut) on one account
+    TxnStatus changeBalance(string_view accNum, Cents amount, JournalOp op, LedgerKind kind, BankOp metric,
+                            BalanceChange* change) {
+        OpTimer timer(metrics, metric);
+        if (journalFailed()) return timer.finish(TxnStatus::IoError);
+        bool credit = op == JournalOp::Deposit || op == JournalOp::TransferIn;
+        uint64_t seq = 0;
+        TxnStatus status;
+        {
+            shared_lock<shared_mutex> structure(structureMutex);
+            uint32_t row = findRow(accNum);
+            if (row == AccountStore::NO_ROW) return timer.finish(amount <= 0 ? TxnStatus::InvalidAmount : TxnStatus::NotFound);
+            lock_guard<mutex> stripe(stripeFor(accounts.number(row).key()));
+            int64_t time = wallClockMicros();
+            status = credit ? applyDeposit(row, amount, time, kind, change) : applyWithdraw(row, amount, time, kind, change);
+            if (status == TxnStatus::Ok) seq = journalAppend(op, accNum, amount, time);
+        }
+        if (status == TxnStatus::Ok && !commitJournal(seq)) status = TxnStatus::IoError;
+        return timer.finish(status);
+    }
+
+    // One applyBatch request, with the same checks in the same order as tryDeposit, tryWithdraw and
+    // tryTransfer; `seq` is advanced past its journal record. Caller holds structureMutex exclusively.
+    TxnStatus applyRequestLocked(const TxnRequest& request, int64_t time, BalanceChange& change, uint64_t& seq) {
+        static const BankOp ops[] = { BankOp::Deposit, BankOp::Withdraw, BankOp::Transfer };
+        OpTimer timer(metrics, ops[static_cast<size_t>(request.op)]);
+        auto rowOf = [&](const AccountNumber& number) {
+            return number.empty() ? AccountStore::NO_ROW : index.find(number.key());
+        };
+        uint32_t row = rowOf(request.account);
+        TxnStatus status;
+        switch (request.op) {
+        case TxnOp::Deposit:
+            status = applyDeposit(row, request.amount, time, LedgerKind::Deposit, &change);
+            if (status == TxnStatus::Ok && journal.isOpen())
+                seq = journalAppend(JournalOp::Deposit, request.account.view(), request.amount, time);
+            break;
+        case TxnOp::Withdraw:
+            status = applyWithdraw(row, request.amount, time, LedgerKind::Withdraw, &change);
+            if (status == TxnStatus::Ok && journal.isOpen())
+                seq = journalAppend(JournalOp::Withdraw, request.account.view(), request.amount, time);
+            break;
+        case TxnOp::Transfer: {
+            uint32_t target = rowOf(request.target);
+            if (request.amount <= 0) status = TxnStatus::InvalidAmount;
+            else if (row == AccountStore::NO_ROW || target == AccountStore::NO_ROW) status = TxnStatus::NotFound;
+            else if (row == target) status = TxnStatus::SameAccount;
+            else if (!canCredit(target, request.amount)) status = TxnStatus::InvalidAmount;
+            else status = applyWithdraw(row, request.amount, time, LedgerKind::TransferOut, &change);
+            if (status != TxnStatus::Ok) break;
+            applyDeposit(target, request.amount, time, LedgerKind::TransferIn, nullptr);
+            if (journal.isOpen())
+                seq = journal.append(makeJournalRecord(JournalOp::Transfer, request.account.view(), request.amount, time),
+                                     request.target.view());
+            break;
+        }
+        default:
+            status = TxnStatus::InvalidAmount;
+        }
+        return timer.finish(status);
+    }
+
+    // Rows per interest task: enough that running a chunk far outweighs claiming it
+    static const size_t INTEREST_CHUNK_ROWS = 1 << 16;
+
+    WorkerPool& interestWorkers() {
+        if (!interestPool) {
+            size_t threads = options.interestThreads ? options.interestThreads : max<size_t>(1, thread::hardware_concurrency());
+            interestPool = make_unique<WorkerPool>(threads);
+        }
+        return *interestPool;
+    }
+
+    // Posts one period of interest to every savings account; the caller holds the exclusive lock.
+    // The rows are split into fixed chunks shared out over the interest workers. Non-savings and
+    // dead rows have rate 0, so within a chunk the kernel runs straight down the balance and rate
+    // columns; the rare savings row outside the kernel's range is credited on its own with the
+    // same rounding, and the kernel resumes after it. Rows are independent and the chunks'
+    // portfolio sums are added in chunk order, so balances and totals do not depend on the
+    // thread count. The credits then go to the ledger, each stripe's in row order by one task.
+    size_t accrueInterestLocked(int periodsPerYear, int64_t time) {
+        if (periodsPerYear <= 0 || periodsPerYear > MAX_PERIODS_PER_YEAR) return 0;
+        size_t credited = accounts.countOf(AccountKind::Savings);
+        if (credited == 0) return 0;
+        Cents* balances = accounts.balanceData();
+        const RatePpm* rates = accounts.rateData();
+        size_t rows = accounts.rowCount();
+        size_t chunks = (rows + INTEREST_CHUNK_ROWS - 1) / INTEREST_CHUNK_ROWS;
+        size_t savings = static_cast<size_t>(AccountKind::Savings);
+        vector<Cents> before(options.ledger ? rows : 0);
+        vector<uint8_t> rowStripe(options.ledger ? rows : 0);
+        vector<PortfolioSums> shares(chunks);
+        WorkerPool& workers = interestWorkers();
+        workers.run(chunks, [&](size_t chunk) {
+            size_t begin = chunk * INTEREST_CHUNK_ROWS, end = min(rows, begin + INTEREST_CHUNK_ROWS);
+            // Only savings rows have a rate, so the chunk's portfolio share is taken off before the
+            // run and added back after it; the net change goes to stripe 0
+            PortfolioSums& share = shares[chunk];
+            auto addShare = [&](Cents sign) {
+                for (size_t row = begin; row < end; row++) {
+                    if (rates[row] == 0) continue;
+                    share.liabilities[savings] += sign * balances[row];
+                    share.deposits += sign * max<Cents>(balances[row], 0);
+                    share.balanceRate += sign * static_cast<__int128>(balances[row]) * rates[row];
+                }
+            };
+            addShare(-1);
+            if (options.ledger) copy(balances + begin, balances + end, before.begin() + begin);
+            size_t start = begin;
+            for (size_t row = begin; row < end; row++) {
+                bool inRange = rates[row] == 0
+                    || (balances[row] >= 0 && balances[row] <= MAX_KERNEL_BALANCE && rates[row] > 0 && rates[row] <= 1000000);
+                if (inRange) continue;
+                accrueInterestKernel(balances + start, rates + start, row - start, periodsPerYear);
+                balances[row] = min(balances[row] + interestFor(balances[row], rates[row], periodsPerYear), MAX_BALANCE);
+                start = row + 1;
+            }
+            accrueInterestKernel(balances + start, rates + start, end - start, periodsPerYear);
+            addShare(1);
+            if (!options.ledger) return;
+            for (size_t row = begin; row < end; row++) {
+                if (balances[row] != before[row]) rowStripe[row] = static_cast<uint8_t>(stripeIndex(accounts.number(row).key()));
+            }
+        });
+        PortfolioSums& sums = stripes[0].portfolio;
+        for (const PortfolioSums& share : shares) {
+            sums.liabilities[savings] += share.liabilities[savings];
+            sums.deposits += share.deposits;
+            sums.balanceRate += share.balanceRate;
+        }
+        if (options.ledger) {
+            // Task g appends to the stripes s with s % groups == g, so no stripe's ledger is shared
+            size_t groups = min(workers.size(), size_t{ LOCK_STRIPES });
+            workers.run(groups, [&](size_t group) {
+                for (size_t row = 0; row < rows; row++) {
+                    if (balances[row] != before[row] && rowStripe[row] % groups == group)
+                        recordLedger(static_cast<uint32_t>(row), LedgerKind::Interest, balances[row] - before[row], balances[row], time);
+                }
+            });
+        }
+        allChanged = true;
+        dropSecondaryIndexes();
+        return credited;
+    }
+
+    // One journaled interest posting stamped with now(), read once the exclusive lock is held.
+    // IoError if the journal failed before or while it was committed; `credited` is set only on Ok.
+    template <typename Clock>
+    TxnStatus postInterest(int periodsPerYear, Clock now, size_t* credited) {
+        if (periodsPerYear <= 0 || periodsPerYear > MAX_PERIODS_PER_YEAR) return TxnStatus::InvalidAmount;
+        if (journalFailed()) return TxnStatus::IoError;
+        uint64_t seq = 0;
+        size_t count;
+        {
+            unique_lock<shared_mutex> structure(structureMutex);
+            int64_t time = now();
+            count = accrueInterestLocked(periodsPerYear, time);
+            seq = journalAppend(JournalOp::AccrueInterest, "", periodsPerYear, time);
+        }
+        if (!commitJournal(seq)) return TxnStatus::IoError;
+        if (credited) *credited = count;
+        return TxnStatus::Ok;
+    }
+
+    static JournalRecord makeJournalRecord(JournalOp op, string_view number, int64_t amount, int64_t time) {
+        JournalRecord rec = {};
+        rec.op = static_cast<uint8_t>(op);
+        rec.numberLength = static_cast<uint8_t>(number.size());
+        memcpy(rec.number, number.data(), number.size());
+        rec.amount = amount;
+        rec.time = time;
+        return rec;
+    }
+
+    bool checkpointDue() const {
+        return options.checkpointInterval && journal.recordCount() >= options.checkpointInterval;
+    }
+
+    // Called after the account locks are released: waits for the record's group commit if acks
+    // are durable, and checkpoints when the journal is long. False once the journal has failed:
+    // the change may not survive a restart, so the caller reports TxnStatus::IoError.
+    bool commitJournal(uint64_t seq) {
+        bool durable = !options.durableAcks || !seq || journal.waitDurable(seq);
+        if (!durable || journalFailed()) {
+            if (!journalErrorReported.test_and_set())
+                cout << "Error: Journal write failed; further changes are refused." << endl;
+            return false;
+        }
+        if (checkpointDue() && !snapshotRunning) checkpoint(false, true);
+        return true;
+    }
+
+    // Set for good by a failed journal write or restart; mutators then refuse with IoError. A
+    // journal that could not be opened at startup is closed instead, and changes are saved on exit.
+    bool journalFailed() const { return journal.isOpen() && journal.hasFailed(); }
+
+    // Turns the Ok results of a batch into IoError when its journal commit failed
+    static void failUncommitted(vector<TxnStatus>& results) {
+        replace(results.begin(), results.end(), TxnStatus::Ok, TxnStatus::IoError);
+    }
+
+    // Appends a record if journaling is on; the caller holds the locks that order it
+    uint64_t journalAppend(JournalOp op, string_view accNum, Cents amount, int64_t time) {
+        return journal.isOpen() ? journal.append(makeJournalRecord(op, accNum, amount, time)) : 0;
+    }
+
+    static JournalRecord makeLegRecord(JournalOp op, const PreparedLeg& leg, uint8_t flags, int64_t time) {
+        JournalRecord rec = makeJournalRecord(op, leg.number.view(), leg.amount, time);
+        rec.kind = flags;
+        return rec;
+    }
+
+    static string legTail(uint64_t txn) { return string(reinterpret_cast<const char*>(&txn), sizeof(txn)); }
+
+    // The legs still prepared, as the records that start the next journal generation
+    vector<pair<JournalRecord, string>> carriedLegs() const {
+        vector<pair<JournalRecord, string>> records;
+        int64_t time = wallClockMicros();
+        for (const auto& leg : preparedLegs) {
+            uint8_t flags = LEG_CARRIED | (leg.second.outgoing ? LEG_OUTGOING : 0);
+            records.emplace_back(makeLegRecord(JournalOp::PrepareLeg, leg.second, flags, time), legTail(leg.first));
+        }
+        return records;
+    }
+
+    // Caller holds the account's stripe and legMutex (or is loading)
+    void addLegLocked(uint64_t txn, const PreparedLeg& leg) {
+        if (preparedLegs.emplace(txn, leg).second) legPins[leg.number.key()]++;
+    }
+
+    void rememberAbortLocked(uint64_t txn) {
+        if (!abortedTxns.insert(txn).second) return;
+        if (abortedOrder.size() < ABORTED_KEPT) {
+            abortedOrder.push_back(txn);
+            return;
+        }
+        abortedTxns.erase(abortedOrder[abortedNext]);
+        abortedOrder[abortedNext] = txn;
+        abortedNext = (abortedNext + 1) % ABORTED_KEPT;
+    }
+
+    bool takeLegLocked(uint64_t txn, PreparedLeg& leg) {
+        auto it = preparedLegs.find(txn);
+        if (it == preparedLegs.end()) return false;
+        leg = it->second;
+        preparedLegs.erase(it);
+        auto pin = legPins.find(leg.number.key());
+        if (pin != legPins.end() && --pin->second == 0) legPins.erase(pin);
+        return true;
+    }
+
+    // Replays a PrepareLeg or SettleLeg record; with `moveMoney` false (a record the loaded files
+    // already hold) only the set of prepared legs changes
+    void applyLegRecord(const JournalRecord& rec, string_view tail, bool moveMoney) {
+        uint64_t txn;
+        if (tail.size() < sizeof(txn)) return;
+        memcpy(&txn, tail.data(), sizeof(txn));
+        string_view number(rec.number, rec.numberLength);
+        if (rec.op == static_cast<uint8_t>(JournalOp::PrepareLeg)) {
+            PreparedLeg leg{ AccountNumber(number), rec.amount, (rec.kind & LEG_OUTGOING) != 0 };
+            if (moveMoney && leg.outgoing && !(rec.kind & LEG_CARRIED)
+                && applyWithdraw(findRow(number), leg.amount, rec.time, LedgerKind::TransferOut, nullptr) != TxnStatus::Ok)
+                return;
+            addLegLocked(txn, leg);
+        } else if (rec.op == static_cast<uint8_t>(JournalOp::SettleLeg)) {
+            PreparedLeg leg;
+            if (takeLegLocked(txn, leg) && moveMoney && (rec.kind & LEG_COMMIT) != leg.outgoing)
+                applyDeposit(findRow(leg.number.view()), leg.amount, rec.time, LedgerKind::TransferIn, nullptr);
+        }
+    }
+
+    // Converts a double stored by an older format (dollars, or percent for a savings rate) to cents/ppm
+    static int64_t fromLegacyDouble(int64_t bits, bool isRate) {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return isRate ? toRatePpm(value) : toCents(value);
+    }
+
+    void applyJournalRecord(const JournalRecord& rec, string_view tail, uint32_t version) {
+        string_view number(rec.number, rec.numberLength);
+        int64_t time = rec.time ? rec.time : wallClockMicros(); // older journals kept no time
+        bool legacy = version < JOURNAL_FIRST_CENTS_VERSION;
+        Cents amount = legacy && rec.op != static_cast<uint8_t>(JournalOp::AccrueInterest)
+            ? fromLegacyDouble(rec.amount, false) : rec.amount;
+        switch (static_cast<JournalOp>(rec.op)) {
+        case JournalOp::Create: {
+            if (tail.size() < sizeof(int64_t)) break;
+            int64_t parameter;
+            memcpy(&parameter, tail.data(), sizeof(parameter));
+            AccountKind kind = static_cast<AccountKind>(rec.kind);
+            if (legacy) parameter = fromLegacyDouble(parameter, kind == AccountKind::Savings);
+            openAccount(kind, number, tail.substr(sizeof(int64_t)), amount, parameter, time);
+            break;
+        }
+        case JournalOp::Deposit:
+            applyDeposit(findRow(number), amount, time, LedgerKind::Deposit, nullptr);
+            break;
+        case JournalOp::Withdraw:
+            applyWithdraw(findRow(number), amount, time, LedgerKind::Withdraw, nullptr);
+            break;
+        case JournalOp::TransferOut:
+            applyWithdraw(findRow(number), amount, time, LedgerKind::TransferOut, nullptr);
+            break;
+        case JournalOp::TransferIn:
+            applyDeposit(findRow(number), amount, time, LedgerKind::TransferIn, nullptr);
+            break;
+        case JournalOp::Transfer: {
+            uint32_t from = findRow(number), to = findRow(tail);
+            if (to != AccountStore::NO_ROW && applyWithdraw(from, amount, time, LedgerKind::TransferOut, nullptr) == TxnStatus::Ok)
+                applyDeposit(to, amount, time, LedgerKind::TransferIn, nullptr);
+            break;
+        }
+        case JournalOp::AccrueInterest:
+            accrueInterestLocked(static_cast<int>(rec.amount), time);
+            break;
+        case JournalOp::Delete: {
+            uint64_t key;
+            if (AccountNumber::pack(number, key)) closeAccount(key, time);
+            break;
+        }
+        case JournalOp::PrepareLeg:
+        case JournalOp::SettleLeg:
+            applyLegRecord(rec, tail, true);
+            break;
+        }
+    }
+
+    // Replays the journal that continues the loaded snapshot, then keeps appending to it (unless read-only)
+    void openJournal() {
+        uint64_t validLength = 0;
+        size_t records = 0;
+        uint32_t replayedVersion = JOURNAL_VERSION;
+        bool matched = false;
+        if (options.autoLoad) {
+            auto restoreLeg = [this](const JournalRecord& rec, string_view tail) { applyLegRecord(rec, tail, false); };
+            matched = Journal::replay(options.journalFile, journalGeneration, journalSkip, validLength, records,
+                [this, &replayedVersion](const JournalRecord& rec, string_view tail, uint32_t version) {
+                    replayedVersion = version;
+                    applyJournalRecord(rec, tail, version);
+                }, restoreLeg);
+            if (matched && records > journalSkip) cout << records - journalSkip << " journal records replayed." << endl;
+            // A checkpoint cut off before it restarted the journal leaves the previous generation's:
+            // the loaded files hold all of it, but the transfer legs it prepared are still undecided
+            uint64_t ignoredLength;
+            size_t ignoredRecords;
+            if (!matched && journalGeneration > 0)
+                Journal::replay(options.journalFile, journalGeneration - 1, numeric_limits<size_t>::max(), ignoredLength,
+                                ignoredRecords, nullptr, restoreLeg);
+        }
+        if (options.readOnly) return;
+        if (!journal.open(options.journalFile, journalGeneration, validLength, records, options.groupCommitWindow)) {
+            cout << "Error: Could not open journal " << options.journalFile << "; changes will only be saved on exit." << endl;
+            return;
+        }
+        if (!matched && !preparedLegs.empty() && !journal.reset(journalGeneration, carriedLegs())) {
+            journal.close();
+            cout << "Error: Could not restart journal " << options.journalFile << "; changes will only be saved on exit." << endl;
+            return;
+        }
+        // New records must not be appended to a journal written in an older format
+        if (replayedVersion != JOURNAL_VERSION && !checkpoint()) {
+            journal.close();
+            cout << "Error: Could not upgrade journal " << options.journalFile << "; changes will only be saved on exit." << endl;
+            return;
+        }
+        // Nor to one holding fewer records than the snapshot says it already has (lost or cut short
+        // in a crash): they would land where the next load skips. A full save starts a new journal.
+        if (records < journalSkip) {
+            cout << "Error: Journal " << options.journalFile << " is missing records the snapshot expects; saving a new snapshot." << endl;
+            allChanged = true;
+            if (!checkpoint()) {
+                journal.close();
+                cout << "Error: Could not restart journal " << options.journalFile << "; changes will only be saved on exit." << endl;
+            }
+        }
+    }
+
+    // The live rows as snapshot records and a name heap, ready to be written without holding a lock
+    struct SnapshotImage {
+        vector<SnapshotRecord> records;
+        string heap;
+
+        uint64_t fileSize() const { return sizeof(SnapshotHeader) + records.size() * sizeof(SnapshotRecord) + heap.size(); }
+    };
+
+    // One row as a snapshot record whose name is at nameOffset in the heap
+    SnapshotRecord makeSnapshotRecord(uint32_t row, uint64_t nameOffset) const {
+        SnapshotRecord rec = {};
+        string_view number = accounts.number(row).view();
+        memcpy(rec.number, number.data(), number.size());
+        rec.numberLength = static_cast<uint8_t>(number.size());
+        rec.kind = static_cast<uint8_t>(accounts.kind(row));
+        rec.nameOffset = static_cast<uint32_t>(nameOffset);
+        rec.nameLength = static_cast<uint32_t>(accounts.name(row).size());
+        rec.balance = accounts.balance(row);
+        rec.parameter = accounts.parameter(row);
+        return rec;
+    }
+
+    // One row as a snapshot record; its name is appended to heap
+    SnapshotRecord makeSnapshotRecord(uint32_t row, string& heap) const {
+        SnapshotRecord rec = makeSnapshotRecord(row, heap.size());
+        heap.append(accounts.name(row));
+        return rec;
+    }
+
+    // Writes the live rows straight to a new snapshot file through a stack buffer. It allocates
+    // nothing and takes no locks, so it is safe in a child forked from a multithreaded process.
+    bool writeSnapshotFile(const char* path, uint64_t generation, uint64_t skip) const {
+        int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.recordSize = sizeof(SnapshotRecord);
+        header.recordCount = accounts.size();
+        header.journalGeneration = generation;
+        header.journalSkip = skip;
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (accounts.isLive(row)) header.heapSize += accounts.name(row).size();
+        }
+
+        char buffer[64 << 10];
+        size_t used = 0;
+        off_t offset = 0;
+        bool ok = true;
+        auto put = [&](const char* data, size_t n) {
+            if (used + n > sizeof(buffer)) {
+                ok = ok && writeAllAt(fd, buffer, used, offset);
+                offset += static_cast<off_t>(used);
+                used = 0;
+            }
+            if (n > sizeof(buffer)) {
+                ok = ok && writeAllAt(fd, data, n, offset);
+                offset += static_cast<off_t>(n);
+            } else {
+                memcpy(buffer + used, data, n);
+                used += n;
+            }
+        };
+        put(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t nameOffset = 0;
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (!accounts.isLive(row)) continue;
+            SnapshotRecord rec = makeSnapshotRecord(row, nameOffset);
+            put(reinterpret_cast<const char*>(&rec), sizeof(rec));
+            nameOffset += rec.nameLength;
+        }
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (accounts.isLive(row)) put(accounts.name(row).data(), accounts.name(row).size());
+        }
+        ok = ok && writeAllAt(fd, buffer, used, offset) && fdatasync(fd) == 0;
+        return ::close(fd) == 0 && ok;
+    }
+
+    // Runs on the compaction thread. Under the exclusive lock, forks a child that writes the
+    // accounts as they are now to a new snapshot continuing the current journal generation, past the
+    // records already appended to it; writers resume as soon as fork returns, and the changes tracked
+    // from then on are those since the new snapshot (the journal covers them until it is in place).
+    // The child is killed if this thread dies first, so a crashed process never has its files
+    // replaced behind its successor. The child first saves the unsaved ledger entries. Falls back to
+    // saveAllLocked if fork fails. The journal is synced before the fork: the snapshot says how many
+    // of its records it holds, and that many must be on disk for the next load to skip them.
+    bool writeForkedSnapshot(size_t& saved) {
+        string tempPath = options.snapshotFile + ".tmp", directory = directoryOf(options.snapshotFile);
+        pid_t child;
+        uint32_t ledgerFirst[LOCK_STRIPES], ledgerUpTo[LOCK_STRIPES];
+        uint64_t ledgerEntries, ledgerOffset;
+        {
+            lock_guard<mutex> writer(snapshotMutex);
+            unique_lock<shared_mutex> structure(structureMutex);
+            OpTimer pause(metrics, BankOp::Snapshot);
+            saved = accounts.size();
+            if (journal.isOpen()) journal.sync();
+            if (journal.hasFailed()) {
+                cout << "Error: Could not save to file." << endl;
+                return pause.finish(false);
+            }
+            uint64_t skip = journal.isOpen() ? journal.recordCount() : 0;
+            ledgerEntries = unsavedLedgerEntries(ledgerFirst);
+            for (size_t s = 0; s < LOCK_STRIPES; s++) ledgerUpTo[s] = stripes[s].ledger.size();
+            if (ledgerEntries > 0 && !openLedgerFile()) {
+                cout << "Error: Could not save to file." << endl;
+                return pause.finish(false);
+            }
+            ledgerOffset = ledgerLength;
+            pid_t parent = getpid();
+            child = fork();
+            if (child < 0) return pause.finish(saveAllLocked(false));
+            if (child == 0) {
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                bool written = getppid() == parent
+                    && (ledgerEntries == 0 || writeLedgerSegment(ledgerOffset, journalGeneration, skip, ledgerFirst))
+                    && writeSnapshotFile(tempPath.c_str(), journalGeneration, skip)
+                    && rename(tempPath.c_str(), options.snapshotFile.c_str()) == 0;
+                // Once renamed the snapshot is the one a restart reads, so a failed directory sync
+                // only gets reported (status 2)
+                _exit(!written ? 1 : syncDirectory(directory.c_str()) ? 0 : 2);
+            }
+            accounts.clearDirty();
+            for (LockStripe& stripe : stripes) stripe.changedKeys.clear();
+            deletedNumbers.clear();
+            deltaBase = true; // track changes from the forked image on
+            allChanged = false;
+            pause.finish(true);
+        }
+
+        int status = 0;
+        while (waitpid(child, &status, 0) < 0 && errno == EINTR) {}
+        bool written = WIFEXITED(status) && (WEXITSTATUS(status) == 0 || WEXITSTATUS(status) == 2);
+        if (written && WEXITSTATUS(status) == 2) cout << "Error: Could not sync the directory of " << options.snapshotFile << "." << endl;
+        unique_lock<shared_mutex> structure(structureMutex);
+        if (!written) {
+            allChanged = true; // what changed before the fork is no longer tracked
+            cout << "Error: Could not save to file." << endl;
+            return false;
+        }
+        if (ledgerEntries > 0) {
+            ledgerLength = ledgerOffset + ledgerSegmentSize(ledgerEntries);
+            for (size_t s = 0; s < LOCK_STRIPES; s++) stripes[s].ledgerSaved = ledgerUpTo[s];
+        }
+        // The delta file only held changes the new snapshot has
+        struct stat info;
+        snapshotLength = stat(options.snapshotFile.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+        closeDelta();
+        unlink(options.deltaFile.c_str());
+        deltaLength = 0;
+        return true;
+    }
+
+    // Asks the compaction thread for a forked snapshot, or joins the one already under way; with
+    // wait, returns once it is in place and whether it was saved
+    bool requestSnapshot(bool report, bool wait) {
+        unique_lock<mutex> lock(compactMutex);
+        if (!snapshotRunning) {
+            snapshotRunning = true;
+            snapshotRequested = true;
+            reportSnapshot = false;
+            if (!compactor.joinable()) compactor = thread(&BankSystem::compactionLoop, this);
+            compactWake.notify_one();
+        }
+        reportSnapshot = reportSnapshot || report;
+        if (!wait) return true;
+        snapshotDone.wait(lock, [this] { return !snapshotRunning; });
+        return snapshotSaved;
+    }
+
+    // Blocks until no forked snapshot is running; returns whether the last one was saved
+    bool waitForSnapshot() {
+        unique_lock<mutex> lock(compactMutex);
+        snapshotDone.wait(lock, [this] { return !snapshotRunning; });
+        return snapshotSaved;
+    }
+
+    // Caller holds structureMutex
+    SnapshotImage captureSnapshot() const {
+        SnapshotImage image;
+        image.records.reserve(accounts.size());
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (accounts.isLive(row)) image.records.push_back(makeSnapshotRecord(row, image.heap));
+        }
+        return image;
+    }
+
+    // Changes queued since the last save (an upper bound: a key can be queued more than once)
+    size_t pendingChanges() const {
+        size_t count = deletedNumbers.size();
+        for (const LockStripe& stripe : stripes) count += stripe.changedKeys.size();
+        return count;
+    }
+
+    // A full snapshot is cheaper than a delta once half the accounts changed
+    bool fullSaveDue() const {
+        return !deltaBase || allChanged || pendingChanges() * 2 > accounts.size();
+    }
+
+    bool compactionDue() const {
+        return options.compactionRatio > 0 && deltaLength >= MIN_COMPACTION_BYTES
+            && deltaLength >= options.compactionRatio * snapshotLength;
+    }
+
+    static DeltaHeader makeDeltaHeader() {
+        DeltaHeader header = {};
+        memcpy(header.magic, DELTA_MAGIC, sizeof(header.magic));
+        header.version = DELTA_VERSION;
+        return header;
+    }
+
+    void closeDelta() {
+        if (deltaFd >= 0) ::close(deltaFd);
+        deltaFd = -1;
+    }
+
+    // Opens the ledger file for appending after its intact part, cutting off any segments the loaded
+    // files did not reach. The file and its header are created on first use, with a directory sync.
+    bool openLedgerFile() {
+        if (ledgerFd >= 0) return true;
+        ledgerFd = ::open(options.ledgerFile.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (ledgerFd < 0) return false;
+        if (ledgerLength < sizeof(LedgerHeader)) {
+            LedgerHeader header = {};
+            memcpy(header.magic, LEDGER_MAGIC, sizeof(header.magic));
+            header.version = LEDGER_VERSION;
+            if (!writeAllAt(ledgerFd, reinterpret_cast<const char*>(&header), sizeof(header), 0)
+                || !syncDirectory(directoryOf(options.ledgerFile).c_str()))
+                return false;
+            ledgerLength = sizeof(header);
+        }
+        return ftruncate(ledgerFd, static_cast<off_t>(ledgerLength)) == 0;
+    }
+
+    void closeLedger() {
+        if (ledgerFd >= 0) ::close(ledgerFd);
+        ledgerFd = -1;
+    }
+
+    // Writes each stripe's ledger entries from first[stripe] on to the ledger file at offset as one
+    // segment tagged with the journal position it saves through, then syncs. It goes through a stack
+    // buffer and allocates nothing, so a forked snapshot child can write it too. Returns whether the
+    // segment (of ledgerSegmentSize bytes) was written.
+    bool writeLedgerSegment(uint64_t offset, uint64_t generation, uint64_t skip, const uint32_t* first) const {
+        LedgerSegmentHeader header = {};
+        for (size_t s = 0; s < LOCK_STRIPES; s++) header.entryCount += stripes[s].ledger.size() - first[s];
+        header.size = ledgerSegmentSize(header.entryCount);
+        header.generation = generation;
+        header.journalSkip = skip;
+        uint32_t checksum = fnv1a(reinterpret_cast<const char*>(&header) + 4, sizeof(header) - 4);
+
+        char buffer[64 * 1024];
+        size_t used = 0;
+        uint64_t position = offset + sizeof(header);
+        bool ok = true;
+        auto flush = [&] {
+            checksum = fnv1a(buffer, used, checksum);
+            ok = ok && writeAllAt(ledgerFd, buffer, used, static_cast<off_t>(position));
+            position += used;
+            used = 0;
+        };
+        auto put = [&](const void* data, size_t n) {
+            if (used + n > sizeof(buffer)) flush();
+            memcpy(buffer + used, data, n);
+            used += n;
+        };
+        auto putColumn = [&](auto value) {
+            for (size_t s = 0; s < LOCK_STRIPES; s++) {
+                const Ledger& ledger = stripes[s].ledger;
+                for (uint32_t entry = first[s]; entry < ledger.size(); entry++) {
+                    auto v = value(ledger, entry);
+                    put(&v, sizeof(v));
+                }
+            }
+        };
+        putColumn([](const Ledger& ledger, uint32_t entry) { return ledger.keyAt(entry); });
+        putColumn([](const Ledger& ledger, uint32_t entry) { return ledger.timeAt(entry); });
+        putColumn([](const Ledger& ledger, uint32_t entry) { return ledger.amountAt(entry); });
+        putColumn([](const Ledger& ledger, uint32_t entry) { return ledger.balanceAt(entry); });
+        putColumn([](const Ledger& ledger, uint32_t entry) { return ledger.kindAt(entry); });
+        static const char padding[8] = {};
+        put(padding, (8 - header.entryCount % 8) % 8);
+        flush();
+        header.checksum = checksum;
+        return ok && writeAllAt(ledgerFd, reinterpret_cast<const char*>(&header), sizeof(header), static_cast<off_t>(offset))
+            && fdatasync(ledgerFd) == 0;
+    }
+
+    // Ledger entries not yet in the ledger file (none without one); first[stripe] is where each
+    // stripe's begin
+    uint64_t unsavedLedgerEntries(uint32_t* first) const {
+        uint64_t entries = 0;
+        for (size_t s = 0; s < LOCK_STRIPES; s++) {
+            first[s] = stripes[s].ledgerSaved;
+            entries += stripes[s].ledger.size() - first[s];
+        }
+        return options.ledger && !options.ledgerFile.empty() ? entries : 0;
+    }
+
+    // Saves the ledger entries added since the last save as one segment, before the snapshot or delta
+    // batch that moves past their journal records. Caller holds structureMutex exclusively.
+    bool saveLedgerLocked(uint64_t generation, uint64_t skip) {
+        uint32_t first[LOCK_STRIPES];
+        uint64_t entries = unsavedLedgerEntries(first);
+        if (entries == 0) return true;
+        if (!openLedgerFile() || !writeLedgerSegment(ledgerLength, generation, skip, first)) return false;
+        ledgerLength += ledgerSegmentSize(entries);
+        for (LockStripe& stripe : stripes) stripe.ledgerSaved = stripe.ledger.size();
+        return true;
+    }
+
+    // Loads the ledger segments up to the journal position the loaded files reached; later ones
+    // hold changes the journal is about to replay. Called before the journal is opened.
+    void loadLedger() {
+        ledgerLength = 0;
+        MappedFile file(options.ledgerFile);
+        const LedgerHeader* header = reinterpret_cast<const LedgerHeader*>(file.data());
+        if (file.empty() || file.size() < sizeof(LedgerHeader)) return;
+        if (memcmp(header->magic, LEDGER_MAGIC, sizeof(header->magic)) != 0 || header->version != LEDGER_VERSION) {
+            cout << "Error: " << options.ledgerFile << " is not a bank ledger; account history starts over." << endl;
+            return;
+        }
+        unique_lock<shared_mutex> structure(structureMutex);
+        size_t offset = sizeof(LedgerHeader);
+        while (offset + sizeof(LedgerSegmentHeader) <= file.size()) {
+            LedgerSegmentHeader segment;
+            memcpy(&segment, file.data() + offset, sizeof(segment));
+            uint64_t n = segment.entryCount;
+            if (n > file.size() / 32 || segment.size != ledgerSegmentSize(n) || segment.size > file.size() - offset
+                || fnv1a(file.data() + offset + 4, segment.size - 4) != segment.checksum
+                || tie(segment.generation, segment.journalSkip) > tie(journalGeneration, journalSkip))
+                break;
+
+            const char* columns = file.data() + offset + sizeof(segment);
+            for (uint64_t i = 0; i < n; i++) {
+                uint64_t key;
+                int64_t time;
+                Cents amount, balance;
+                memcpy(&key, columns + i * 8, 8);
+                memcpy(&time, columns + (n + i) * 8, 8);
+                memcpy(&amount, columns + (2 * n + i) * 8, 8);
+                memcpy(&balance, columns + (3 * n + i) * 8, 8);
+                LedgerKind kind = static_cast<LedgerKind>(columns[4 * n * 8 + i]);
+                uint32_t row = index.find(key);
+                if (row != AccountStore::NO_ROW) {
+                    recordLedger(row, kind, amount, balance, time);
+                } else {
+                    LockStripe& stripe = stripes[stripeIndex(key)];
+                    stripe.closedHeads.assign(key, stripe.ledger.append(key, stripe.closedHeads.find(key), kind, amount, balance, time));
+                }
+            }
+            offset += segment.size;
+        }
+        ledgerLength = offset;
+        for (LockStripe& stripe : stripes) stripe.ledgerSaved = stripe.ledger.size();
+    }
+
+    // Gives each account loaded without ledger history (from files older than the ledger, or loaded
+    // after the bank started) its balance as an opening entry, so every history adds up to the balance
+    void seedLedger() {
+        unique_lock<shared_mutex> structure(structureMutex);
+        seedLedgerLocked();
+    }
+
+    void seedLedgerLocked() {
+        int64_t time = wallClockMicros();
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (!accounts.isLive(row)) continue;
+            uint32_t head = accounts.ledgerHead(row);
+            if (head == Ledger::NONE || stripes[stripeIndex(accounts.number(row).key())].ledger.kindAt(head) == LedgerKind::Close)
+                recordLedger(row, LedgerKind::Open, accounts.balance(row), accounts.balance(row), time);
+        }
+    }
+
+    // Writes a batch after the intact part of the delta file (cutting off anything beyond it, such as
+    // a torn batch) and syncs it. The file and its header are created on first use, and the
+    // directory is synced so the new file survives the journal reset that follows.
+    bool appendDelta(const string& batch) {
+        if (deltaFd < 0) {
+            deltaFd = ::open(options.deltaFile.c_str(), O_WRONLY | O_CREAT, 0644);
+            if (deltaFd < 0) return false;
+        }
+        if (deltaLength < sizeof(DeltaHeader)) {
+            DeltaHeader header = makeDeltaHeader();
+            if (!writeAllAt(deltaFd, reinterpret_cast<const char*>(&header), sizeof(header), 0)
+                || !syncDirectory(directoryOf(options.deltaFile).c_str()))
+                return false;
+            deltaLength = sizeof(header);
+        }
+        if (ftruncate(deltaFd, static_cast<off_t>(deltaLength)) != 0
+            || !writeAllAt(deltaFd, batch.data(), batch.size(), static_cast<off_t>(deltaLength)) || fdatasync(deltaFd) != 0)
+            return false;
+        deltaLength += batch.size();
+        return true;
+    }
+
+    // Calls visit(batch, start) for each intact batch of a mapped delta file in order, until visit
+    // returns false or a batch is torn or corrupt. Returns the length of the intact part.
+    static uint64_t walkDeltaBatches(const MappedFile& file, const function<bool(const DeltaBatchHeader&, const char*)>& visit) {
+        uint64_t offset = sizeof(DeltaHeader);
+        while (offset + sizeof(DeltaBatchHeader) <= file.size()) {
+            DeltaBatchHeader batch;
+            memcpy(&batch, file.data() + offset, sizeof(batch));
+            if (batch.size < sizeof(batch) || batch.size > file.size() - offset
+                || batch.recordCount > (batch.size - sizeof(batch)) / sizeof(SnapshotRecord)
+                || fnv1a(file.data() + offset + 4, batch.size - 4) != batch.checksum
+                || !visit(batch, file.data() + offset))
+                break;
+            offset += batch.size;
+        }
+        return offset;
+    }
+
+    // Deletions remove the account; other records replace it in place or add it
+    void applyDeltaBatch(const DeltaBatchHeader& batch, const char* start) {
+        const char* records = start + sizeof(batch);
+        const char* heap = records + batch.recordCount * sizeof(SnapshotRecord);
+        uint64_t heapSize = batch.size - sizeof(batch) - batch.recordCount * sizeof(SnapshotRecord);
+        for (uint64_t i = 0; i < batch.recordCount; i++) {
+            SnapshotRecord rec;
+            memcpy(&rec, records + i * sizeof(rec), sizeof(rec)); // batches are not 8-byte aligned
+            if (rec.numberLength > AccountNumber::MAX_DIGITS || uint64_t(rec.nameOffset) + rec.nameLength > heapSize) continue;
+            string_view number(rec.number, rec.numberLength), name(heap + rec.nameOffset, rec.nameLength);
+
+            AccountKind kind = static_cast<AccountKind>(rec.kind);
+            uint32_t row = findRow(number);
+            if (kind == AccountKind::None) {
+                if (row != AccountStore::NO_ROW) removeAccount(accounts.number(row).key());
+            } else if (row == AccountStore::NO_ROW) {
+                insertAccount(kind, number, name, rec.balance, rec.parameter);
+            } else if (kind == AccountKind::Basic || kind == AccountKind::Savings || kind == AccountKind::Checking) {
+                countInPortfolio(row, accounts.balance(row), -1);
+                accounts.assign(row, kind, name, rec.balance, rec.parameter);
+                countInPortfolio(row, rec.balance, 1);
+            }
+        }
+    }
+
+    // Applies the batches of a delta file that continue the loaded snapshot's generation and notes
+    // where its intact part ends, so the next batch goes there. Caller holds structureMutex.
+    bool loadDeltaFile(const string& path) {
+        MappedFile file(path);
+        deltaLength = 0;
+        if (file.size() < sizeof(DeltaHeader)) return true; // none yet, or torn before its first batch
+        const DeltaHeader* header = reinterpret_cast<const DeltaHeader*>(file.data());
+        if (memcmp(header->magic, DELTA_MAGIC, sizeof(header->magic)) != 0 || header->version != DELTA_VERSION) {
+            cout << "Error: Unsupported or corrupt delta file " << path << "." << endl;
+            return false;
+        }
+
+        uint64_t changes = 0;
+        deltaLength = walkDeltaBatches(file, [&](const DeltaBatchHeader& batch, const char* start) {
+            if (batch.generation > journalGeneration + 1) return false; // does not continue this snapshot
+            if (batch.generation == journalGeneration + 1) {
+                applyDeltaBatch(batch, start);
+                journalGeneration++;
+                journalSkip = 0;
+                changes += batch.recordCount;
+            }
+            return true; // older batches are already in the snapshot
+        });
+        if (changes > 0) cout << changes << " saved changes applied." << endl;
+        return true;
+    }
+
+    // Appends the accounts changed since the last save to the delta file as one batch of the next
+    // generation, then restarts the journal with it; the cost follows the number of changes, not
+    // accounts. Deletions come first and changed rows follow in display order, so loading rebuilds
+    // the same order. Caller holds structureMutex exclusively and has checked fullSaveDue().
+    bool saveChangesLocked(bool report) {
+        journal.sync();
+        sort(deletedNumbers.begin(), deletedNumbers.end(),
+             [](const AccountNumber& a, const AccountNumber& b) { return a.key() < b.key(); });
+        deletedNumbers.erase(unique(deletedNumbers.begin(), deletedNumbers.end(),
+                                    [](const AccountNumber& a, const AccountNumber& b) { return a.key() == b.key(); }),
+                             deletedNumbers.end());
+        vector<uint32_t> rows;
+        for (const LockStripe& stripe : stripes) {
+            for (uint64_t key : stripe.changedKeys) {
+                uint32_t row = index.find(key);
+                if (row != AccountStore::NO_ROW && accounts.isDirty(row)) rows.push_back(row);
+            }
+        }
+        sort(rows.begin(), rows.end());
+        rows.erase(unique(rows.begin(), rows.end()), rows.end());
+        if (rows.empty() && deletedNumbers.empty() && journal.recordCount() == 0) {
+            if (report) cout << "0 changed accounts saved." << endl;
+            return true;
+        }
+
+        vector<SnapshotRecord> records;
+        string heap;
+        records.reserve(deletedNumbers.size() + rows.size());
+        for (const AccountNumber& number : deletedNumbers) {
+            SnapshotRecord rec = {};
+            memcpy(rec.number, number.view().data(), number.view().size());
+            rec.numberLength = static_cast<uint8_t>(number.view().size());
+            records.push_back(rec);
+        }
+        for (uint32_t row : rows) records.push_back(makeSnapshotRecord(row, heap));
+
+        DeltaBatchHeader header = {};
+        header.size = sizeof(header) + records.size() * sizeof(SnapshotRecord) + heap.size();
+        header.generation = journalGeneration + 1;
+        header.recordCount = records.size();
+        string batch;
+        batch.reserve(header.size);
+        batch.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        batch.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(SnapshotRecord));
+        batch.append(heap);
+        header.checksum = fnv1a(batch.data() + 4, batch.size() - 4);
+        memcpy(&batch[0], &header.checksum, sizeof(header.checksum));
+        if (!saveLedgerLocked(journalGeneration + 1, 0) || !appendDelta(batch)) {
+            cout << "Error: Could not save to file." << endl;
+            return false;
+        }
+
+        journalGeneration++;
+        for (uint32_t row : rows) accounts.clearDirty(row);
+        for (LockStripe& stripe : stripes) stripe.changedKeys.clear();
+        deletedNumbers.clear();
+        if (report) cout << records.size() << " changed accounts saved." << endl;
+        if (journal.isOpen() && !journal.reset(journalGeneration, carriedLegs())) {
+            cout << "Error: Could not reset journal " << options.journalFile << "." << endl;
+            return false;
+        }
+        if (compactionDue()) requestCompaction();
+        return true;
+    }
+
+    // Writes a full snapshot naming the next generation and waits until it is on disk, then drops
+    // the delta file and restarts the journal. A crash between the steps is harmless: the older
+    // batches and journal no longer continue the snapshot's generation. Caller holds snapshotMutex
+    // and structureMutex exclusively.
+    bool saveAllLocked(bool report) {
+        journal.sync();
+        if (!saveLedgerLocked(journalGeneration + 1, 0)) {
+            cout << "Error: Could not save to file." << endl;
+            return false;
+        }
+        SnapshotImage image = captureSnapshot();
+        if (!writeSnapshotImage(options.snapshotFile, image, journalGeneration + 1, report)) return false;
+        journalGeneration++;
+        snapshotLength = image.fileSize();
+
+        closeDelta();
+        unlink(options.deltaFile.c_str());
+        deltaLength = 0;
+        accounts.clearDirty();
+        for (LockStripe& stripe : stripes) stripe.changedKeys.clear();
+        deletedNumbers.clear();
+        deltaBase = true;
+        allChanged = false;
+
+        if (journal.isOpen() && !journal.reset(journalGeneration, carriedLegs())) {
+            cout << "Error: Could not reset journal " << options.journalFile << "." << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Rewrites the delta file without the batches a snapshot of `generation` holds; batches saved
+    // while that snapshot was being written are kept. The snapshot must already be on disk: the
+    // batches it replaces are gone once this returns. Caller holds structureMutex exclusively.
+    void dropDeltasThrough(uint64_t generation) {
+        closeDelta();
+        DeltaHeader header = makeDeltaHeader();
+        string kept(reinterpret_cast<const char*>(&header), sizeof(header));
+        {
+            MappedFile file(options.deltaFile);
+            walkDeltaBatches(file, [&](const DeltaBatchHeader& batch, const char* start) {
+                if (static_cast<uint64_t>(start - file.data()) >= deltaLength) return false;
+                if (batch.generation > generation) kept.append(start, batch.size);
+                return true;
+            });
+        }
+        if (kept.size() == sizeof(header)) {
+            unlink(options.deltaFile.c_str());
+            deltaLength = 0;
+            return;
+        }
+
+        // On failure the old file stays: the snapshot's generation makes load skip its folded batches
+        string tempPath = options.deltaFile + ".tmp";
+        int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool written = fd >= 0 && writeAllAt(fd, kept.data(), kept.size(), 0) && fdatasync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        if (written && renameDurably(tempPath, options.deltaFile)) deltaLength = kept.size();
+        else unlink(tempPath.c_str());
+    }
+
+    // Starts the compaction thread on first use
+    void requestCompaction() {
+        lock_guard<mutex> lock(compactMutex);
+        if (compactStopping) return;
+        if (!compactor.joinable()) compactor = thread(&BankSystem::compactionLoop, this);
+        compactRequested = true;
+        compactWake.notify_one();
+    }
+
+    // Also takes the forked snapshots, including one requested just before stopping
+    void compactionLoop() {
+        unique_lock<mutex> lock(compactMutex);
+        while (true) {
+            compactWake.wait(lock, [this] { return snapshotRequested || compactRequested || compactStopping; });
+            if (snapshotRequested) {
+                snapshotRequested = false;
+                lock.unlock();
+                size_t saved = 0;
+                bool written = writeForkedSnapshot(saved);
+                lock.lock();
+                if (written && reportSnapshot) cout << saved << " accounts saved." << endl;
+                snapshotSaved = written;
+                snapshotRunning = false;
+                snapshotDone.notify_all();
+                continue;
+            }
+            if (compactStopping) break;
+            compactRequested = false;
+            lock.unlock();
+            compact(true);
+            lock.lock();
+        }
+    }
+
+    void stopCompaction() {
+        {
+            lock_guard<mutex> lock(compactMutex);
+            compactStopping = true;
+        }
+        compactWake.notify_one();
+        if (compactor.joinable()) compactor.join();
+    }
+
+#if BANK_METRICS
+    thread metricsWatcher;
+    struct sigaction previousSignalAction = {};
+
+    // Claims SIGUSR1 for this bank if metricsFile is set and no other bank has it; every signal
+    // then rewrites metricsFile
+    void watchMetricsSignal() {
+        if (options.metricsFile.empty() || metricsSignalClaimed.exchange(true)) return;
+        if (metricsSignalPipe[0] < 0 && pipe2(metricsSignalPipe, O_CLOEXEC) != 0) {
+            metricsSignalClaimed = false;
+            return;
+        }
+        fcntl(metricsSignalPipe[1], F_SETFL, O_NONBLOCK);
+        struct sigaction action = {};
+        action.sa_handler = onMetricsSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, &previousSignalAction);
+        metricsWatcher = thread([this] {
+            char request;
+            while (read(metricsSignalPipe[0], &request, 1) == 1 && request == 'd') {
+                if (!writeMetrics(options.metricsFile))
+                    cerr << "Error: Could not write metrics to " << options.metricsFile << "." << endl;
+            }
+        });
+    }
+
+    void stopMetricsWatcher() {
+        if (!metricsWatcher.joinable()) return;
+        sigaction(SIGUSR1, &previousSignalAction, nullptr);
+        char request = 'q';
+        while (write(metricsSignalPipe[1], &request, 1) != 1 && (errno == EAGAIN || errno == EINTR))
+            this_thread::yield();
+        metricsWatcher.join();
+        metricsSignalClaimed = false;
+    }
+#else
+    void watchMetricsSignal() {}
+    void stopMetricsWatcher() {}
+#endif
+
+public:
+    explicit BankSystem(const BankOptions& opts = BankOptions()) : options(opts) {
+        if (options.readOnly) {
+            options.saveOnExit = false;
+            options.ledgerFile.clear();
+        }
+        if (options.autoLoad) loadAccounts();
+        if (options.ledger && options.autoLoad) {
+            if (!options.ledgerFile.empty()) loadLedger();
+            seedLedger();
+        }
+        ledgerReady = true;
+        if (options.journaling || options.readOnly) openJournal();
+        watchMetricsSignal();
+    }
+    BankSystem(const BankSystem&) = delete;
+    BankSystem& operator=(const BankSystem&) = delete;
+
+    ~BankSystem() {
+        stopMetricsWatcher();
+        if (options.saveOnExit) saveAccounts();
+        stopCompaction();
+        if (!options.saveOnExit && journal.isOpen()) journal.sync();
+        journal.close();
+        closeDelta();
+        closeLedger();
+    }
+
+    // Loads the binary snapshot and the saved changes over it if there is one, otherwise falls back
+    // to the text file
+    void loadAccounts() {
+        if (access(options.snapshotFile.c_str(), F_OK) == 0) loadSnapshot(options.snapshotFile, options.deltaFile);
+        else loadAccountsFromFile(options.textFile);
+    }
+
+    // Saves everything changed since the last save; with journaling on this is a checkpoint that
+    // restarts the journal
+    void saveAccounts() { checkpoint(true); }
+
+    // Usually appends just the changed accounts to the delta file (see saveChangesLocked). A full
+    // snapshot is written instead when changes were not tracked (nothing saved yet, text data
+    // loaded, interest posted) or when they cover at least half the accounts; with forkSnapshots an
+    // automatic (onlyIfDue) checkpoint returns once the snapshot is started. While one is running,
+    // automatic checkpoints wait for the next chance and the journal keeps growing.
+    bool checkpoint(bool report = false, bool onlyIfDue = false) {
+        OpTimer timer(metrics, BankOp::Save);
+        if (options.readOnly) return timer.finish(false);
+        if (unloadedTextRecords) return timer.finish(refuseSnapshot(report));
+        if (!onlyIfDue) waitForSnapshot();
+        {
+            // A delta batch must not be written between a forked snapshot's fork and its switch-over,
+            // which would drop it with the old delta file
+            unique_lock<shared_mutex> structure(structureMutex);
+            if (onlyIfDue && (!checkpointDue() || snapshotRunning)) return true; // another thread got here first
+            if (!fullSaveDue() && !snapshotRunning) return timer.finish(saveChangesLocked(report));
+        }
+        if (options.forkSnapshots) return timer.finish(requestSnapshot(report, !onlyIfDue));
+        lock_guard<mutex> writer(snapshotMutex);
+        unique_lock<shared_mutex> structure(structureMutex);
+        if (onlyIfDue && !checkpointDue()) return true;
+        return timer.finish(fullSaveDue() ? saveAllLocked(report) : saveChangesLocked(report));
+    }
+
+    // Folds the delta file into a new snapshot; runs in the background once the delta file reaches
+    // compactionRatio of the snapshot. Pending changes are saved first, so the rows copied under the
+    // exclusive lock are exactly the latest generation. The snapshot is written without the lock, and
+    // batches saved meanwhile are kept in the delta file.
+    bool compact(bool onlyIfDue = false) {
+        if (options.readOnly || unloadedTextRecords) return false;
+        if (options.forkSnapshots) {
+            // The forked image holds every change, so pending ones need no delta batch first
+            OpTimer timer(metrics, BankOp::Compact);
+            {
+                unique_lock<shared_mutex> structure(structureMutex);
+                if (onlyIfDue && !compactionDue()) return true;
+            }
+            return timer.finish(requestSnapshot(false, !onlyIfDue));
+        }
+
+        lock_guard<mutex> writer(snapshotMutex);
+        OpTimer timer(metrics, BankOp::Compact);
+        SnapshotImage image;
+        uint64_t generation;
+        {
+            unique_lock<shared_mutex> structure(structureMutex);
+            if (onlyIfDue && !compactionDue()) return true;
+            if (fullSaveDue()) return onlyIfDue || timer.finish(saveAllLocked(false)); // the next checkpoint is a full one anyway
+            if (!saveChangesLocked(false)) return timer.finish(false);
+            if (deltaLength == 0) return true;
+            generation = journalGeneration;
+            image = captureSnapshot();
+        }
+        if (!writeSnapshotImage(options.snapshotFile, image, generation, false)) return timer.finish(false);
+
+        unique_lock<shared_mutex> structure(structureMutex);
+        snapshotLength = image.fileSize();
+        dropDeltasThrough(generation);
+        return timer.finish(true);
+    }
+
+    // A snapshot is loaded in place of the text file from then on, so one written while text records
+    // were skipped would lose them for good. The text file stays authoritative instead; with
+    // journaling on, the journal keeps this run's changes and replays them over it next time.
+    bool refuseSnapshot(bool report) const {
+        if (report)
+            cout << "Error: Not saved: " << unloadedTextRecords << " record(s) of the text file could not be loaded."
+                 << " Fix or remove them and load it again." << endl;
+        return false;
+    }
+
+    void saveAccountsToFile() { saveAccountsToFile(options.textFile); }
+
+    void saveAccountsToFile(const string& path) {
+        OpTimer timer(metrics, BankOp::Save);
+        unique_lock<shared_mutex> structure(structureMutex);
+        ofstream outFile(path);
+        if (!outFile) {
+            cout << "Error: Could not save to file." << endl;
+            timer.finish(false);
+            return;
+        }
+
+        int count = 0;
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            AccountKind kind = accounts.kind(row);
+            if (kind == AccountKind::None) continue;
+            outFile << "TYPE:" << accountTypeName(kind) << "\nNUMBER:" << accounts.number(row).view()
+                    << "\nNAME:" << accounts.name(row) << "\nBALANCE:" << formatMoney(accounts.balance(row)) << "\n";
+
+            if (kind == AccountKind::Savings)
+                outFile << "INTEREST_RATE:" << formatRate(accounts.rate(row)) << "\n";
+            else if (kind == AccountKind::Checking)
+                outFile << "OVERDRAFT_LIMIT:" << formatMoney(accounts.overdraft(row)) << "\n";
+
+            outFile << "----------\n";
+            count++;
+        }
+        outFile.close();
+        timer.finish(static_cast<bool>(outFile));
+        cout << count << " accounts saved." << endl;
+    }
+
+    bool saveSnapshot(const string& path) {
+        OpTimer timer(metrics, BankOp::Save);
+        if (unloadedTextRecords) return timer.finish(refuseSnapshot(true));
+        unique_lock<shared_mutex> structure(structureMutex);
+        return timer.finish(writeSnapshot(path, 0, true));
+    }
+
+    // Caller holds structureMutex
+    bool writeSnapshot(const string& path, uint64_t nextJournalGeneration, bool report) {
+        return writeSnapshotImage(path, captureSnapshot(), nextJournalGeneration, report);
+    }
+
+    // Writes the binary snapshot to a temporary file, syncs it and renames it into place,
+    // so a crash mid-save never leaves a truncated snapshot behind
+    bool writeSnapshotImage(const string& path, const SnapshotImage& image, uint64_t nextJournalGeneration, bool report) {
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.recordSize = sizeof(SnapshotRecord);
+        header.recordCount = image.records.size();
+        header.heapSize = image.heap.size();
+        header.journalGeneration = nextJournalGeneration;
+
+        string tempPath = path + ".tmp";
+        ofstream outFile(tempPath, ios::binary | ios::trunc);
+        if (!outFile) {
+            cout << "Error: Could not save to file." << endl;
+            return false;
+        }
+        outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        outFile.write(reinterpret_cast<const char*>(image.records.data()), image.records.size() * sizeof(SnapshotRecord));
+        outFile.write(image.heap.data(), image.heap.size());
+        outFile.close();
+        if (!outFile || !syncFileData(tempPath) || !renameDurably(tempPath, path)) {
+            cout << "Error: Could not save to file." << endl;
+            return false;
+        }
+        if (report) cout << image.records.size() << " accounts saved." << endl;
+        return true;
+    }
+
+    // Loads a binary snapshot, then the saved changes in deltaPath that continue it (if given)
+    bool loadSnapshot(const string& path, const string& deltaPath = string()) {
+        OpTimer timer(metrics, BankOp::Load);
+        waitForSnapshot(); // its completion would mark the loaded accounts as saved
+        unique_lock<shared_mutex> structure(structureMutex);
+        bool fresh = accounts.size() == 0;
+        deltaBase = false; // until the files are known to hold everything
+        dropSecondaryIndexes();
+        MappedFile file(path);
+        const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(file.data());
+        if (file.empty() || file.size() < SNAPSHOT_V1_HEADER_SIZE
+            || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+            cout << "Error: " << path << " is not a bank snapshot." << endl;
+            return timer.finish(false);
+        }
+        size_t headerSize = header->version == 1 ? SNAPSHOT_V1_HEADER_SIZE
+            : header->version < 4 ? SNAPSHOT_V3_HEADER_SIZE : sizeof(SnapshotHeader);
+        // Checked piece by piece so a corrupt count cannot wrap the sum around to the file size
+        uint64_t bodySize = file.size() > headerSize ? file.size() - headerSize : 0;
+        if (header->version < 1 || header->version > SNAPSHOT_VERSION || header->recordSize != sizeof(SnapshotRecord)
+            || file.size() < headerSize || header->recordCount > bodySize / sizeof(SnapshotRecord)
+            || header->heapSize != bodySize - header->recordCount * sizeof(SnapshotRecord)) {
+            cout << "Error: Unsupported or corrupt snapshot " << path << " (version " << header->version << ")." << endl;
+            return timer.finish(false);
+        }
+        journalGeneration = header->version >= 2 ? header->journalGeneration : 0;
+        journalSkip = header->version >= 4 ? header->journalSkip : 0;
+
+        const SnapshotRecord* records = reinterpret_cast<const SnapshotRecord*>(file.data() + headerSize);
+        const char* heap = reinterpret_cast<const char*>(records + header->recordCount);
+        accounts.reserve(header->recordCount);
+        index.reserve(index.size() + header->recordCount);
+        int count = 0;
+        for (uint64_t i = 0; i < header->recordCount; i++) {
+            const SnapshotRecord& rec = records[i];
+            if (rec.numberLength > AccountNumber::MAX_DIGITS
+                || uint64_t(rec.nameOffset) + rec.nameLength > header->heapSize) continue;
+            string_view number(rec.number, rec.numberLength), name(heap + rec.nameOffset, rec.nameLength);
+
+            AccountKind kind = static_cast<AccountKind>(rec.kind);
+            Cents balance = rec.balance;
+            int64_t parameter = rec.parameter;
+            if (header->version < SNAPSHOT_FIRST_CENTS_VERSION) {
+                balance = fromLegacyDouble(balance, false);
+                parameter = fromLegacyDouble(parameter, kind == AccountKind::Savings);
+            }
+            if (insertAccount(kind, number, name, balance, parameter) == TxnStatus::Ok) count++;
+        }
+        cout << count << " accounts loaded." << endl;
+
+        // Later saves can append to these files only if they are all the bank holds
+        if (!deltaPath.empty() && loadDeltaFile(deltaPath))
+            deltaBase = fresh && path == options.snapshotFile && deltaPath == options.deltaFile;
+        if (ledgerReady) seedLedgerLocked();
+        snapshotLength = file.size();
+        return timer.finish(true);
+    }
+
+    void loadAccountsFromFile() { loadAccountsFromFile(options.textFile); }
+
+    // Loads the text format. The file is mapped, cut at "----------" separator lines into one chunk
+    // per loader thread, and the chunks are parsed in parallel without allocating; the parsed
+    // accounts are then added in file order on this thread.
+    void loadAccountsFromFile(const string& path) {
+        OpTimer timer(metrics, BankOp::Load);
+        waitForSnapshot();
+        unique_lock<shared_mutex> structure(structureMutex);
+        deltaBase = false; // the next save writes these accounts to a full snapshot
+        dropSecondaryIndexes();
+        MappedFile file(path);
+        if (file.empty()) {
+            cout << (access(path.c_str(), F_OK) == 0 ? "0 accounts loaded." : "No existing data found. Starting fresh.") << endl;
+            timer.finish(true);
+            return;
+        }
+
+        const char* data = file.data();
+        const char* end = data + file.size();
+        const size_t MIN_CHUNK = 1 << 20;
+        size_t threads = options.loaderThreads ? options.loaderThreads : max<size_t>(1, thread::hardware_concurrency());
+        size_t chunks = max<size_t>(1, min(threads, file.size() / MIN_CHUNK));
+        vector<const char*> bounds = { data };
+        for (size_t c = 1; c < chunks; c++) {
+            const char* target = max(data + file.size() / chunks * c, bounds.back());
+            size_t separator = string_view(target, end - target).find("\n----------\n");
+            if (separator == string_view::npos) break;
+            bounds.push_back(target + separator + 12);
+        }
+        bounds.push_back(end);
+
+        size_t chunkCount = bounds.size() - 1;
+        vector<vector<ParsedAccount>> parsed(chunkCount);
+        vector<char> complete(chunkCount);
+        vector<size_t> chunkLines(chunkCount);
+        vector<thread> workers;
+        for (size_t c = 1; c < chunkCount; c++)
+            workers.emplace_back([&, c] { complete[c] = parseTextChunk(bounds[c], bounds[c + 1], parsed[c], chunkLines[c]); });
+        complete[0] = parseTextChunk(bounds[0], bounds[1], parsed[0], chunkLines[0]);
+        for (thread& worker : workers) worker.join();
+
+        size_t total = 0;
+        for (const auto& chunk : parsed) total += chunk.size();
+        accounts.reserve(total);
+        index.reserve(index.size() + total);
+
+        // A record that cannot be added is reported with its line; account numbers longer than
+        // AccountNumber::MAX_DIGITS and fields that do not parse are the usual causes. A chunk's
+        // lines start after those of the chunks before it (only complete chunks are followed by more).
+        int count = 0, skipped = 0;
+        size_t firstLine = 1;
+        for (size_t c = 0; c < chunkCount; firstLine += chunkLines[c++]) {
+            for (const ParsedAccount& acc : parsed[c]) {
+                TxnStatus status = acc.badField ? TxnStatus::InvalidAmount
+                                                : insertAccount(acc.kind, acc.number, acc.name, acc.balance, acc.parameter);
+                if (status == TxnStatus::Ok) {
+                    count++;
+                    continue;
+                }
+                skipped++;
+                cout << "Skipped account " << acc.number << " on line " << firstLine + acc.line << ": ";
+                if (acc.badField)
+                    cout << "Invalid " << acc.badField << "." << endl;
+                else if (acc.number.size() > AccountNumber::MAX_DIGITS)
+                    cout << "Account number must be at most " << AccountNumber::MAX_DIGITS << " digits long." << endl;
+                else
+                    cout << describeStatus(status) << "." << endl;
+            }
+            if (!complete[c]) break; // like the sequential format, stop at the first line that is not a record
+        }
+        unloadedTextRecords += skipped;
+        if (ledgerReady) seedLedgerLocked();
+        timer.finish(true);
+        cout << count << " accounts loaded";
+        if (skipped) cout << ", " << skipped << " skipped (no snapshot will be saved over the file until they load)";
+        cout << "." << endl;
+    }
+
+    // Journaled, non-printing operations; the interactive wrappers below report the outcome.
+    // These are safe to call from many threads at once.
+    // Adds an account straight from its fields; `parameter` is the interest rate (savings) or
+    // overdraft limit (checking). Nothing is allocated per account beyond the store's own columns.
+    TxnStatus tryAddAccount(AccountKind kind, string_view number, string_view name, Cents balance, int64_t parameter) {
+        OpTimer timer(metrics, BankOp::Add);
+        if (journalFailed()) return timer.finish(TxnStatus::IoError);
+        uint64_t seq = 0;
+        TxnStatus status;
+        int64_t time = wallClockMicros();
+        {
+            unique_lock<shared_mutex> structure(structureMutex);
+            status = openAccount(kind, number, name, balance, parameter, time);
+            if (status == TxnStatus::Ok && journal.isOpen()) {
+                JournalRecord rec = makeJournalRecord(JournalOp::Create, number, balance, time);
+                rec.kind = static_cast<uint8_t>(kind);
+                string tail(reinterpret_cast<const char*>(&parameter), sizeof(parameter));
+                tail.append(name);
+                seq = journal.append(rec, tail);
+            }
+        }
+        if (status == TxnStatus::Ok && !commitJournal(seq)) status = TxnStatus::IoError;
+        return timer.finish(status);
+    }
+
+    // Adds many accounts under one exclusive lock: duplicates inside the batch are found first with
+    // a hash set of the batch's keys (the first occurrence wins), the store and index are sized once,
+    // then every account is inserted and journaled in a single pass with one group commit at the
+    // end. Fields are not validated beyond the account number; callers check them with
+    // validationError. Each account succeeds or fails on its own.
+    vector<TxnStatus> tryAddAccounts(const vector<AccountRequest>& requests) {
+        const size_t PREFETCH_AHEAD = 16;
+        vector<TxnStatus> results(requests.size(), journalFailed() ? TxnStatus::IoError : TxnStatus::Ok);
+        vector<uint64_t> keys(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (results[i] != TxnStatus::Ok) continue;
+            if (!AccountNumber::pack(requests[i].number, keys[i]) || requests[i].number.empty())
+                results[i] = TxnStatus::InvalidAccount;
+        }
+        AccountIndex batch;
+        batch.reserve(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (i + PREFETCH_AHEAD < keys.size()) batch.prefetch(keys[i + PREFETCH_AHEAD]);
+            if (results[i] != TxnStatus::Ok) continue;
+            if (batch.find(keys[i]) != AccountStore::NO_ROW) results[i] = TxnStatus::Duplicate;
+            else batch.insert(keys[i], static_cast<uint32_t>(i));
+        }
+
+        uint64_t seq = 0;
+        int64_t time = wallClockMicros();
+        string tail;
+        {
+            unique_lock<shared_mutex> structure(structureMutex);
+            accounts.reserve(batch.size());
+            index.reserve(index.size() + batch.size());
+            for (size_t i = 0; i < requests.size(); i++) {
+                if (i + PREFETCH_AHEAD < keys.size()) index.prefetch(keys[i + PREFETCH_AHEAD]);
+                if (results[i] != TxnStatus::Ok) continue;
+                const AccountRequest& request = requests[i];
+                OpTimer timer(metrics, BankOp::Add);
+                results[i] = timer.finish(openAccount(request.kind, request.number, request.name, request.balance,
+                                                      request.parameter, time));
+                if (results[i] == TxnStatus::Ok && journal.isOpen()) {
+                    JournalRecord rec = makeJournalRecord(JournalOp::Create, request.number, request.balance, time);
+                    rec.kind = static_cast<uint8_t>(request.kind);
+                    tail.assign(reinterpret_cast<const char*>(&request.parameter), sizeof(request.parameter));
+                    tail.append(request.name);
+                    seq = journal.append(rec, tail);
+                }
+            }
+        }
+        if (!commitJournal(seq)) failUncommitted(results);
+        return results;
+    }
+
+    // The account's fields are copied into the store; the object itself is not kept
+    TxnStatus tryAddAccount(unique_ptr<Account> newAccount) {
+        if (!newAccount) return TxnStatus::InvalidAccount;
+        const Account& acc = *newAccount;
+        return tryAddAccount(acc.getKind(), acc.getAccountNumber(), acc.getCustomerName(), acc.getBalance(),
+                             accountParameter(acc));
+    }
+
+    TxnStatus tryDeleteAccount(string_view accNum) {
+        OpTimer timer(metrics, BankOp::Delete);
+        uint64_t key, seq = 0;
+        if (!AccountNumber::pack(accNum, key)) return timer.finish(TxnStatus::InvalidAccount);
+        if (journalFailed()) return timer.finish(TxnStatus::IoError);
+        TxnStatus status;
+        {
+            unique_lock<shared_mutex> structure(structureMutex);
+            int64_t time = wallClockMicros();
+            status = legPins.count(key) ? TxnStatus::Busy : closeAccount(key, time);
+            if (status == TxnStatus::Ok) seq = journalAppend(JournalOp::Delete, accNum, 0, time);
+        }
+        if (status == TxnStatus::Ok && !commitJournal(seq)) status = TxnStatus::IoError;
+        return timer.finish(status);
+    }
+
+    TxnStatus tryDeposit(string_view accNum, Cents amount, BalanceChange* change = nullptr) {
+        return changeBalance(accNum, amount, JournalOp::Deposit, LedgerKind::Deposit, BankOp::Deposit, change);
+    }
+
+    TxnStatus tryWithdraw(string_view accNum, Cents amount, BalanceChange* change = nullptr) {
+        return changeBalance(accNum, amount, JournalOp::Withdraw, LedgerKind::Withdraw, BankOp::Withdraw, change);
+    }
+
+    // One side of a transfer whose other account is held by another process (a shard's leg of a
+    // cross-shard transfer), held under the router's id `txn` until trySettleLeg decides it. An
+    // outgoing leg takes the money now; an incoming one only checks the account. Either pins its
+    // account against deletion, and is journaled so that it outlives a restart. Duplicate if the id
+    // is already prepared or was aborted first.
+    TxnStatus tryPrepareLeg(uint64_t txn, string_view accNum, Cents amount, bool outgoing, BalanceChange* change = nullptr) {
+        OpTimer timer(metrics, BankOp::Transfer);
+        if (amount <= 0) return timer.finish(TxnStatus::InvalidAmount);
+        if (journalFailed()) return timer.finish(TxnStatus::IoError);
+        uint64_t seq = 0;
+        TxnStatus status = TxnStatus::Ok;
+        {
+            shared_lock<shared_mutex> structure(structureMutex);
+            uint32_t row = findRow(accNum);
+            if (row == AccountStore::NO_ROW) return timer.finish(TxnStatus::NotFound);
+            lock_guard<mutex> stripe(stripeFor(accounts.number(row).key()));
+            lock_guard<mutex> legs(legMutex);
+            if (preparedLegs.count(txn) || abortedTxns.count(txn)) return timer.finish(TxnStatus::Duplicate);
+            int64_t time = wallClockMicros();
+            if (outgoing)
+                status = applyWithdraw(row, amount, time, LedgerKind::TransferOut, change);
+            else if (!canCredit(row, amount))
+                status = TxnStatus::InvalidAmount;
+            else if (change)
+                *change = { accounts.balance(row), accounts.balance(row), accounts.available(row) };
+            if (status == TxnStatus::Ok) {
+                PreparedLeg leg{ accounts.number(row), amount, outgoing };
+                addLegLocked(txn, leg);
+                if (journal.isOpen())
+                    seq = journal.append(makeLegRecord(JournalOp::PrepareLeg, leg, outgoing ? LEG_OUTGOING : 0, time), legTail(txn));
+            }
+        }
+        if (status == TxnStatus::Ok && !commitJournal(seq)) status = TxnStatus::IoError;
+        return timer.finish(status);
+    }
+
+    // Commits or aborts a prepared leg: money moves only for a committed credit or an aborted debit
+    // (the refund). NotFound if no leg has that id, as when it was already settled; an abort then
+    // also bars a prepare under that id from arriving late.
+    TxnStatus trySettleLeg(uint64_t txn, bool commit, BalanceChange* change = nullptr) {
+        OpTimer timer(metrics, BankOp::Transfer);
+        if (journalFailed()) return timer.finish(TxnStatus::IoError);
+        uint64_t seq = 0;
+        {
+            shared_lock<shared_mutex> structure(structureMutex);
+            AccountNumber number;
+            {
+                lock_guard<mutex> legs(legMutex);
+                auto it = preparedLegs.find(txn);
+                if (it == preparedLegs.end()) {
+                    if (!commit) rememberAbortLocked(txn);
+                    return timer.finish(TxnStatus::NotFound);
+                }
+                number = it->second.number;
+            }
+            uint32_t row = index.find(number.key()); // pinned, so still open
+            lock_guard<mutex> stripe(stripeFor(number.key()));
+            lock_guard<mutex> legs(legMutex);
+            PreparedLeg leg;
+            if (!takeLegLocked(txn, leg)) return timer.finish(TxnStatus::NotFound); // settled meanwhile
+            int64_t time = wallClockMicros();
+            if (commit != leg.outgoing)
+                applyDeposit(row, leg.amount, time, LedgerKind::TransferIn, change);
+            else if (change)
+                *change = { accounts.balance(row), accounts.balance(row), accounts.available(row) };
+            if (journal.isOpen())
+                seq = journal.append(makeLegRecord(JournalOp::SettleLeg, leg, commit ? LEG_COMMIT : 0, time), legTail(txn));
+        }
+        return timer.finish(commitJournal(seq) ? TxnStatus::Ok : TxnStatus::IoError);
+    }
+
+    // Ids of the legs still waiting for trySettleLeg, in increasing order
+    vector<uint64_t> preparedTransfers() {
+        shared_lock<shared_mutex> structure(structureMutex);
+        lock_guard<mutex> legs(legMutex);
+        vector<uint64_t> ids;
+        for (const auto& leg : preparedLegs) ids.push_back(leg.first);
+        sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    // Moves amount between two accounts atomically: both stripes are locked (lowest index first, so
+    // concurrent transfers cannot deadlock) and the move is journaled as one record.
+    // `change` describes the source account.
+    TxnStatus tryTransfer(string_view from, string_view to, Cents amount, BalanceChange* change = nullptr) {
+        OpTimer timer(metrics, BankOp::Transfer);
+        if (amount <= 0) return timer.finish(TxnStatus::InvalidAmount);
+        if (journalFailed()) return timer.finish(TxnStatus::IoError);
+        uint64_t seq = 0;
+        TxnStatus status;
+        {
+            shared_lock<shared_mutex> structure(structureMutex);
+            uint32_t source = findRow(from), target = findRow(to);
+            if (source == AccountStore::NO_ROW || target == AccountStore::NO_ROW) return timer.finish(TxnStatus::NotFound);
+            if (source == target) return timer.finish(TxnStatus::SameAccount);
+
+            size_t a = stripeIndex(accounts.number(source).key()), b = stripeIndex(accounts.number(target).key());
+            unique_lock<mutex> first(stripes[min(a, b)].lock), second;
+            if (a != b) second = unique_lock<mutex>(stripes[max(a, b)].lock);
+
+            int64_t time = wallClockMicros();
+            status = canCredit(target, amount) ? applyWithdraw(source, amount, time, LedgerKind::TransferOut, change)
+                                               : TxnStatus::InvalidAmount;
+            if (status == TxnStatus::Ok) {
+                applyDeposit(target, amount, time, LedgerKind::TransferIn, nullptr);
+                if (journal.isOpen()) seq = journal.append(makeJournalRecord(JournalOp::Transfer, from, amount, time), to);
+            }
+        }
+        if (status == TxnStatus::Ok && !commitJournal(seq)) status = TxnStatus::IoError;
+        return timer.finish(status);
+    }
+
+    // Applies many transfers in order under one lock acquisition. Each distinct account is looked
+    // up once (keys are sorted and deduplicated), its balance is worked on in a local array and
+    // written back once at the end. Every stripe the batch touches is locked in ascending order,
+    // the same order tryTransfer uses. Each transfer succeeds or fails on its own.
+    vector<TxnStatus> tryTransferBatch(const vector<TransferRequest>& transfers) {
+        vector<TxnStatus> results(transfers.size(), TxnStatus::Ok);
+        vector<uint64_t> fromKeys(transfers.size()), toKeys(transfers.size()), keys;
+        keys.reserve(transfers.size() * 2);
+        bool refused = journalFailed();
+        for (size_t i = 0; i < transfers.size(); i++) {
+            if (transfers[i].amount <= 0) results[i] = TxnStatus::InvalidAmount;
+            else if (refused) results[i] = TxnStatus::IoError;
+            else if (!AccountNumber::pack(transfers[i].from, fromKeys[i]) || !AccountNumber::pack(transfers[i].to, toKeys[i]))
+                results[i] = TxnStatus::NotFound;
+            else {
+                keys.push_back(fromKeys[i]);
+                keys.push_back(toKeys[i]);
+            }
+        }
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        auto slotOf = [&](uint64_t key) { return static_cast<size_t>(lower_bound(keys.begin(), keys.end(), key) - keys.begin()); };
+
+        uint64_t seq = 0;
+        // As in tryWithdrawBatch, transfers that get past validation are timed until the commit
+        vector<OpTimer> timers;
+        vector<uint32_t> applied;
+        timers.reserve(transfers.size());
+        applied.reserve(transfers.size());
+        {
+            shared_lock<shared_mutex> structure(structureMutex);
+            // Resolve each account once; what it may withdraw is asked of its policy at the running balance
+            vector<uint32_t> rows(keys.size());
+            vector<Cents> balances(keys.size());
+            vector<size_t> stripeIds;
+            for (size_t k = 0; k < keys.size(); k++) {
+                rows[k] = index.find(keys[k]);
+                if (rows[k] != AccountStore::NO_ROW) stripeIds.push_back(stripeIndex(keys[k]));
+            }
+            sort(stripeIds.begin(), stripeIds.end());
+            stripeIds.erase(unique(stripeIds.begin(), stripeIds.end()), stripeIds.end());
+            for (size_t id : stripeIds) stripes[id].lock.lock();
+
+            for (size_t k = 0; k < keys.size(); k++)
+                if (rows[k] != AccountStore::NO_ROW) balances[k] = accounts.balance(rows[k]);
+
+            int64_t time = wallClockMicros();
+            for (size_t i = 0; i < transfers.size(); i++) {
+                if (results[i] != TxnStatus::Ok) {
+                    OpTimer(metrics, BankOp::Transfer).finish(results[i]);
+                    continue;
+                }
+                timers.emplace_back(metrics, BankOp::Transfer);
+                applied.push_back(static_cast<uint32_t>(i));
+                size_t src = slotOf(fromKeys[i]), dst = slotOf(toKeys[i]);
+                Cents amount = transfers[i].amount, credited;
+                // Existence first, then the same account, as tryTransfer checks them
+                if (rows[src] == AccountStore::NO_ROW || rows[dst] == AccountStore::NO_ROW) results[i] = TxnStatus::NotFound;
+                else if (src == dst) results[i] = TxnStatus::SameAccount;
+                else if (!addToBalance(balances[dst], amount, credited)) results[i] = TxnStatus::InvalidAmount;
+                else if (amount > accounts.availableAt(rows[src], balances[src])) results[i] = TxnStatus::InsufficientFunds;
+                else {
+                    balances[src] -= amount;
+                    balances[dst] = credited;
+                    recordLedger(rows[src], LedgerKind::TransferOut, -amount, balances[src], time);
+                    recordLedger(rows[dst], LedgerKind::TransferIn, amount, balances[dst], time);
+                    if (journal.isOpen())
+                        seq = journal.append(makeJournalRecord(JournalOp::Transfer, transfers[i].from, amount, time),
+                                             transfers[i].to);
+                }
+            }
+
+            for (size_t k = 0; k < keys.size(); k++) {
+                if (rows[k] == AccountStore::NO_ROW || accounts.balance(rows[k]) == balances[k]) continue;
+                Cents oldBalance = accounts.balance(rows[k]);
+                accounts.balance(rows[k]) = balances[k];
+                balanceChanged(rows[k], oldBalance);
+            }
+            for (auto it = stripeIds.rbegin(); it != stripeIds.rend(); ++it) stripes[*it].lock.unlock();
+        }
+        if (!commitJournal(seq)) failUncommitted(results);
+        for (size_t t = 0; t < timers.size(); t++) timers[t].finish(results[applied[t]]);
+        return results;
+    }
+
+    // Applies many withdrawals under one lock pass, dispatching on account type once per batch
+    // rather than once per call: requests are bucketed by their account's kind and each bucket runs
+    // a loop compiled for that kind's policy. An account has one kind, so its withdrawals still
+    // apply in request order and every result matches calling tryWithdraw one by one.
+    vector<TxnStatus> tryWithdrawBatch(const vector<WithdrawRequest>& requests) {
+        vector<TxnStatus> results(requests.size(), TxnStatus::Ok);
+        vector<uint64_t> keys(requests.size());
+        bool refused = journalFailed();
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (requests[i].amount <= 0) results[i] = TxnStatus::InvalidAmount;
+            else if (refused) results[i] = TxnStatus::IoError;
+            else if (!AccountNumber::pack(requests[i].number, keys[i])) results[i] = TxnStatus::NotFound;
+        }
+
+        uint64_t seq = 0;
+        // Requests that reach their account are timed from there until their outcome is final,
+        // after the journal commit; applied[t] is the request timers[t] belongs to
+        vector<OpTimer> timers;
+        vector<uint32_t> applied;
+        timers.reserve(requests.size());
+        applied.reserve(requests.size());
+        {
+            shared_lock<shared_mutex> structure(structureMutex);
+            vector<uint32_t> rows(requests.size(), AccountStore::NO_ROW);
+            array<vector<uint32_t>, 4> byKind; // request indices per AccountKind
+            vector<size_t> stripeIds;
+            for (size_t i = 0; i < requests.size(); i++) {
+                if (results[i] == TxnStatus::Ok) rows[i] = index.find(keys[i]);
+                if (rows[i] == AccountStore::NO_ROW) {
+                    if (results[i] == TxnStatus::Ok) results[i] = TxnStatus::NotFound;
+                    OpTimer(metrics, BankOp::Withdraw).finish(results[i]);
+                    continue;
+                }
+                byKind[static_cast<size_t>(accounts.kind(rows[i]))].push_back(static_cast<uint32_t>(i));
+                stripeIds.push_back(stripeIndex(keys[i]));
+            }
+            sort(stripeIds.begin(), stripeIds.end());
+            stripeIds.erase(unique(stripeIds.begin(), stripeIds.end()), stripeIds.end());
+            for (size_t id : stripeIds) stripes[id].lock.lock();
+
+            int64_t time = wallClockMicros();
+            for (AccountKind kind : { AccountKind::Basic, AccountKind::Savings, AccountKind::Checking }) {
+                withPolicy(kind, [&](auto policy) {
+                    using Policy = decltype(policy);
+                    for (uint32_t i : byKind[static_cast<size_t>(kind)]) {
+                        timers.emplace_back(metrics, BankOp::Withdraw);
+                        applied.push_back(i);
+                        uint32_t row = rows[i];
+                        Cents amount = requests[i].amount, oldBalance = accounts.balance(row);
+                        Cents limit = 0;
+                        if constexpr (Policy::hasOverdraft) limit = accounts.overdraft(row);
+                        if (amount > Policy::available(oldBalance, limit)) {
+                            results[i] = TxnStatus::InsufficientFunds;
+                            continue;
+                        }
+                        accounts.balance(row) = oldBalance - amount;
+                        balanceChanged(row, oldBalance);
+                        recordLedger(row, LedgerKind::Withdraw, -amount, accounts.balance(row), time);
+                        if (journal.isOpen()) seq = journalAppend(JournalOp::Withdraw, requests[i].number, amount, time);
+                    }
+                });
+            }
+            for (auto it = stripeIds.rbegin(); it != stripeIds.rend(); ++it) stripes[*it].lock.unlock();
+        }
+        if (!commitJournal(seq)) failUncommitted(results);
+        for (size_t t = 0; t < timers.size(); t++) timers[t].finish(results[applied[t]]);
+        return results;
+    }
+
+    // Applies requests in order under one exclusive lock and commits their journal records once.
+    // No stripe locks are needed with everything else held off, so a single applier thread
+    // (TxnEngine) runs each request with no synchronization of its own.
+    void applyBatch(const TxnRequest* requests, size_t count, TxnResult* results) {
+        uint64_t seq = 0;
+        bool refused = journalFailed();
+        {
+            unique_lock<shared_mutex> structure(structureMutex);
+            int64_t time = wallClockMicros();
+            for (size_t i = 0; i < count; i++) {
+                results[i].status = refused ? TxnStatus::IoError : applyRequestLocked(requests[i], time, results[i].change, seq);
+            }
+        }
+        if (refused || commitJournal(seq)) return;
+        for (size_t i = 0; i < count; i++) {
+            if (results[i].status == TxnStatus::Ok) results[i].status = TxnStatus::IoError;
+        }
+    }
+
+    // Credits every savings account with one period (1/periodsPerYear of its annual rate) of
+    // interest as a single journaled step; `credited` receives the number of accounts credited.
+    TxnStatus tryAccrueInterest(int periodsPerYear = 12, size_t* credited = nullptr) {
+        return postInterest(periodsPerYear, wallClockMicros, credited);
+    }
+
+    // Runs the interest schedule over `days` simulated days, starting with the UTC day containing
+    // `from`: at the end of each day (Daily, 1/365 or 1/366 of the annual rate by the calendar
+    // year) or of each calendar month (Monthly, 1/12) every savings account is credited, journaled
+    // and recorded in the ledger at the last microsecond of that day. Other updates may run
+    // between postings. Stops at the first posting that is not committed (the journal failed) and
+    // returns the number of postings committed before it.
+    size_t fastForwardInterest(int64_t from, size_t days, InterestSchedule schedule) {
+        const int64_t DAY = 86400LL * 1000000;
+        int64_t day = from - ((from % DAY) + DAY) % DAY;
+        size_t postings = 0;
+        for (size_t i = 0; i < days; i++, day += DAY) {
+            time_t seconds = static_cast<time_t>(day / 1000000), nextSeconds = seconds + 86400;
+            tm date, next;
+            gmtime_r(&seconds, &date);
+            gmtime_r(&nextSeconds, &next);
+            int year = date.tm_year + 1900;
+            int periods = 12;
+            if (schedule == InterestSchedule::Daily) periods = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0 ? 366 : 365;
+            else if (next.tm_mday != 1) continue;
+            int64_t endOfDay = day + DAY - 1;
+            if (postInterest(periods, [endOfDay] { return endOfDay; }, nullptr) != TxnStatus::Ok) break;
+            postings++;
+        }
+        return postings;
+    }
+
+    // Calls fn(AccountView) for every account in display order with all updates held off
+    template <typename Fn>
+    void forEachAccount(Fn fn) const {
+        unique_lock<shared_mutex> structure(structureMutex);
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (accounts.isLive(row)) fn(AccountView(accounts, row));
+        }
+    }
+
+    // Calls fn(AccountView) for one account, holding off updates to it; NotFound if it does not exist
+    template <typename Fn>
+    TxnStatus withAccount(string_view accNum, Fn fn) const {
+        OpTimer timer(metrics, BankOp::Lookup);
+        shared_lock<shared_mutex> structure(structureMutex);
+        uint32_t row = findRow(accNum);
+        if (row == AccountStore::NO_ROW) return timer.finish(TxnStatus::NotFound);
+        lock_guard<mutex> stripe(stripeFor(accounts.number(row).key()));
+        fn(AccountView(accounts, row));
+        return timer.finish(TxnStatus::Ok);
+    }
+
+    // Waits until every change made so far is on disk: with durableAcks off, a caller acknowledges
+    // a whole group of changes after one call instead of waiting on each. False if the journal
+    // failed first; changes are refused from then on (see commitJournal).
+    bool syncJournal() {
+        return !journal.isOpen() || journal.sync();
+    }
+
+    // Thread-safe balance read
+    TxnStatus tryGetBalance(string_view accNum, Cents& balance) const {
+        OpTimer timer(metrics, BankOp::Lookup);
+        shared_lock<shared_mutex> structure(structureMutex);
+        uint32_t row = findRow(accNum);
+        if (row == AccountStore::NO_ROW) return timer.finish(TxnStatus::NotFound);
+        lock_guard<mutex> stripe(stripeFor(accounts.number(row).key()));
+        balance = accounts.balance(row);
+        return timer.finish(TxnStatus::Ok);
+    }
+
+    size_t accountCount() const {
+        shared_lock<shared_mutex> structure(structureMutex);
+        return accounts.size();
+    }
+
+    // Bank-wide totals from the running per-stripe sums: the cost does not depend on the number of
+    // accounts. Every stripe is locked (in ascending order, like tryTransferBatch), so a transfer is
+    // seen either whole or not at all.
+    Portfolio portfolio() const {
+        shared_lock<shared_mutex> structure(structureMutex);
+        for (LockStripe& stripe : stripes) stripe.lock.lock();
+        PortfolioSums total;
+        for (const LockStripe& stripe : stripes) {
+            const PortfolioSums& sums = stripe.portfolio;
+            for (size_t kind = 0; kind < 4; kind++) total.liabilities[kind] += sums.liabilities[kind];
+            total.deposits += sums.deposits;
+            total.overdrawn += sums.overdrawn;
+            total.overdraftLimits += sums.overdraftLimits;
+            total.balanceRate += sums.balanceRate;
+        }
+        for (auto it = stripes.rbegin(); it != stripes.rend(); ++it) it->lock.unlock();
+        return makePortfolio(total);
+    }
+
+    // The same totals from a full scan of the store, to check portfolio() against
+    Portfolio scanPortfolio() const {
+        unique_lock<shared_mutex> structure(structureMutex);
+        PortfolioSums total;
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (!accounts.isLive(row)) continue;
+            Cents balance = accounts.balance(row);
+            total.liabilities[static_cast<size_t>(accounts.kind(row))] += balance;
+            total.deposits += max<Cents>(balance, 0);
+            if (accounts.kind(row) == AccountKind::Checking) {
+                total.overdrawn += max<Cents>(-balance, 0);
+                total.overdraftLimits += accounts.overdraft(row);
+            }
+            total.balanceRate += static_cast<__int128>(balance) * accounts.rate(row);
+        }
+        return makePortfolio(total);
+    }
+
+    // The account's ledger entries with from <= time <= to (microseconds since the Unix epoch),
+    // oldest first. Closed accounts keep their history; NotFound if the number never had any.
+    TxnStatus tryStatement(string_view accNum, int64_t from, int64_t to, vector<LedgerEntry>& entries) const {
+        entries.clear();
+        uint64_t key;
+        if (!AccountNumber::pack(accNum, key)) return TxnStatus::NotFound;
+        shared_lock<shared_mutex> structure(structureMutex);
+        lock_guard<mutex> stripe(stripeFor(key));
+        uint32_t head = ledgerHeadOf(key, index.find(key));
+        if (head == Ledger::NONE) return TxnStatus::NotFound;
+        stripes[stripeIndex(key)].ledger.statement(head, from, to, entries);
+        return TxnStatus::Ok;
+    }
+
+    // Rebuilds every balance from the ledger: each entry must be the previous balance plus its amount,
+    // and the entries since an account was opened must add up to its balance now. Returns the number
+    // of accounts that do not.
+    size_t verifyLedger() const {
+        unique_lock<shared_mutex> structure(structureMutex);
+        size_t mismatches = 0;
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (!accounts.isLive(row)) continue;
+            uint64_t key = accounts.number(row).key();
+            const Ledger& ledger = stripes[stripeIndex(key)].ledger;
+            Cents total = 0, expected = accounts.balance(row);
+            bool consistent = true, opened = false;
+            ledger.forEachNewestFirst(accounts.ledgerHead(row), [&](uint32_t entry) {
+                consistent = consistent && ledger.balanceAt(entry) == expected;
+                expected = ledger.balanceAt(entry) - ledger.amountAt(entry);
+                total += ledger.amountAt(entry);
+                opened = ledger.kindAt(entry) == LedgerKind::Open;
+                return !opened;
+            });
+            if (!opened || !consistent || total != accounts.balance(row) || expected != 0) mismatches++;
+        }
+        return mismatches;
+    }
+
+    MemoryUsage memoryUsage() const {
+        shared_lock<shared_mutex> structure(structureMutex);
+        MemoryUsage usage;
+        usage.accounts = accounts.size();
+        usage.distinctNames = accounts.distinctNames();
+        usage.columnBytes = accounts.columnBytes();
+        usage.nameBytes = accounts.nameBytes();
+        usage.indexBytes = index.memoryBytes();
+        return usage;
+    }
+
+    // Entries and bytes held by the ledger
+    pair<size_t, size_t> ledgerSize() const {
+        unique_lock<shared_mutex> structure(structureMutex);
+        size_t entries = 0, bytes = 0;
+        for (const LockStripe& stripe : stripes) {
+            entries += stripe.ledger.size();
+            bytes += stripe.ledger.memoryBytes() + stripe.closedHeads.memoryBytes();
+        }
+        bytes += accounts.rowCount() * sizeof(uint32_t); // the head column
+        return { entries, bytes };
+    }
+
+    // Operation counts by outcome and latency percentiles since the bank was created, as CSV
+    void printMetrics(ostream& out) const { metrics.print(out); }
+
+    // Writes printMetrics output to a temporary file renamed into place, so readers never see half a dump
+    bool writeMetrics(const string& path) const {
+        string tempPath = path + ".tmp";
+        ofstream outFile(tempPath, ios::trunc);
+        if (outFile) printMetrics(outFile);
+        outFile.close();
+        if (!outFile || rename(tempPath.c_str(), path.c_str()) != 0) {
+            unlink(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool addAccount(unique_ptr<Account> newAccount) {
+        TxnStatus status = tryAddAccount(std::move(newAccount));
+        if (status != TxnStatus::Ok) cout << "Error: " << describeStatus(status) << "." << endl;
+        return status == TxnStatus::Ok;
+    }
+
+    // True if the account exists. No view is handed out: its fields could change or the row be
+    // reused once the locks are dropped, so read them with withAccount.
+    bool searchByAccountNumber(string_view accNum) const {
+        OpTimer timer(metrics, BankOp::Lookup);
+        shared_lock<shared_mutex> structure(structureMutex);
+        uint32_t row = findRow(accNum);
+        return timer.finish(row == AccountStore::NO_ROW ? TxnStatus::NotFound : TxnStatus::Ok) == TxnStatus::Ok;
+    }
+
+    // Secondary-index queries: one tree search per index shard plus O(log shards) per result. The
+    // first query builds the indexes. The accounts are copied out, not handed out as views, for the
+    // same reason as in searchByAccountNumber.
+
+    // Accounts with low <= balance < high, lowest balance first
+    vector<AccountDetails> findByBalance(Cents low, Cents high, size_t limit = SIZE_MAX) {
+        unique_lock<shared_mutex> structure(structureMutex);
+        buildSecondaryIndexes();
+        vector<pair<BalanceIndex::BalanceSet::const_iterator, BalanceIndex::BalanceSet::const_iterator>> ranges;
+        for (const IndexShard& shard : indexShards)
+            ranges.emplace_back(shard.balances.balances().lower_bound({ low, 0 }), shard.balances.balances().end());
+        vector<AccountDetails> found;
+        mergeRanges(ranges, limit, less<BalanceIndex::ByBalance>(), [&](const BalanceIndex::ByBalance& entry) {
+            if (entry.balance >= high) return false;
+            found.push_back(detailsOf(index.find(entry.key)));
+            return true;
+        });
+        return found;
+    }
+
+    // The n highest balances, highest first
+    vector<AccountDetails> topBalances(size_t n) {
+        unique_lock<shared_mutex> structure(structureMutex);
+        buildSecondaryIndexes();
+        vector<pair<BalanceIndex::BalanceSet::const_reverse_iterator, BalanceIndex::BalanceSet::const_reverse_iterator>> ranges;
+        for (const IndexShard& shard : indexShards)
+            ranges.emplace_back(shard.balances.balances().rbegin(), shard.balances.balances().rend());
+        vector<AccountDetails> found;
+        mergeRanges(ranges, n, [](const BalanceIndex::ByBalance& a, const BalanceIndex::ByBalance& b) { return b < a; },
+                    [&](const BalanceIndex::ByBalance& entry) {
+                        found.push_back(detailsOf(index.find(entry.key)));
+                        return true;
+                    });
+        return found;
+    }
+
+    // Accounts of the given type (None for any) with low <= available balance < high, lowest first.
+    // Checking accounts near their overdraft limit are those with a small available balance.
+    vector<AccountDetails> findByAvailable(AccountKind kind, Cents low, Cents high, size_t limit = SIZE_MAX) {
+        unique_lock<shared_mutex> structure(structureMutex);
+        buildSecondaryIndexes();
+        vector<pair<BalanceIndex::AvailableSet::const_iterator, BalanceIndex::AvailableSet::const_iterator>> ranges;
+        for (AccountKind k : { AccountKind::Basic, AccountKind::Savings, AccountKind::Checking }) {
+            if (kind != AccountKind::None && kind != k) continue;
+            for (const IndexShard& shard : indexShards) {
+                const BalanceIndex::AvailableSet& entries = shard.balances.available();
+                ranges.emplace_back(entries.lower_bound({ k, low, 0 }), entries.lower_bound({ k, high, 0 }));
+            }
+        }
+        vector<AccountDetails> found;
+        mergeRanges(ranges, limit,
+                    [](const BalanceIndex::ByAvailable& a, const BalanceIndex::ByAvailable& b) {
+                        return tie(a.available, a.key) < tie(b.available, b.key);
+                    },
+                    [&](const BalanceIndex::ByAvailable& entry) {
+                        found.push_back(detailsOf(index.find(entry.key)));
+                        return true;
+                    });
+        return found;
+    }
+
+    // Accounts whose customer name starts with prefix (ignoring case), in name order
+    vector<AccountDetails> findByNamePrefix(string_view prefix, size_t limit = SIZE_MAX) {
+        unique_lock<shared_mutex> structure(structureMutex);
+        buildSecondaryIndexes();
+        vector<AccountDetails> found;
+        names.forEachWithPrefix(prefix, limit, [&](uint64_t key) { found.push_back(detailsOf(index.find(key))); });
+        return found;
+    }
+
+    void displayAllAccounts() const {
+        unique_lock<shared_mutex> structure(structureMutex);
+        if (accounts.size() == 0) {
+            cout << "No accounts in the system." << endl;
+            return;
+        }
+        int count = 1;
+        for (uint32_t row = 0; row < accounts.rowCount(); row++) {
+            if (!accounts.isLive(row)) continue;
+            cout << "\n--- Account " << count++ << " ---" << endl;
+            AccountView(accounts, row).displayDetails();
+        }
+    }
+
+    bool deleteAccount(string_view accNum) {
+        TxnStatus status = tryDeleteAccount(accNum);
+        if (status != TxnStatus::Ok) {
+            cout << describeStatus(status) << "." << endl;
+            return false;
+        }
+        cout << "Account deleted successfully." << endl;
+        return true;
+    }
+
+    bool deposit(string_view accNum, Cents amount) {
+        BalanceChange change;
+        TxnStatus status = tryDeposit(accNum, amount, &change);
+        switch (status) {
+        case TxnStatus::Ok:
+            cout << "Deposit successful! Previous: $" << formatMoney(change.before)
+                 << ", Deposited: $" << formatMoney(amount) << ", New: $" << formatMoney(change.after) << endl;
+            return true;
+        case TxnStatus::InvalidAmount:
+            if (amount > 0) cout << "Error: The balance cannot exceed $" << formatMoney(MAX_BALANCE) << "." << endl;
+            else cout << "Error: Amount must be positive." << endl;
+            return false;
+        default: cout << "Error: " << describeStatus(status) << "." << endl; return false;
+        }
+    }
+
+    bool withdraw(string_view accNum, Cents amount) {
+        BalanceChange change;
+        TxnStatus status = tryWithdraw(accNum, amount, &change);
+        switch (status) {
+        case TxnStatus::Ok:
+            cout << "Withdrawal successful! Previous: $" << formatMoney(change.before)
+                 << ", Withdrawn: $" << formatMoney(amount) << ", New: $" << formatMoney(change.after) << endl;
+            return true;
+        case TxnStatus::InvalidAmount: cout << "Error: Amount must be positive." << endl; return false;
+        case TxnStatus::InsufficientFunds:
+            cout << "Error: Insufficient funds! Available: $" << formatMoney(change.available) << endl;
+            return false;
+        default: cout << "Error: " << describeStatus(status) << "." << endl; return false;
+        }
+    }
+
+    bool transfer(string_view from, string_view to, Cents amount) {
+        BalanceChange change;
+        TxnStatus status = tryTransfer(from, to, amount, &change);
+        if (status == TxnStatus::Ok) {
+            cout << "Transfer successful! Moved $" << formatMoney(amount) << " from " << from << " to " << to
+                 << ". Source balance: $" << formatMoney(change.after) << endl;
+            return true;
+        }
+        cout << "Error: " << describeStatus(status);
+        if (status == TxnStatus::InsufficientFunds) cout << "! Available: $" << formatMoney(change.available);
+        cout << endl;
+        return false;
+    }
+
+    void showAccountInfo(string_view accNum) {
+        unique_lock<shared_mutex> structure(structureMutex);
+        uint32_t row = findRow(accNum);
+        if (row == AccountStore::NO_ROW) { cout << "Error: Account not found." << endl; return; }
+        AccountView acc(accounts, row);
+
+        cout << "\n=== Account Information ===" << endl;
+        acc.displayDetails();
+        cout << "\n=== Special Features ===" << endl;
+        acc.showSpecialFeatures();
+    }
+
+    // Returns why an account number or customer name is invalid, or "" if it is valid
+    static string validationError(string_view str, bool isName) {
+        // Almost every input is valid; those are settled by a word-at-a-time scan, and the checks
+        // below only run to name the reason
+        if (isName ? str.length() >= 2 && swarIsName(str)
+                   : str.length() >= 3 && str.length() <= AccountNumber::MAX_DIGITS && swarAllDigits(str))
+            return "";
+        if (str.empty() || str.length() < (isName ? 2 : 3))
+            return string(isName ? "Name" : "Account number") + " must be at least " + (isName ? "2" : "3") + " characters long.";
+        if (!isName && str.length() > AccountNumber::MAX_DIGITS)
+            return "Account number must be at most " + to_string(AccountNumber::MAX_DIGITS) + " digits long.";
+
+        bool valid;
+        if (isName) {
+            valid = all_of(str.begin(), str.end(), [](char c) { return isalpha(c) || c == ' '; });
+        } else {
+            valid = all_of(str.begin(), str.end(), [](char c) { return isdigit(c); });
+        }
+        if (!valid)
+            return isName ? "Name can only contain letters and spaces" : "Account number can only contain numbers";
+
+        if (isName && !any_of(str.begin(), str.end(), [](char c) { return isalpha(c); }))
+            return "Name must contain at least one letter.";
+        return "";
+    }
+
+    unique_ptr<Account> createAccount(int type, const string& accNum, const string& custName, Cents balance) {
+        if (!isValid(accNum, false) || !isValid(custName, true) || balance < 0) return nullptr;
+
+        switch (type) {
+        case 1: return make_unique<Account>(accNum, custName, balance);
+        case 2: {
+            double rate;
+            cout << "Enter interest rate (default 2.5%): ";
+            cin >> rate;
+            return make_unique<SavingsAccount>(accNum, custName, balance, rate > 0 ? toRatePpm(rate) : DEFAULT_INTEREST_RATE);
+        }
+        case 3: {
+            double overdraft;
+            cout << "Enter overdraft limit (default $500): $";
+            cin >> overdraft;
+            return make_unique<CheckingAccount>(accNum, custName, balance,
+                                                overdraft >= 0 ? toCents(overdraft) : DEFAULT_OVERDRAFT_LIMIT);
+        }
+        }
+        return nullptr;
+    }
+};
+
+// Blocks while word == expected (Linux futex); returns early on a wake or a spurious wakeup
+inline void futexWait(atomic<uint32_t>& word, uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void futexWake(atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+// Where TxnEngine reports one request's outcome. The submitter owns it and must keep it alive
+// until done(); wait() spins briefly, then sleeps on a futex that the applier wakes only if needed.
+class TxnCompletion {
+public:
+    TxnResult result;
+
+    bool done() const { return state.load(memory_order_acquire) == DONE; }
+
+    void wait() {
+        for (int spin = 0; spin < 64; spin++) {
+            if (done()) return;
+        }
+        uint32_t expected = PENDING;
+        state.compare_exchange_strong(expected, SLEEPING, memory_order_acquire);
+        while (!done()) futexWait(state, SLEEPING);
+    }
+
+private:
+    friend class TxnEngine;
+    static const uint32_t PENDING = 0, SLEEPING = 1, DONE = 2;
+    atomic<uint32_t> state{ DONE };
+
+    void complete() {
+        if (state.exchange(DONE, memory_order_acq_rel) == SLEEPING) futexWake(state);
+    }
+};
+
+// Single-writer transaction engine: any number of threads submit requests into a bounded
+// multi-producer ring, and one applier thread drains whatever has queued (up to MAX_BATCH) and
+// applies it with BankSystem::applyBatch: one lock acquisition and one journal commit per batch
+// instead of a shared lock, a stripe lock and a commit per request. Producers claim a position
+// with one fetch_add, copy the request in and publish it through the slot's sequence number (the
+// Disruptor/Vyukov scheme), so they never take a lock. The bank may still be used directly
+// alongside, but the engine gains most when it is the only writer.
+class TxnEngine {
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 14;
+    static const size_t MAX_BATCH = 1024;
+
+    // capacity is rounded up to a power of two
+    explicit TxnEngine(BankSystem& bankSystem, size_t capacity = DEFAULT_CAPACITY) : bank(bankSystem) {
+        size_t slots = 1;
+        while (slots < capacity) slots <<= 1;
+        mask = slots - 1;
+        ring.reset(new Slot[slots]);
+        for (size_t i = 0; i < slots; i++) ring[i].sequence.store(i, memory_order_relaxed);
+        applier = thread(&TxnEngine::applyLoop, this);
+    }
+    TxnEngine(const TxnEngine&) = delete;
+    TxnEngine& operator=(const TxnEngine&) = delete;
+
+    // Applies everything already submitted, then stops; no submit may race with this
+    ~TxnEngine() {
+        stopping.store(true);
+        wakeApplier();
+        applier.join();
+    }
+
+    // Queues a request; `completion` is done once it has been applied (and journaled durably if
+    // the bank acks durably). Waits only while the ring is full.
+    void submit(const TxnRequest& request, TxnCompletion& completion) {
+        completion.state.store(TxnCompletion::PENDING, memory_order_relaxed);
+        uint64_t position = tail.fetch_add(1, memory_order_relaxed);
+        Slot& slot = ring[position & mask];
+        for (unsigned spins = 0; slot.sequence.load(memory_order_acquire) != position; spins++) {
+            if (spins > 64) this_thread::yield(); // ring full: the applier has not freed this slot yet
+        }
+        slot.request = request;
+        slot.completion = &completion;
+        slot.sequence.store(position + 1, memory_order_release);
+        wakeApplier();
+    }
+
+    // Submits and waits: the engine counterpart of tryDeposit/tryWithdraw/tryTransfer
+    TxnStatus execute(const TxnRequest& request, BalanceChange* change = nullptr) {
+        TxnCompletion completion;
+        submit(request, completion);
+        completion.wait();
+        if (change) *change = completion.result.change;
+        return completion.result.status;
+    }
+
+private:
+    // sequence == position: free for the producer claiming `position`; position + 1: published
+    struct alignas(64) Slot {
+        atomic<uint64_t> sequence{ 0 };
+        TxnRequest request;
+        TxnCompletion* completion = nullptr;
+    };
+
+    BankSystem& bank;
+    size_t mask = 0;
+    unique_ptr<Slot[]> ring;
+    alignas(64) atomic<uint64_t> tail{ 0 }; // next position a producer claims
+    alignas(64) atomic<uint32_t> applierSleeping{ 0 };
+    atomic<bool> stopping{ false };
+    thread applier;
+
+    // The fence pairs with the one in applyLoop: either the applier sees the new slot before it
+    // sleeps, or this sees applierSleeping and wakes it
+    void wakeApplier() {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (applierSleeping.load(memory_order_relaxed) && applierSleeping.exchange(0) == 1) futexWake(applierSleeping);
+    }
+
+    void applyLoop() {
+        vector<TxnRequest> requests(MAX_BATCH);
+        vector<TxnCompletion*> completions(MAX_BATCH);
+        vector<TxnResult> results(MAX_BATCH);
+        uint64_t head = 0;
+        unsigned idle = 0;
+        while (true) {
+            size_t n = 0;
+            for (; n < MAX_BATCH; n++, head++) {
+                Slot& slot = ring[head & mask];
+                if (slot.sequence.load(memory_order_acquire) != head + 1) break;
+                requests[n] = slot.request;
+                completions[n] = slot.completion;
+                slot.sequence.store(head + mask + 1, memory_order_release); // free for the next lap
+            }
+            if (n > 0) {
+                idle = 0;
+                bank.applyBatch(requests.data(), n, results.data());
+                for (size_t i = 0; i < n; i++) {
+                    completions[i]->result = results[i];
+                    completions[i]->complete();
+                }
+                continue;
+            }
+            if (stopping.load()) break;
+            if (++idle < 16) {
+                this_thread::yield();
+                continue;
+            }
+            applierSleeping.store(1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (ring[head & mask].sequence.load(memory_order_relaxed) != head + 1 && !stopping.load())
+                futexWait(applierSleeping, 1);
+            applierSleeping.store(0, memory_order_relaxed);
+        }
+    }
+};
+
+// Function to clear input buffer
+void clearInputBuffer() {
+    cin.clear();
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+}
+
+// Function to ask for retry with specific error messages
+bool askForRetry(const string& errorType) {
+    string choice;
+    cout << "Error in " << errorType << ". Do you want to retry? (y/n): ";
+    getline(cin, choice);
+    return (choice == "y" || choice == "Y");
+}
+
+// menu selection with error handling
+int getMenuChoice() {
+    int choice;
+    while (true) {
+        cout << "\n===== Bank Account Management System =====\n"
+             << "1. Add account\n2. Display all accounts\n3. Search by account number\n"
+             << "4. Deposit\n5. Withdraw\n6. Delete account\n7. Show account info\n8. Exit\n"
+             << "9. Find accounts\n10. Account statement\n11. Portfolio summary\n";
+        cout << "Enter choice: ";
+
+        if (!(cin >> choice) || choice < 1 || choice > 11) {
+            cout << "Error: Invalid input. Please enter a number between 1 and 11." << endl;
+            clearInputBuffer();
+            if (!askForRetry("menu selection")) {
+                return -1; // User chose not to retry
+            }
+            continue;
+        }
+        cin.ignore(); // Clear the newline after numeric input
+        return choice;
+    }
+}
+
+// account number input with validation
 string getAccountNumber(BankSystem& bankSystem, bool shouldExist = true) {
     string accNum;
     while (true) {
-         cout << "Enter account number (numbers only, min 3 digits): ";
-        getline(cin, accNum);
+         cout << "Enter account number (numbers only, min 3 digits): ";
+        getline(cin, accNum);
+
+        // Basic validation
+        if (accNum.empty() || accNum.length() < 3) {
+            cout << "Error: Account number must be at least 3 characters long." << endl;
+            if (!askForRetry("account number input")) {
+                return "";
+            }
+            continue;
+        }
+
+        // Check if contains only digits
+        bool validFormat = all_of(accNum.begin(), accNum.end(), [](char c) { return isdigit(c); });
+        if (!validFormat) {
+            cout << "Error: Account number can only contain numbers." << endl;
+            if (!askForRetry("account number input")) {
+                return "";
+            }
+            continue;
+        }
+
+        if (accNum.length() > AccountNumber::MAX_DIGITS) {
+            cout << "Error: Account number must be at most " << AccountNumber::MAX_DIGITS << " digits long." << endl;
+            if (!askForRetry("account number input")) {
+                return "";
+            }
+            continue;
+        }
+
+        // Check existence
+        bool exists = bankSystem.searchByAccountNumber(accNum);
+        if (shouldExist && !exists) {
+            cout << "Error: Account number " << accNum << " not found." << endl;
+            if (!askForRetry("account number input")) {
+                return "";
+            }
+            continue;
+        }
+
+        if (!shouldExist && exists) {
+            cout << "Error: Account number " << accNum << " already exists." << endl;
+            if (!askForRetry("account number input")) {
+                return "";
+            }
+            continue;
+        }
+
+        return accNum;
+    }
+}
+
+// amount input with validation
+double getAmount() {
+    double amount;
+    while (true) {
+        cout << "Enter amount: $";
+        if (!(cin >> amount)) {
+            cout << "Error: Invalid input. Please enter a valid number." << endl;
+            clearInputBuffer();
+            if (!askForRetry("amount input")) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (amount <= 0) {
+            cout << "Error: Amount must be positive." << endl;
+            clearInputBuffer(); // Clear the input buffer after detecting negative amount
+            if (!askForRetry("amount input")) {
+                return -1;
+            }
+            continue;
+        }
+
+        clearInputBuffer(); // Clear the input buffer before returning valid amount
+        return amount;
+    }
+}
+
+// customer name input
+string getCustomerName() {
+    string custName;
+    while (true) {
+        cout << "Enter customer name: ";
+        getline(cin, custName);
+
+        if (custName.empty() || custName.length() < 2) {
+            cout << "Error: Name must be at least 2 characters long." << endl;
+            if (!askForRetry("account input process")) {
+                return "";
+            }
+            continue;
+        }
+
+        bool validName = all_of(custName.begin(), custName.end(), [](char c) { return isalpha(c) || c == ' '; });
+        bool hasLetter = any_of(custName.begin(), custName.end(), [](char c) { return isalpha(c); });
+
+        if (!validName) {
+            cout << "Error: Name can only contain letters and spaces." << endl;
+            if (!askForRetry("account input process")) {
+                return "";
+            }
+            continue;
+        }
+
+        if (!hasLetter) {
+            cout << "Error: Name must contain at least one letter." << endl;
+            if (!askForRetry("account input process")) {
+                return "";
+            }
+            continue;
+        }
+
+        return custName;
+    }
+}
+
+// initial balance input
+double getInitialBalance() {
+    double balance;
+    while (true) {
+        cout << "Enter initial balance: $";
+        if (!(cin >> balance)) {
+            cout << "Error: Invalid input. Please enter a valid number." << endl;
+            clearInputBuffer();
+            if (!askForRetry("account input process")) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (balance < 0) {
+            cout << "Error: Balance cannot be negative." << endl;
+            clearInputBuffer(); // Clear the input buffer after detecting negative balance
+            if (!askForRetry("account input process")) {
+                return -1;
+            }
+            continue;
+        }
+
+        clearInputBuffer(); // Clear the input buffer before returning valid balance
+        return balance;
+    }
+}
+
+//  account type selection
+int getAccountType() {
+    int type;
+    while (true) {
+        cout << "\n1. Basic Account\n2. Savings Account\n3. Checking Account\n";
+        cout << "Enter account type: ";
+
+        if (!(cin >> type) || type < 1 || type > 3) {
+            cout << "Error: Invalid choice. Please enter 1, 2, or 3." << endl;
+            clearInputBuffer();
+            if (!askForRetry("account input process")) {
+                return -1;
+            }
+            continue;
+        }
+        cin.ignore(); // Clear the newline after numeric input
+        return type;
+    }
+}
+
+// account creation process
+bool createNewAccount(BankSystem& bankSystem) {
+    while (true) {
+        cout << "\n=== Add New Account ===" << endl;
+
+        // Get account type
+        int type = getAccountType();
+        if (type == -1) return false; // User chose not to retry
+
+        // Get account number
+        string accNum = getAccountNumber(bankSystem, false); // false = should not exist
+        if (accNum.empty()) return false; // User chose not to retry
+
+        // Get customer name
+        string custName = getCustomerName();
+        if (custName.empty()) return false; // User chose not to retry
+
+        // Get initial balance
+        double balance = getInitialBalance();
+        if (balance == -1) return false; // User chose not to retry
+
+        // Create and add account
+        auto acc = bankSystem.createAccount(type, accNum, custName, toCents(balance));
+        if (acc && bankSystem.addAccount(std::move(acc))) {
+            cout << "Account added successfully!" << endl;
+            return true;
+        } else {
+            cout << "Error: Failed to create account." << endl;
+            if (!askForRetry("account input process")) {
+                return false;
+            }
+            // Continue the loop to retry the entire process
+        }
+    }
+}
+
+// account search
+bool searchAccount(BankSystem& bankSystem) {
+    while (true) {
+        string accNum = getAccountNumber(bankSystem, true); // true = should exist
+        if (accNum.empty()) return false; // User chose not to retry
+
+        TxnStatus status = bankSystem.withAccount(accNum, [](AccountView acc) {
+            cout << "\nAccount found:" << endl;
+            acc.displayDetails();
+        });
+        if (status == TxnStatus::Ok) {
+            return true;
+        } else {
+            cout << "Error: Account not found." << endl;
+            if (!askForRetry("account search")) {
+                return false;
+            }
+            // Continue the loop to retry
+        }
+    }
+}
+
+// deposit process
+bool performDeposit(BankSystem& bankSystem) {
+    while (true) {
+        string accNum = getAccountNumber(bankSystem, true);
+        if (accNum.empty()) return false;
+
+        double amount = getAmount();
+        if (amount == -1) return false;
+
+        if (bankSystem.deposit(accNum, toCents(amount))) {
+            return true;
+        } else {
+            cout << "Error: Deposit failed." << endl;
+            if (!askForRetry("amount input")) {
+                return false;
+            }
+            // Continue the loop to retry
+        }
+    }
+}
+
+// withdrawal process
+bool performWithdrawal(BankSystem& bankSystem) {
+    while (true) {
+        string accNum = getAccountNumber(bankSystem, true);
+        if (accNum.empty()) return false;
+
+        double amount = getAmount();
+        if (amount == -1) return false;
+
+        if (bankSystem.withdraw(accNum, toCents(amount))) {
+            return true;
+        } else {
+            if (!askForRetry("withdrawal process")) {
+                return false;
+            }
+            // Continue the loop to retry
+        }
+    }
+}
+
+// account deletion
+bool deleteAccount(BankSystem& bankSystem) {
+    while (true) {
+        string accNum = getAccountNumber(bankSystem, true);
+        if (accNum.empty()) return false;
+
+        cout << "Delete account " << accNum << "? (y/n): ";
+        string confirm;
+        getline(cin, confirm);
+        if (confirm == "y" || confirm == "Y") {
+            bankSystem.deleteAccount(accNum);
+            return true;
+        } else {
+            cout << "Account deletion cancelled." << endl;
+            return true;
+        }
+    }
+}
+
+// Enhanced show account info
+bool showAccountInfo(BankSystem& bankSystem) {
+    while (true) {
+        string accNum = getAccountNumber(bankSystem, true);
+        if (accNum.empty()) return false;
+
+        bankSystem.showAccountInfo(accNum);
+        return true;
+    }
+}
+
+// Dollar amount input (may be negative) for account queries
+bool getQueryAmount(const string& prompt, Cents& amount) {
+    while (true) {
+        string text;
+        cout << prompt;
+        getline(cin, text);
+        if (parseMoney(text, amount)) return true;
+        cout << "Error: Invalid input. Please enter a valid number." << endl;
+        if (!askForRetry("amount input")) return false;
+    }
+}
+
+// Balance, top-N, overdraft and name-prefix queries answered from the secondary indexes
+bool findAccounts(BankSystem& bankSystem) {
+    cout << "1. Balance in a range\n2. Top balances\n3. Checking accounts near their overdraft limit\n"
+         << "4. Customer name starts with\nEnter choice: ";
+    string choice;
+    getline(cin, choice);
+
+    vector<AccountDetails> found;
+    if (choice == "1") {
+        Cents low, high;
+        if (!getQueryAmount("Minimum balance: $", low) || !getQueryAmount("Maximum balance: $", high)) return false;
+        found = bankSystem.findByBalance(low, high + 1); // both ends inclusive
+    } else if (choice == "2") {
+        string text;
+        size_t count = 0;
+        cout << "How many accounts: ";
+        getline(cin, text);
+        auto result = from_chars(text.data(), text.data() + text.size(), count);
+        if (result.ec != errc() || result.ptr != text.data() + text.size() || count == 0) {
+            cout << "Error: Invalid input. Please enter a positive whole number." << endl;
+            return false;
+        }
+        found = bankSystem.topBalances(count);
+    } else if (choice == "3") {
+        Cents margin;
+        if (!getQueryAmount("Available balance at most: $", margin)) return false;
+        found = bankSystem.findByAvailable(AccountKind::Checking, numeric_limits<Cents>::min(), margin + 1);
+    } else if (choice == "4") {
+        string prefix;
+        cout << "Name starts with: ";
+        getline(cin, prefix);
+        found = bankSystem.findByNamePrefix(prefix);
+    } else {
+        cout << "Error: Invalid choice." << endl;
+        return false;
+    }
+
+    if (found.empty()) {
+        cout << "No matching accounts." << endl;
+        return true;
+    }
+    for (size_t i = 0; i < found.size(); i++) {
+        cout << "\n--- Match " << i + 1 << " of " << found.size() << " ---" << endl;
+        found[i].displayDetails();
+    }
+    return true;
+}
+
+// A whole non-negative decimal number, as given on the command line; false for a sign, other
+// characters or a value too large
+bool parseCount(const char* text, size_t& value) {
+    const char* end = text + strlen(text);
+    auto result = from_chars(text, end, value);
+    return text != end && result.ec == errc() && result.ptr == end;
+}
+
+// "YYYY-MM-DD" as microseconds since the Unix epoch at the start of that day (UTC)
+bool parseDate(string_view text, int64_t& micros) {
+    int year = 0, month = 0, day = 0;
+    auto number = [&](size_t at, size_t length, int& value) {
+        auto result = from_chars(text.data() + at, text.data() + at + length, value);
+        return result.ec == errc() && result.ptr == text.data() + at + length;
+    };
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-' || !number(0, 4, year) || !number(5, 2, month)
+        || !number(8, 2, day) || month < 1 || month > 12)
+        return false;
+    static const int DAYS_IN_MONTH[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (day < 1 || day > DAYS_IN_MONTH[month - 1] + (month == 2 && leap)) return false;
+    tm date = {};
+    date.tm_year = year - 1900;
+    date.tm_mon = month - 1;
+    date.tm_mday = day;
+    micros = static_cast<int64_t>(timegm(&date)) * 1000000;
+    return true;
+}
+
+// "YYYY-MM-DD HH:MM:SS" (UTC)
+string formatTimestamp(int64_t micros) {
+    time_t seconds = static_cast<time_t>(micros / 1000000);
+    tm date;
+    gmtime_r(&seconds, &date);
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &date);
+    return text;
+}
+
+// Date bound for a statement; blank keeps the default (open-ended)
+bool getStatementDate(const string& prompt, int64_t& micros) {
+    while (true) {
+        string text;
+        cout << prompt;
+        getline(cin, text);
+        if (text.empty() || parseDate(text, micros)) return true;
+        cout << "Error: Invalid date. Please use YYYY-MM-DD." << endl;
+        if (!askForRetry("date input")) return false;
+    }
+}
+
+// Every balance change of an account between two dates (inclusive), from the ledger
+bool showStatement(BankSystem& bankSystem) {
+    string accNum = getAccountNumber(bankSystem, true);
+    if (accNum.empty()) return false;
+    int64_t from = numeric_limits<int64_t>::min(), to = numeric_limits<int64_t>::max();
+    if (!getStatementDate("From date (YYYY-MM-DD, blank for the first entry): ", from)
+        || !getStatementDate("To date (YYYY-MM-DD, blank for the latest entry): ", to))
+        return false;
+    if (to != numeric_limits<int64_t>::max()) to += 86400LL * 1000000 - 1; // through the end of that day
+
+    vector<LedgerEntry> entries;
+    if (bankSystem.tryStatement(accNum, from, to, entries) != TxnStatus::Ok) {
+        cout << "Error: No history for account " << accNum << "." << endl;
+        return false;
+    }
+    if (entries.empty()) {
+        cout << "No transactions in that period." << endl;
+        return true;
+    }
+    cout << "\n--- Statement for " << accNum << " (" << entries.size() << " entries) ---\n";
+    cout << left << setw(21) << "Date (UTC)" << setw(17) << "Type" << right << setw(16) << "Amount" << setw(16) << "Balance" << "\n";
+    for (const LedgerEntry& entry : entries) {
+        cout << left << setw(21) << formatTimestamp(entry.time) << setw(17) << ledgerKindName(entry.kind) << right
+             << setw(16) << (entry.amount >= 0 ? "+$" + formatMoney(entry.amount) : "-$" + formatMoney(-entry.amount))
+             << setw(16) << "$" + formatMoney(entry.balance) << "\n";
+    }
+    cout << left;
+    return true;
+}
+
+// Bank-wide totals by account type, from the running portfolio sums
+void showPortfolio(const BankSystem& bankSystem) {
+    Portfolio portfolio = bankSystem.portfolio();
+    cout << "\n--- Portfolio Summary ---\n";
+    cout << left << setw(18) << "Type" << right << setw(10) << "Accounts" << setw(20) << "Liabilities" << "\n";
+    for (AccountKind kind : { AccountKind::Basic, AccountKind::Savings, AccountKind::Checking }) {
+        size_t k = static_cast<size_t>(kind);
+        cout << left << setw(18) << accountTypeName(kind) << right << setw(10) << portfolio.accounts[k]
+             << setw(20) << (portfolio.liabilities[k] < 0 ? "-$" + formatMoney(-portfolio.liabilities[k])
+                                                         : "$" + formatMoney(portfolio.liabilities[k])) << "\n";
+    }
+    cout << left << "Total deposits: $" << formatMoney(portfolio.deposits)
+         << "\nOverdraft exposure: $" << formatMoney(portfolio.overdrawn) << " drawn of $"
+         << formatMoney(portfolio.overdraftLimits) << " granted"
+         << "\nProjected annual interest (savings): $" << formatMoney(portfolio.projectedInterest) << endl;
+}
+
+// Main system function
+int runBankSystem() {
+    BankSystem bankSystem;
+    int choice;
+
+    do {
+        choice = getMenuChoice();
+        if (choice == -1) {
+            cout << "Operation cancelled. Returning to main menu." << endl;
+            continue;
+        }
+
+        switch (choice) {
+        case 1:
+            createNewAccount(bankSystem);
+            break;
+        case 2:
+            bankSystem.displayAllAccounts();
+            break;
+        case 3:
+            searchAccount(bankSystem);
+            break;
+        case 4:
+            performDeposit(bankSystem);
+            break;
+        case 5:
+            performWithdrawal(bankSystem);
+            break;
+        case 6:
+            deleteAccount(bankSystem);
+            break;
+        case 7:
+            showAccountInfo(bankSystem);
+            break;
+        case 8:
+            cout << "Thank you for using Bank Account Management System!" << endl;
+            break;
+        case 9:
+            findAccounts(bankSystem);
+            break;
+        case 10:
+            showStatement(bankSystem);
+            break;
+        case 11:
+            showPortfolio(bankSystem);
+            break;
+        }
+    } while (choice != 8);
+
+    return 1;
+}
+
+// Converts between the legacy text format and the binary snapshot format
+int runConversion(const string& mode, const string& inPath, const string& outPath) {
+    BankOptions opts;
+    opts.autoLoad = false;
+    opts.saveOnExit = false;
+    opts.journaling = false;
+    BankSystem bankSystem(opts);
+
+    if (mode == "--to-binary") {
+        bankSystem.loadAccountsFromFile(inPath);
+        return bankSystem.saveSnapshot(outPath) ? 0 : 1;
+    }
+    // Changes saved after the bank's own snapshot are in the delta file beside it
+    struct stat in, own;
+    bool ownSnapshot = stat(inPath.c_str(), &in) == 0 && stat(opts.snapshotFile.c_str(), &own) == 0
+        && in.st_dev == own.st_dev && in.st_ino == own.st_ino;
+    if (!bankSystem.loadSnapshot(inPath, ownSnapshot ? opts.deltaFile : string())) return 1;
+    bankSystem.saveAccountsToFile(outPath);
+    return 0;
+}
+
+// Splits s at the next comma, returning the field and advancing s past it
+string_view nextField(string_view& s) {
+    size_t comma = s.find(',');
+    string_view field = s.substr(0, comma);
+    s = comma == string_view::npos ? string_view() : s.substr(comma + 1);
+    while (!field.empty() && isspace(static_cast<unsigned char>(field.front()))) field.remove_prefix(1);
+    while (!field.empty() && isspace(static_cast<unsigned char>(field.back()))) field.remove_suffix(1);
+    return field;
+}
+
+bool equalsIgnoreCase(string_view a, string_view b) {
+    return a.size() == b.size()
+        && equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return toupper(x) == toupper(y); });
+}
+
+// Parses the fields after "TRANSFER," (from, to, amount)
+bool parseTransferFields(string_view line, TransferRequest& request) {
+    request.from = nextField(line);
+    request.to = nextField(line);
+    return parseMoney(nextField(line), request.amount) && line.empty();
+}
+
+// Parses "<BASIC|SAVINGS|CHECKING>,<number>,<name>,<balance>[,<interest rate|overdraft limit>]"
+// and validates it; returns "" or the reason the account was rejected
+string parseAccountFields(string_view line, AccountRequest& request) {
+    string_view type = nextField(line);
+    request.number = nextField(line);
+    request.name = nextField(line);
+    request.parameter = 0;
+    bool hasParameter = false;
+    if (!parseMoney(nextField(line), request.balance)) return "Malformed balance";
+    if (!line.empty()) {
+        string_view field = nextField(line);
+        bool parsed = equalsIgnoreCase(type, "SAVINGS") ? parseRate(field, request.parameter) : parseMoney(field, request.parameter);
+        if (!parsed || !line.empty()) return "Malformed interest rate or overdraft limit";
+        hasParameter = true;
+    }
+
+    string error = BankSystem::validationError(request.number, false);
+    if (error.empty()) error = BankSystem::validationError(request.name, true);
+    if (!error.empty()) return error;
+    if (request.balance < 0) return "Balance cannot be negative.";
+
+    if (equalsIgnoreCase(type, "BASIC")) {
+        if (hasParameter) return "BASIC accounts take no interest rate or overdraft limit";
+        request.kind = AccountKind::Basic;
+    } else if (equalsIgnoreCase(type, "SAVINGS")) {
+        request.kind = AccountKind::Savings;
+        if (!hasParameter || request.parameter <= 0) request.parameter = DEFAULT_INTEREST_RATE;
+    } else if (equalsIgnoreCase(type, "CHECKING")) {
+        request.kind = AccountKind::Checking;
+        if (!hasParameter || request.parameter < 0) request.parameter = DEFAULT_OVERDRAFT_LIMIT;
+    } else {
+        return "Unknown account type";
+    }
+    return "";
+}
+
+// Counters for one batch run
+struct BatchSummary {
+    size_t lines = 0, applied = 0, rejected = 0;
+    size_t creates = 0, deposits = 0, withdrawals = 0, deletes = 0, transfers = 0;
+};
+
+// Applies one transaction line; returns "" on success or the reason it was rejected.
+//   CREATE,<BASIC|SAVINGS|CHECKING>,<number>,<name>,<balance>[,<interest rate|overdraft limit>]
+//   DEPOSIT,<number>,<amount>      WITHDRAW,<number>,<amount>
+//   DELETE,<number>                TRANSFER,<from>,<to>,<amount>
+string applyTransactionLine(BankSystem& bankSystem, string_view line, BatchSummary& summary) {
+    string_view op = nextField(line);
+    Cents amount = 0;
+
+    if (equalsIgnoreCase(op, "DEPOSIT") || equalsIgnoreCase(op, "WITHDRAW")) {
+        string_view number = nextField(line);
+        if (!parseMoney(nextField(line), amount) || !line.empty()) return "Malformed amount";
+        bool isDeposit = equalsIgnoreCase(op, "DEPOSIT");
+        TxnStatus status = isDeposit ? bankSystem.tryDeposit(number, amount) : bankSystem.tryWithdraw(number, amount);
+        if (status != TxnStatus::Ok) return describeStatus(status);
+        (isDeposit ? summary.deposits : summary.withdrawals)++;
+        return "";
+    }
+
+    if (equalsIgnoreCase(op, "TRANSFER")) {
+        TransferRequest request;
+        if (!parseTransferFields(line, request)) return "Malformed amount";
+        TxnStatus status = bankSystem.tryTransfer(request.from, request.to, request.amount);
+        if (status != TxnStatus::Ok) return describeStatus(status);
+        summary.transfers++;
+        return "";
+    }
+
+    if (equalsIgnoreCase(op, "DELETE")) {
+        string_view number = nextField(line);
+        if (!line.empty()) return "Too many fields";
+        TxnStatus status = bankSystem.tryDeleteAccount(number);
+        if (status != TxnStatus::Ok) return describeStatus(status);
+        summary.deletes++;
+        return "";
+    }
+
+    if (equalsIgnoreCase(op, "CREATE")) {
+        AccountRequest request;
+        string error = parseAccountFields(line, request);
+        if (!error.empty()) return error;
+
+        TxnStatus status = bankSystem.tryAddAccount(request.kind, request.number, request.name, request.balance,
+                                                    request.parameter);
+        if (status != TxnStatus::Ok) return describeStatus(status);
+        summary.creates++;
+        return "";
+    }
+
+    return "Unknown operation";
+}
+
+// Streams a transaction file into the bank without prompts, writing rejected lines to rejectsPath
+int runBatch(const string& inPath, const string& rejectsPath) {
+    ifstream inFile(inPath);
+    if (!inFile) {
+        cout << "Error: Could not open " << inPath << "." << endl;
+        return 1;
+    }
+    ofstream rejects(rejectsPath);
+    if (!rejects) {
+        cout << "Error: Could not open " << rejectsPath << "." << endl;
+        return 1;
+    }
+
+    // Journal records still reach disk through group commit, but no call waits for its fsync
+    BankOptions opts;
+    opts.durableAcks = false;
+    BankSystem bankSystem(opts);
+
+    BatchSummary summary;
+    auto record = [&](size_t lineNumber, const string& text, const string& reason) {
+        if (reason.empty()) {
+            summary.applied++;
+        } else {
+            summary.rejected++;
+            rejects << "line " << lineNumber << ": " << text << " | " << reason << "\n";
+        }
+    };
+
+    // Runs of consecutive TRANSFER lines are applied through tryTransferBatch
+    const size_t TRANSFER_BATCH_SIZE = 4096;
+    vector<pair<size_t, string>> pendingTransfers;
+    auto flushTransfers = [&] {
+        if (pendingTransfers.size() == 1) { // not worth a batch
+            record(pendingTransfers[0].first, pendingTransfers[0].second,
+                   applyTransactionLine(bankSystem, pendingTransfers[0].second, summary));
+            pendingTransfers.clear();
+            return;
+        }
+        vector<TransferRequest> requests;
+        vector<string> reasons(pendingTransfers.size());
+        vector<size_t> requestLine;
+        for (size_t i = 0; i < pendingTransfers.size(); i++) {
+            TransferRequest request;
+            string_view fields = string_view(pendingTransfers[i].second);
+            nextField(fields); // "TRANSFER"
+            if (!parseTransferFields(fields, request)) {
+                reasons[i] = "Malformed amount";
+                continue;
+            }
+            requests.push_back(request);
+            requestLine.push_back(i);
+        }
+        vector<TxnStatus> results = bankSystem.tryTransferBatch(requests);
+        for (size_t r = 0; r < results.size(); r++) {
+            if (results[r] == TxnStatus::Ok) summary.transfers++;
+            else reasons[requestLine[r]] = describeStatus(results[r]);
+        }
+        for (size_t i = 0; i < pendingTransfers.size(); i++)
+            record(pendingTransfers[i].first, pendingTransfers[i].second, reasons[i]);
+        pendingTransfers.clear();
+    };
+
+    string line;
+    auto start = chrono::steady_clock::now();
+    while (getline(inFile, line)) {
+        summary.lines++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        string_view fields(line);
+        if (equalsIgnoreCase(nextField(fields), "TRANSFER")) {
+            pendingTransfers.emplace_back(summary.lines, line);
+            if (pendingTransfers.size() >= TRANSFER_BATCH_SIZE) flushTransfers();
+            continue;
+        }
+        if (!pendingTransfers.empty()) flushTransfers();
+        record(summary.lines, line, applyTransactionLine(bankSystem, line, summary));
+    }
+    if (!pendingTransfers.empty()) flushTransfers();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "\n=== Batch Summary ===" << "\nLines read: " << summary.lines
+         << "\nApplied: " << summary.applied << " (creates " << summary.creates << ", deposits " << summary.deposits
+         << ", withdrawals " << summary.withdrawals << ", deletes " << summary.deletes
+         << ", transfers " << summary.transfers << ")"
+         << "\nRejected: " << summary.rejected << (summary.rejected ? " (see " + rejectsPath + ")" : string())
+         << "\nElapsed: " << fixed << setprecision(3) << seconds << " s"
+         << "\nThroughput: " << setprecision(0) << (seconds > 0 ? (summary.applied + summary.rejected) / seconds : 0)
+         << " ops/sec" << defaultfloat << setprecision(6) << endl;
+    return 0;
+}
+
+// Bulk-imports an accounts CSV, one "<type>,<number>,<name>,<balance>[,<rate|overdraft>]" per
+// line: the mapped file is parsed and validated without copying a field, then every valid account
+// goes in through one tryAddAccounts call. Rejected lines go to rejectsPath with the same reasons
+// the interactive prompts give.
+int runImport(const string& inPath, const string& rejectsPath) {
+    MappedFile file(inPath);
+    if (file.empty()) {
+        cout << "Error: Could not open " << inPath << " (or it is empty)." << endl;
+        return 1;
+    }
+    ofstream rejects(rejectsPath);
+    if (!rejects) {
+        cout << "Error: Could not open " << rejectsPath << "." << endl;
+        return 1;
+    }
+
+    BankOptions opts;
+    opts.durableAcks = false;
+    BankSystem bankSystem(opts);
+
+    // Lines that fail to parse are found before the insert pass, duplicates during it, so the report
+    // is sorted back into file order before it is written
+    size_t lines = 0;
+    vector<tuple<size_t, string_view, string>> rejectedLines;
+    auto reject = [&](size_t lineNumber, string_view text, string reason) {
+        rejectedLines.emplace_back(lineNumber, text, move(reason));
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<AccountRequest> requests;
+    vector<pair<size_t, string_view>> requestLines;
+    const char* p = file.data();
+    const char* end = p + file.size();
+    requests.reserve(file.size() / 32);
+    requestLines.reserve(file.size() / 32);
+    while (p < end) {
+        const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+        string_view line(p, (newline ? newline : end) - p);
+        p = newline ? newline + 1 : end;
+        lines++;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty() || line[0] == '#') continue;
+
+        AccountRequest request;
+        string error = parseAccountFields(line, request);
+        if (!error.empty()) {
+            reject(lines, line, error);
+            continue;
+        }
+        requests.push_back(request);
+        requestLines.emplace_back(lines, line);
+    }
+    auto parsed = chrono::steady_clock::now();
+
+    vector<TxnStatus> results = bankSystem.tryAddAccounts(requests);
+    size_t imported = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i] == TxnStatus::Ok) imported++;
+        else reject(requestLines[i].first, requestLines[i].second, describeStatus(results[i]));
+    }
+    sort(rejectedLines.begin(), rejectedLines.end(),
+         [](const auto& a, const auto& b) { return get<0>(a) < get<0>(b); });
+    for (const auto& [lineNumber, text, reason] : rejectedLines)
+        rejects << "line " << lineNumber << ": " << text << " | " << reason << "\n";
+    size_t rejected = rejectedLines.size();
+    auto done = chrono::steady_clock::now();
+    double parseSeconds = chrono::duration<double>(parsed - start).count();
+    double seconds = chrono::duration<double>(done - start).count();
+
+    cout << "\n=== Import Summary ===" << "\nLines read: " << lines
+         << "\nImported: " << imported
+         << "\nRejected: " << rejected << (rejected ? " (see " + rejectsPath + ")" : string())
+         << "\nElapsed: " << fixed << setprecision(3) << seconds << " s (parse and validate " << parseSeconds
+         << " s, insert " << seconds - parseSeconds << " s)"
+         << "\nThroughput: " << setprecision(0) << (seconds > 0 ? (imported + rejected) / seconds : 0)
+         << " accounts/sec" << defaultfloat << setprecision(6) << endl;
+    return 0;
+}
+
+// Fast-forwards a read-only copy of the bank's data by `days` days of scheduled interest from
+// `start` (today when empty) and reports the interest credited. The files are loaded but never
+// written, and no ledger is kept, so the simulated dates reach nothing that outlives the run.
+int runFastForward(size_t days, const string& scheduleName, const string& start) {
+    InterestSchedule schedule;
+    if (scheduleName == "daily") schedule = InterestSchedule::Daily;
+    else if (scheduleName == "monthly") schedule = InterestSchedule::Monthly;
+    else {
+        cout << "Error: Unknown schedule " << scheduleName << " (use daily or monthly)." << endl;
+        return 1;
+    }
+    int64_t from = wallClockMicros();
+    if (!start.empty() && !parseDate(start, from)) {
+        cout << "Error: Invalid date. Please use YYYY-MM-DD." << endl;
+        return 1;
+    }
+
+    BankOptions opts;
+    opts.readOnly = true;
+    opts.ledger = false;
+    BankSystem bankSystem(opts);
+    size_t savings = static_cast<size_t>(AccountKind::Savings);
+    Portfolio before = bankSystem.portfolio();
+    auto begin = chrono::steady_clock::now();
+    size_t postings = bankSystem.fastForwardInterest(from, days, schedule);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    Portfolio after = bankSystem.portfolio();
+    Cents interest = after.liabilities[savings] - before.liabilities[savings];
+
+    cout << "\n=== Fast-Forward Summary ===" << "\nDays simulated: " << days << " from " << formatTimestamp(from).substr(0, 10)
+         << "\nPostings: " << postings << " (" << scheduleName << ") to " << after.accounts[savings] << " savings accounts"
+         << "\nInterest credited: " << (interest < 0 ? "-$" + formatMoney(-interest) : "$" + formatMoney(interest))
+         << "\nElapsed: " << fixed << setprecision(3) << seconds << " s" << defaultfloat << setprecision(6) << endl;
+    return 0;
+}
+
+// Sharded deployment: each shard is a worker process that owns the accounts whose key hashes into
+// its slice of the hash range, with its own data files. A router accepts clients on a Unix-domain
+// socket and forwards each request to the shard that owns the account; a transfer between two
+// shards runs as a two-phase commit (see ShardRouter). Router, shards and ShardClient all speak
+// ShardFrame.
+enum class ShardOp : uint8_t { Add = 1, Deposit, Withdraw, Delete, Balance, Transfer, PrepareOut, PrepareIn, Commit, Abort, Stop,
+                               Pending };
+
+// One request or reply; an Add request is followed by nameLength bytes of customer name. A reply
+// is the request frame with no name, status set and, for balance changes and Balance, amount =
+// the balance after.
+struct ShardFrame {
+    uint8_t op;               // ShardOp
+    uint8_t status;           // TxnStatus, replies only
+    uint8_t kind;             // AccountKind, adds only
+    uint8_t numberLength;
+    uint8_t targetLength;     // transfers only
+    uint8_t reserved[3];
+    uint32_t nameLength;      // adds only
+    char number[AccountNumber::MAX_DIGITS];
+    char target[AccountNumber::MAX_DIGITS];
+    int64_t amount;           // cents: opening balance, amount moved, or the balance in a reply
+    int64_t parameter;        // adds only: interest rate (savings) or overdraft limit (checking)
+    uint64_t txn;             // prepare/commit/abort: the router's id for the transfer; Pending: the
+                              // id to look past, and in the reply the next prepared one
+};
+
+static_assert(sizeof(ShardFrame) == 72, "shard frame layout changed");
+
+const uint32_t MAX_SHARD_NAME = 1 << 16; // longer names are refused rather than buffered
+
+// The shard of `shards` that owns key: keys are spread by hash, so each shard gets an even slice
+inline size_t shardOf(uint64_t key, size_t shards) {
+    return static_cast<size_t>((AccountIndex::hashOf(key) >> 32) * shards >> 32);
+}
+
+// Copies an account number into a frame field; false if it cannot be one
+inline bool putShardNumber(char (&field)[AccountNumber::MAX_DIGITS], uint8_t& length, string_view number) {
+    if (number.size() > AccountNumber::MAX_DIGITS) return false;
+    memcpy(field, number.data(), number.size());
+    length = static_cast<uint8_t>(number.size());
+    return true;
+}
+
+inline string_view shardNumber(const char (&field)[AccountNumber::MAX_DIGITS], uint8_t length) {
+    return string_view(field, length > AccountNumber::MAX_DIGITS ? AccountNumber::MAX_DIGITS : length);
+}
+
+// Sends/receives exactly n bytes on a socket, retrying short transfers; false once the peer is gone
+inline bool sendAll(int fd, const void* data, size_t n) {
+    const char* p = static_cast<const char*>(data);
+    while (n > 0) {
+        ssize_t sent = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += sent;
+        n -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+inline bool recvAll(int fd, void* data, size_t n) {
+    char* p = static_cast<char*>(data);
+    while (n > 0) {
+        ssize_t got = ::recv(fd, p, n, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        n -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+inline bool sendShardFrame(int fd, const ShardFrame& frame, string_view name = {}) {
+    return sendAll(fd, &frame, sizeof(frame)) && (name.empty() || sendAll(fd, name.data(), name.size()));
+}
+
+// Reads a frame and, for an Add, its name; false if the peer is gone or broke the protocol
+inline bool recvShardFrame(int fd, ShardFrame& frame, string& name) {
+    if (!recvAll(fd, &frame, sizeof(frame))) return false;
+    name.clear();
+    if (frame.op != static_cast<uint8_t>(ShardOp::Add)) return true;
+    if (frame.nameLength > MAX_SHARD_NAME) return false;
+    name.resize(frame.nameLength);
+    return recvAll(fd, &name[0], name.size());
+}
+
+inline bool fillUnixAddress(const string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// A listening Unix-domain socket at path (replacing a stale one), or -1
+inline int listenUnix(const string& path) {
+    sockaddr_un address;
+    if (!fillUnixAddress(path, address)) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    ::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(fd, 128) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+inline int connectUnix(const string& path) {
+    sockaddr_un address;
+    if (!fillUnixAddress(path, address)) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Accepts connections on a listening socket and serves each on its own thread. Finished
+// connections are reaped as new ones arrive; stop() closes the listener, shuts every open
+// connection down and waits for their threads.
+class SocketServer {
+public:
+    SocketServer(int listenFd, function<void(int)> serveConnection) : listenFd(listenFd), serve(move(serveConnection)) {
+        acceptor = thread(&SocketServer::acceptLoop, this);
+    }
+    SocketServer(const SocketServer&) = delete;
+    SocketServer& operator=(const SocketServer&) = delete;
+    ~SocketServer() { stop(); }
+
+    void stop() {
+        if (!acceptor.joinable()) return;
+        ::shutdown(listenFd, SHUT_RDWR); // accept() fails from here on
+        acceptor.join();
+        ::close(listenFd);
+        lock_guard<mutex> lock(mtx);
+        for (auto& connection : connections) ::shutdown(connection->fd, SHUT_RDWR);
+        for (auto& connection : connections) {
+            connection->worker.join();
+            ::close(connection->fd);
+        }
+        connections.clear();
+    }
+
+private:
+    struct Connection {
+        int fd;
+        atomic<bool> finished{ false };
+        thread worker;
+    };
+
+    int listenFd;
+    function<void(int)> serve;
+    thread acceptor;
+    mutex mtx; // guards connections
+    vector<unique_ptr<Connection>> connections;
+
+    void acceptLoop() {
+        while (true) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return;
+            }
+            lock_guard<mutex> lock(mtx);
+            auto done = partition(connections.begin(), connections.end(), [](const unique_ptr<Connection>& c) { return !c->finished; });
+            for (auto it = done; it != connections.end(); ++it) {
+                (*it)->worker.join();
+                ::close((*it)->fd);
+            }
+            connections.erase(done, connections.end());
+
+            connections.emplace_back(new Connection);
+            Connection* connection = connections.back().get();
+            connection->fd = fd;
+            connection->worker = thread([this, connection] {
+                serve(connection->fd);
+                connection->finished = true;
+            });
+        }
+    }
+};
+
+// Files of shard `index` under dir; without `durable` the shard keeps its accounts in memory only
+BankOptions shardOptions(const string& dir, size_t index, bool durable) {
+    BankOptions opts;
+    string base = dir + "/shard" + to_string(index);
+    opts.textFile = base + ".txt";
+    opts.snapshotFile = base + ".snap";
+    opts.journalFile = base + ".journal";
+    opts.deltaFile = base + ".delta";
+    opts.ledgerFile = base + ".ledger";
+    opts.metricsFile = base + "_metrics.csv"; // SIGUSR1 to the shard's pid
+    if (!durable) {
+        opts.autoLoad = opts.saveOnExit = opts.journaling = false;
+        opts.ledgerFile.clear();
+    }
+    return opts;
+}
+
+// One shard: answers ShardFrames from the router against its own BankSystem, one thread per
+// connection. A cross-shard transfer leg is held by the bank between prepare and commit/abort (see
+// BankSystem::tryPrepareLeg). Having voted to commit, a shard waits for the router's decision
+// however long it takes: a leg outlives the connection that prepared it and, journaled, a restart.
+class ShardWorker {
+public:
+    ShardWorker(const BankOptions& options, int listenFd)
+        : bank(options), server(listenFd, [this](int fd) { serveConnection(fd); }) {}
+
+    // Serves until the router sends Stop
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        stopped.wait(lock, [this] { return stopping; });
+        lock.unlock();
+        server.stop();
+    }
+
+private:
+    BankSystem bank;
+    mutex mtx; // guards stopping
+    condition_variable stopped;
+    bool stopping = false;
+    SocketServer server; // last: its threads use the members above
+
+    void serveConnection(int fd) {
+        ShardFrame request;
+        string name;
+        while (recvShardFrame(fd, request, name)) {
+            ShardFrame reply = request;
+            reply.nameLength = 0;
+            reply.amount = 0;
+            reply.status = static_cast<uint8_t>(handle(request, name, reply));
+            if (!sendShardFrame(fd, reply)) break;
+        }
+    }
+
+    TxnStatus handle(const ShardFrame& request, const string& name, ShardFrame& reply) {
+        string_view number = shardNumber(request.number, request.numberLength);
+        BalanceChange change;
+        TxnStatus status;
+        switch (static_cast<ShardOp>(request.op)) {
+        case ShardOp::Add: {
+            int64_t parameter = request.parameter;
+            if (!BankSystem::validationError(number, false).empty() || !BankSystem::validationError(name, true).empty()
+                || !resolveAccountParameter(static_cast<AccountKind>(request.kind), parameter))
+                return TxnStatus::InvalidAccount;
+            if (request.amount < 0) return TxnStatus::InvalidAmount;
+            return bank.tryAddAccount(static_cast<AccountKind>(request.kind), number, name, request.amount, parameter);
+        }
+        case ShardOp::Deposit:
+            status = bank.tryDeposit(number, request.amount, &change);
+            break;
+        case ShardOp::Withdraw:
+            status = bank.tryWithdraw(number, request.amount, &change);
+            break;
+        case ShardOp::Delete:
+            return bank.tryDeleteAccount(number);
+        case ShardOp::Balance:
+            return bank.tryGetBalance(number, reply.amount);
+        case ShardOp::Transfer:
+            status = bank.tryTransfer(number, shardNumber(request.target, request.targetLength), request.amount, &change);
+            break;
+        case ShardOp::PrepareOut:
+        case ShardOp::PrepareIn:
+            status = bank.tryPrepareLeg(request.txn, number, request.amount,
+                                        request.op == static_cast<uint8_t>(ShardOp::PrepareOut), &change);
+            break;
+        case ShardOp::Commit:
+        case ShardOp::Abort:
+            status = bank.trySettleLeg(request.txn, request.op == static_cast<uint8_t>(ShardOp::Commit), &change);
+            break;
+        case ShardOp::Pending: {
+            vector<uint64_t> ids = bank.preparedTransfers();
+            auto next = upper_bound(ids.begin(), ids.end(), request.txn);
+            if (next == ids.end()) return TxnStatus::NotFound;
+            reply.txn = *next;
+            return TxnStatus::Ok;
+        }
+        case ShardOp::Stop: {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+            stopped.notify_all();
+            return TxnStatus::Ok;
+        }
+        default:
+            return TxnStatus::InvalidAccount;
+        }
+        reply.amount = change.after;
+        return status;
+    }
+};
+
+// Body of a forked shard process: serves until stopped, saves, and exits without returning
+[[noreturn]] void runShardWorker(const BankOptions& options, int listenFd) {
+    {
+        ShardWorker worker(options, listenFd);
+        worker.run();
+    }
+    cout.flush();
+    _exit(0);
+}
+
+// The router's record of the cross-shard transfers it decided to commit, so that a restarted router
+// can finish them: an id is synced here before either shard is told to commit, and forgotten once
+// both have acknowledged. The file is an array of ids, rewritten without the finished ones once
+// they make up most of it.
+class CommitLog {
+public:
+    explicit CommitLog(const string& path) : path(path) {}
+    CommitLog(const CommitLog&) = delete;
+    CommitLog& operator=(const CommitLog&) = delete;
+    ~CommitLog() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Ids a previous run decided to commit but may not have finished
+    set<uint64_t> load() const {
+        MappedFile file(path);
+        set<uint64_t> ids;
+        for (size_t offset = 0; offset + sizeof(uint64_t) <= file.size(); offset += sizeof(uint64_t)) {
+            uint64_t txn;
+            memcpy(&txn, file.data() + offset, sizeof(txn));
+            ids.insert(txn);
+        }
+        return ids;
+    }
+
+    // Starts an empty log, once load()'s ids are settled
+    bool restart() {
+        lock_guard<mutex> lock(mtx);
+        open.clear();
+        return rewriteLocked();
+    }
+
+    // Logs the decision to commit txn; false if it could not be made durable
+    bool record(uint64_t txn) {
+        lock_guard<mutex> lock(mtx);
+        if (fd < 0 || !writeAllAt(fd, reinterpret_cast<const char*>(&txn), sizeof(txn), static_cast<off_t>(logged * sizeof(txn))) || fdatasync(fd) != 0) return false;
+        logged++;
+        open.insert(txn);
+        return true;
+    }
+
+    // Both shards have acknowledged txn's commit
+    void finish(uint64_t txn) {
+        lock_guard<mutex> lock(mtx);
+        open.erase(txn);
+        if (logged >= COMPACT_IDS && open.size() * 2 < logged) rewriteLocked();
+    }
+
+private:
+    static const size_t COMPACT_IDS = 4096;
+
+    string path;
+    mutex mtx; // guards everything below
+    int fd = -1;
+    size_t logged = 0;              // ids in the file
+    unordered_set<uint64_t> open;   // logged and not yet finished
+
+    bool rewriteLocked() {
+        vector<uint64_t> ids(open.begin(), open.end());
+        string tempPath = path + ".tmp";
+        int next = ::open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool written = next >= 0 && writeAllAt(next, reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint64_t), 0) && fdatasync(next) == 0;
+        if (!written || !renameDurably(tempPath, path)) {
+            if (next >= 0) ::close(next);
+            ::unlink(tempPath.c_str());
+            return false;
+        }
+        if (fd >= 0) ::close(fd);
+        fd = next;
+        logged = ids.size();
+        return true;
+    }
+};
+
+// Starts one worker process per shard (forked before the router has any threads, each listening
+// on dir/shard<i>.sock), then accepts clients on dir/bank.sock with a thread per client. Each
+// client thread keeps its own connection to every shard, so clients never queue behind each other
+// in the router. A transfer between shards is a two-phase commit run by the client's thread:
+// PrepareOut takes the money on the source shard while PrepareIn checks the target on its shard
+// (both are sent before either reply is read). If both succeed, the transfer is committed from the
+// moment its id is in the CommitLog (durable routers only): the target and then the source are
+// told to commit, each until it acknowledges. Otherwise every leg that may have been prepared,
+// including one whose reply was lost, is aborted the same way, which refunds the source. A
+// durable router starting up commits the legs its log names and aborts the rest.
+class ShardRouter {
+public:
+    // durable: shards load and save their files under dir; otherwise they start empty in memory
+    ShardRouter(size_t shardCount, const string& dir, bool durable) : path(dir + "/bank.sock") {
+        cout.flush(); // or the children would flush the parent's pending output again
+        for (size_t i = 0; i < shardCount; i++) {
+            string socketPath = dir + "/shard" + to_string(i) + ".sock";
+            int listenFd = listenUnix(socketPath);
+            if (listenFd < 0) return;
+            pid_t parent = getpid(), pid = fork();
+            if (pid == 0) {
+                prctl(PR_SET_PDEATHSIG, SIGKILL); // no orphaned shards if the router dies
+                if (getppid() != parent) _exit(1);
+                for (const Shard& shard : shards) ::close(shard.controlFd);
+                runShardWorker(shardOptions(dir, i, durable), listenFd);
+            }
+            ::close(listenFd);
+            if (pid < 0) return;
+            shards.push_back({ pid, socketPath, connectUnix(socketPath) });
+            if (shards.back().controlFd < 0) return;
+        }
+        if (durable) {
+            commits = make_unique<CommitLog>(dir + "/router.commits");
+            if (!recover()) return;
+        }
+        int listenFd = listenUnix(path);
+        if (listenFd < 0) return;
+        server = make_unique<SocketServer>(listenFd, [this](int fd) { serveClient(fd); });
+    }
+    ShardRouter(const ShardRouter&) = delete;
+    ShardRouter& operator=(const ShardRouter&) = delete;
+    ~ShardRouter() { stop(); }
+
+    bool ok() const { return server != nullptr; }
+    const string& socketPath() const { return path; }
+
+    // Disconnects every client, then stops each shard (which saves if durable) and reaps it. A
+    // decision not yet acknowledged by a shard is left to the next start.
+    void stop() {
+        stopping = true;
+        if (server) {
+            server->stop();
+            server.reset();
+            ::unlink(path.c_str());
+        }
+        for (Shard& shard : shards) {
+            ShardFrame frame = {};
+            frame.op = static_cast<uint8_t>(ShardOp::Stop);
+            string name;
+            if (shard.controlFd >= 0 && sendShardFrame(shard.controlFd, frame)) recvShardFrame(shard.controlFd, frame, name);
+            if (shard.controlFd >= 0) ::close(shard.controlFd);
+            if (shard.controlFd < 0) ::kill(shard.pid, SIGKILL);
+            waitpid(shard.pid, nullptr, 0);
+            ::unlink(shard.socketPath.c_str());
+        }
+        shards.clear();
+    }
+
+private:
+    struct Shard {
+        pid_t pid;
+        string socketPath;
+        int controlFd; // carries Stop
+    };
+
+    string path;
+    vector<Shard> shards;
+    atomic<uint64_t> nextTxn{ 1 };
+    unique_ptr<CommitLog> commits; // durable routers only
+    atomic<bool> stopping{ false };
+    unique_ptr<SocketServer> server;
+
+    // Settles the legs a previous run left prepared, over the control connections: a leg whose
+    // transfer is in the commit log is committed; any other was never committed anywhere (the log
+    // is written first) and is aborted
+    bool recover() {
+        set<uint64_t> decided = commits->load();
+        size_t committed = 0, aborted = 0;
+        for (const Shard& shard : shards) {
+            ShardFrame query = {}, reply;
+            query.op = static_cast<uint8_t>(ShardOp::Pending);
+            string name;
+            while (true) {
+                if (!sendShardFrame(shard.controlFd, query) || !recvShardFrame(shard.controlFd, reply, name)) return false;
+                if (reply.status != static_cast<uint8_t>(TxnStatus::Ok)) break;
+                bool commit = decided.count(reply.txn) > 0;
+                ShardFrame decision = {};
+                decision.op = static_cast<uint8_t>(commit ? ShardOp::Commit : ShardOp::Abort);
+                decision.txn = query.txn = reply.txn;
+                if (!sendShardFrame(shard.controlFd, decision) || !recvShardFrame(shard.controlFd, decision, name)) return false;
+                (commit ? committed : aborted)++;
+            }
+        }
+        if (committed + aborted > 0)
+            cout << "Transfers left in doubt: " << committed << " legs committed, " << aborted << " aborted." << endl;
+        return commits->restart();
+    }
+
+    void serveClient(int fd) {
+        vector<int> links(shards.size(), -1); // this client's connection to each shard
+        ShardFrame request;
+        string name;
+        while (recvShardFrame(fd, request, name)) {
+            if (request.op < static_cast<uint8_t>(ShardOp::Add) || request.op > static_cast<uint8_t>(ShardOp::Transfer)) break;
+            ShardFrame reply = request;
+            reply.nameLength = 0;
+            reply.amount = 0;
+            reply.status = static_cast<uint8_t>(route(links, request, name, reply));
+            if (!sendShardFrame(fd, reply)) break;
+        }
+        for (int link : links)
+            if (link >= 0) ::close(link);
+    }
+
+    TxnStatus route(vector<int>& links, const ShardFrame& request, const string& name, ShardFrame& reply) {
+        uint64_t key, targetKey;
+        if (!AccountNumber::pack(shardNumber(request.number, request.numberLength), key)) return TxnStatus::InvalidAccount;
+        if (request.op != static_cast<uint8_t>(ShardOp::Transfer)) return exchange(links, shardOf(key, shards.size()), request, name, reply);
+
+        if (!AccountNumber::pack(shardNumber(request.target, request.targetLength), targetKey)) return TxnStatus::NotFound;
+        size_t from = shardOf(key, shards.size()), to = shardOf(targetKey, shards.size());
+        if (from == to) return exchange(links, from, request, name, reply);
+        if (request.amount <= 0) return TxnStatus::InvalidAmount;
+
+        ShardFrame out = request, in = request, outReply, inReply;
+        out.op = static_cast<uint8_t>(ShardOp::PrepareOut);
+        in.op = static_cast<uint8_t>(ShardOp::PrepareIn);
+        out.txn = in.txn = nextTxn.fetch_add(1, memory_order_relaxed);
+        memcpy(in.number, request.target, sizeof(in.number));
+        in.numberLength = request.targetLength;
+
+        bool outSent = send(links, from, out), inSent = send(links, to, in);
+        TxnStatus outStatus = outSent ? receive(links, from, outReply) : TxnStatus::IoError;
+        TxnStatus inStatus = inSent ? receive(links, to, inReply) : TxnStatus::IoError;
+
+        bool commit = outStatus == TxnStatus::Ok && inStatus == TxnStatus::Ok && (!commits || commits->record(out.txn));
+        ShardFrame decision = out;
+        decision.op = static_cast<uint8_t>(commit ? ShardOp::Commit : ShardOp::Abort);
+        bool settled = true;
+        if (inStatus == TxnStatus::Ok || (inSent && inStatus == TxnStatus::IoError)) settled = settle(links, to, decision);
+        if (outStatus == TxnStatus::Ok || (outSent && outStatus == TxnStatus::IoError))
+            settled = settle(links, from, decision) && settled;
+        if (commit && commits && settled) commits->finish(out.txn);
+        if (commit) {
+            reply.amount = outReply.amount;
+            return TxnStatus::Ok;
+        }
+        return outStatus != TxnStatus::Ok ? outStatus : inStatus != TxnStatus::Ok ? inStatus : TxnStatus::IoError;
+    }
+
+    // Delivers a decision until the shard answers it (NotFound: already settled, or never prepared),
+    // reconnecting with backoff; false only if the router stopped first
+    bool settle(vector<int>& links, size_t shard, const ShardFrame& decision) {
+        chrono::milliseconds backoff{ 1 };
+        ShardFrame ack;
+        while (exchange(links, shard, decision, {}, ack) == TxnStatus::IoError) {
+            if (stopping) return false;
+            this_thread::sleep_for(backoff);
+            backoff = min(backoff * 2, chrono::milliseconds{ 1000 });
+        }
+        return true;
+    }
+
+    // Sends on this client's link to shard, connecting first if need be; a broken link is dropped
+    bool send(vector<int>& links, size_t shard, const ShardFrame& frame, string_view name = {}) {
+        if (links[shard] < 0) links[shard] = connectUnix(shards[shard].socketPath);
+        if (links[shard] >= 0 && sendShardFrame(links[shard], frame, name)) return true;
+        drop(links, shard);
+        return false;
+    }
+
+    TxnStatus receive(vector<int>& links, size_t shard, ShardFrame& reply) {
+        string name;
+        if (recvShardFrame(links[shard], reply, name)) return static_cast<TxnStatus>(reply.status);
+        drop(links, shard);
+        return TxnStatus::IoError;
+    }
+
+    TxnStatus exchange(vector<int>& links, size_t shard, const ShardFrame& request, string_view name, ShardFrame& reply) {
+        return send(links, shard, request, name) ? receive(links, shard, reply) : TxnStatus::IoError;
+    }
 
-        // Basic validation
-        if (accNum.empty() || accNum.length() < 3) {
-            cout << "Error: Account number must be at least 3 characters long." << endl;
-            if (!askForRetry("account number input")) {
-                return "";
+    static void drop(vector<int>& links, size_t shard) {
+        if (links[shard] >= 0) ::close(links[shard]);
+        links[shard] = -1;
+    }
+};
+
+// A connection to a ShardRouter; one request at a time. Calls return IoError once the router is gone.
+class ShardClient {
+public:
+    explicit ShardClient(const string& socketPath) : fd(connectUnix(socketPath)) {}
+    ShardClient(const ShardClient&) = delete;
+    ShardClient& operator=(const ShardClient&) = delete;
+    ~ShardClient() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool connected() const { return fd >= 0; }
+
+    TxnStatus addAccount(AccountKind kind, string_view number, string_view name, Cents balance, int64_t parameter) {
+        if (name.size() > MAX_SHARD_NAME) return TxnStatus::InvalidAccount;
+        ShardFrame frame = {};
+        frame.kind = static_cast<uint8_t>(kind);
+        frame.nameLength = static_cast<uint32_t>(name.size());
+        frame.parameter = parameter;
+        return call(ShardOp::Add, frame, number, balance, nullptr, name);
+    }
+
+    TxnStatus deposit(string_view number, Cents amount, Cents* balance = nullptr) {
+        ShardFrame frame = {};
+        return call(ShardOp::Deposit, frame, number, amount, balance);
+    }
+
+    TxnStatus withdraw(string_view number, Cents amount, Cents* balance = nullptr) {
+        ShardFrame frame = {};
+        return call(ShardOp::Withdraw, frame, number, amount, balance);
+    }
+
+    TxnStatus deleteAccount(string_view number) {
+        ShardFrame frame = {};
+        return call(ShardOp::Delete, frame, number, 0, nullptr);
+    }
+
+    TxnStatus getBalance(string_view number, Cents& balance) {
+        ShardFrame frame = {};
+        return call(ShardOp::Balance, frame, number, 0, &balance);
+    }
+
+    // `balance` receives the source account's balance after the transfer
+    TxnStatus transfer(string_view from, string_view to, Cents amount, Cents* balance = nullptr) {
+        ShardFrame frame = {};
+        if (!putShardNumber(frame.target, frame.targetLength, to)) return TxnStatus::NotFound;
+        return call(ShardOp::Transfer, frame, from, amount, balance);
+    }
+
+private:
+    int fd;
+
+    TxnStatus call(ShardOp op, ShardFrame& frame, string_view number, Cents amount, Cents* balance, string_view name = {}) {
+        if (!putShardNumber(frame.number, frame.numberLength, number)) return TxnStatus::InvalidAccount;
+        frame.op = static_cast<uint8_t>(op);
+        frame.amount = amount;
+        string ignored;
+        if (fd < 0 || !sendShardFrame(fd, frame, name) || !recvShardFrame(fd, frame, ignored)) return TxnStatus::IoError;
+        TxnStatus status = static_cast<TxnStatus>(frame.status);
+        if (balance && status == TxnStatus::Ok) *balance = frame.amount;
+        return status;
+    }
+};
+
+// --shards: serves the router and its shards (files under dir) until SIGINT or SIGTERM
+int runShardRouter(size_t shardCount, const string& dir) {
+    // Blocked before forking, so a Ctrl-C reaches only this loop and the shards are stopped cleanly
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    ShardRouter router(shardCount, dir, true);
+    if (!router.ok()) {
+        cout << "Error: Could not start " << shardCount << " shards under " << dir << "." << endl;
+        return 1;
+    }
+    cout << "Serving " << shardCount << " shards on " << router.socketPath() << " (Ctrl-C to stop)." << endl;
+    int signal;
+    sigwait(&signals, &signal);
+    router.stop();
+    cout << "Shards stopped." << endl;
+    return 0;
+}
+
+// Request protocol of --serve. Every message is a uint32 length (of the bytes after it) and a body,
+// both in native byte order:
+//   request:  u32 id, u8 WireOp, u8 numberLength, account number digits, then
+//             Add: u8 AccountKind, i64 balance, i64 parameter (rate/overdraft), name (the rest)
+//             Deposit/Withdraw: i64 amount
+//   response: u32 id (echoed), u8 TxnStatus, then
+//             Search (Ok): i64 balance
+//             Deposit/Withdraw (Ok or InsufficientFunds): i64 balance, i64 available balance
+//             Info (Ok): u8 AccountKind, i64 balance, i64 parameter, name (the rest)
+// Responses come back in request order, so a client may pipeline as many requests as it likes.
+enum class WireOp : uint8_t { Add = 1, Search, Deposit, Withdraw, Delete, Info };
+
+const uint32_t MAX_WIRE_MESSAGE = 1 << 16; // a longer length prefix closes the connection
+
+// Appends fields to a message; finish() fills in the length prefix
+class WireWriter {
+public:
+    explicit WireWriter(string& buffer) : out(buffer), start(buffer.size()) { out.append(sizeof(uint32_t), '\0'); }
+
+    template <typename T>
+    WireWriter& put(T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        return *this;
+    }
+    WireWriter& putBytes(string_view bytes) {
+        out.append(bytes.data(), bytes.size());
+        return *this;
+    }
+    void finish() {
+        uint32_t length = static_cast<uint32_t>(out.size() - start - sizeof(uint32_t));
+        memcpy(&out[start], &length, sizeof(length));
+    }
+
+private:
+    string& out;
+    size_t start;
+};
+
+// Reads fields from a message body; every get fails once the body runs out
+class WireReader {
+public:
+    explicit WireReader(string_view body) : rest(body) {}
+
+    template <typename T>
+    bool get(T& value) {
+        if (rest.size() < sizeof(value)) return false;
+        memcpy(&value, rest.data(), sizeof(value));
+        rest.remove_prefix(sizeof(value));
+        return true;
+    }
+    bool getBytes(size_t n, string_view& bytes) {
+        if (rest.size() < n) return false;
+        bytes = rest.substr(0, n);
+        rest.remove_prefix(n);
+        return true;
+    }
+    string_view remaining() const { return rest; }
+
+private:
+    string_view rest;
+};
+
+// "host:port" is TCP; anything else (a path with a '/', or without a numeric port) is a
+// Unix-domain socket path
+inline bool isTcpAddress(const string& address) {
+    size_t colon = address.rfind(':');
+    return colon != string::npos && colon + 1 < address.size() && address.find('/') == string::npos
+        && all_of(address.begin() + colon + 1, address.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+}
+
+// The server has no authentication, so a TCP address must name a loopback host ("localhost" or
+// 127.x.x.x) and a port from 1 to 65535
+inline bool parseTcpAddress(const string& address, sockaddr_in& inet) {
+    if (!isTcpAddress(address)) return false;
+    size_t colon = address.rfind(':');
+    string host = address.substr(0, colon);
+    const char* last = address.data() + address.size();
+    unsigned port = 0;
+    auto parsed = from_chars(address.data() + colon + 1, last, port);
+    if (parsed.ec != errc() || parsed.ptr != last || port == 0 || port > 65535) return false;
+    memset(&inet, 0, sizeof(inet));
+    inet.sin_family = AF_INET;
+    inet.sin_port = htons(static_cast<uint16_t>(port));
+    return inet_pton(AF_INET, host == "localhost" ? "127.0.0.1" : host.c_str(), &inet.sin_addr) == 1
+        && ntohl(inet.sin_addr.s_addr) >> 24 == 127;
+}
+
+// A listening socket for a --serve address, or -1
+inline int listenAddress(const string& address) {
+    sockaddr_in inet;
+    if (!isTcpAddress(address)) return listenUnix(address);
+    if (!parseTcpAddress(address, inet)) return -1;
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&inet), sizeof(inet)) < 0 || ::listen(fd, 1024) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+inline int connectAddress(const string& address) {
+    sockaddr_in inet;
+    if (!isTcpAddress(address)) return connectUnix(address);
+    if (!parseTcpAddress(address, inet)) return -1;
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&inet), sizeof(inet)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+// Event-driven request server: one thread runs an epoll loop over the listening socket and every
+// client connection (all non-blocking). Each readable connection has all of its complete messages
+// answered in order into its output buffer. The bank runs with durableAcks off, so after each
+// round of events one syncJournal call makes every change answered in that round durable. Only
+// then are the answers sent, so a whole round of pipelined requests shares one fsync. A client
+// that stops reading has its input paused once MAX_UNSENT bytes of answers are waiting.
+class BankServer {
+public:
+    // Takes ownership of listenFd
+    BankServer(BankSystem& bankSystem, int listenFd) : bank(bankSystem), listenFd(listenFd) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+    BankServer(const BankServer&) = delete;
+    BankServer& operator=(const BankServer&) = delete;
+    ~BankServer() {
+        for (auto& entry : connections) ::close(entry.first);
+        ::close(listenFd);
+        ::close(wakeFd);
+        ::close(epollFd);
+    }
+
+    bool ok() const { return epollFd >= 0 && wakeFd >= 0; }
+
+    // Serves until stop(); answers already computed are sent first
+    void run() {
+        epoll_event events[64];
+        while (!stopping.load()) {
+            int n = epoll_wait(epollFd, events, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
             }
-            continue;
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) acceptAll();
+                else if (fd == wakeFd) {
+                    uint64_t count;
+                    ssize_t ignored = ::read(wakeFd, &count, sizeof(count));
+                    (void)ignored;
+                }
+                else service(fd, events[i].events);
+            }
+            if (answered.empty()) continue;
+            // One fsync acknowledges every change answered this round. If it fails, those answers
+            // are dropped with their connections, so no client hears Ok for a change that may be
+            // lost; the bank refuses every change after that, so later answers need no sync.
+            bool unconfirmed = !journalFailed && !bank.syncJournal();
+            journalFailed = journalFailed || unconfirmed;
+            for (int fd : answered) {
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                Connection& connection = *it->second;
+                connection.synced = connection.out.size();
+                connection.queued = false;
+                if (unconfirmed || !flush(connection)) close(fd);
+            }
+            answered.clear();
         }
+    }
 
-        // Check if contains only digits
-        bool validFormat = all_of(accNum.begin(), accNum.end(), [](char c) { return isdigit(c); });
-        if (!validFormat) {
-            cout << "Error: Account number can only contain numbers." << endl;
-            if (!askForRetry("account number input")) {
-                return "";
+    // May be called from any thread
+    void stop() {
+        stopping.store(true);
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+private:
+    static const size_t MAX_UNSENT = 1 << 20;
+
+    struct Connection {
+        explicit Connection(int socket) : fd(socket) {}
+        int fd;
+        string in;             // bytes received, from `consumed` on not yet answered
+        size_t consumed = 0;
+        string out;            // answers; [sent, synced) may be sent, the rest waits for the journal sync
+        size_t sent = 0, synced = 0;
+        uint32_t events = EPOLLIN;
+        bool queued = false;   // in `answered`
+        bool closing = false;  // the client has shut down its side: close once everything is sent
+    };
+
+    BankSystem& bank;
+    int listenFd, epollFd = -1, wakeFd = -1;
+    atomic<bool> stopping{ false };
+    unordered_map<int, unique_ptr<Connection>> connections;
+    vector<int> answered; // connections given answers this round
+    bool journalFailed = false;
+
+    void watch(int fd, uint32_t events, int op) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, op, fd, &event);
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return; // EAGAIN: none left (or out of descriptors: retried on the next event)
             }
-            continue;
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // fails harmlessly on Unix sockets
+            connections[fd].reset(new Connection(fd));
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
         }
+    }
 
-        // Check existence
-        Account* existingAcc = bankSystem.searchByAccountNumber(accNum);
-        if (shouldExist && !existingAcc) {
-            cout << "Error: Account number " << accNum << " not found." << endl;
-            if (!askForRetry("account number input")) {
-                return "";
+    void close(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+    }
+
+    void service(int fd, uint32_t events) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) return;
+        Connection& connection = *it->second;
+        if ((events & EPOLLOUT) && !flush(connection)) return close(fd);
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            if (!receive(connection)) return close(fd);
+            if (connection.out.size() > connection.synced && !connection.queued) {
+                connection.queued = true;
+                answered.push_back(fd);
             }
-            continue;
+            if (connection.closing && !connection.queued && connection.sent == connection.out.size()) return close(fd);
+            if (connection.closing) updateEvents(connection); // EOF stays readable: stop polling for it
         }
+    }
 
-        if (!shouldExist && existingAcc) {
-            cout << "Error: Account number " << accNum << " already exists." << endl;
-            if (!askForRetry("account number input")) {
-                return "";
+    // Reads what has arrived and answers every complete message; false if the connection is broken
+    bool receive(Connection& connection) {
+        char buffer[64 * 1024];
+        while (!connection.closing) {
+            ssize_t got = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (got > 0) {
+                connection.in.append(buffer, static_cast<size_t>(got));
+                if (connection.in.size() - connection.consumed >= MAX_UNSENT) break; // answer before reading more
+                continue;
             }
-            continue;
+            if (got == 0) connection.closing = true;
+            else if (errno == EINTR) continue;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            break;
         }
 
-        return accNum;
+        while (connection.in.size() - connection.consumed >= sizeof(uint32_t)) {
+            uint32_t length;
+            memcpy(&length, connection.in.data() + connection.consumed, sizeof(length));
+            if (length > MAX_WIRE_MESSAGE) return false;
+            if (connection.in.size() - connection.consumed - sizeof(length) < length) break;
+            answer(string_view(connection.in).substr(connection.consumed + sizeof(length), length), connection.out);
+            connection.consumed += sizeof(length) + length;
+        }
+        connection.in.erase(0, connection.consumed);
+        connection.consumed = 0;
+        return true;
+    }
+
+    // Sends the answers the journal has caught up with, then listens for what the buffers allow
+    bool flush(Connection& connection) {
+        while (connection.sent < connection.synced) {
+            ssize_t sent = ::send(connection.fd, connection.out.data() + connection.sent, connection.synced - connection.sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            connection.sent += static_cast<size_t>(sent);
+        }
+        if (connection.sent == connection.out.size()) {
+            connection.out.clear();
+            connection.sent = connection.synced = 0;
+            if (connection.closing) return false;
+        }
+        updateEvents(connection);
+        return true;
+    }
+
+    // Input is watched while the client may still send and its unsent answers fit in MAX_UNSENT;
+    // output while answers are ready to go
+    void updateEvents(Connection& connection) {
+        size_t unsent = connection.out.size() - connection.sent;
+        bool reading = !connection.closing && unsent < MAX_UNSENT;
+        uint32_t events = (reading ? uint32_t(EPOLLIN) : 0) | (connection.sent < connection.synced ? uint32_t(EPOLLOUT) : 0);
+        if (events != connection.events) {
+            connection.events = events;
+            watch(connection.fd, events, EPOLL_CTL_MOD);
+        }
+    }
+
+    // Answers one request message into out; malformed requests get InvalidAccount, and amounts, rates
+    // and limits past what parseMoney or parseRate accept get InvalidAmount
+    void answer(string_view body, string& out) {
+        WireReader request(body);
+        uint32_t id = 0;
+        uint8_t op = 0, numberLength = 0;
+        string_view number;
+        request.get(id);
+        WireWriter response(out);
+        response.put(id);
+        if (!request.get(op) || !request.get(numberLength) || !request.getBytes(numberLength, number)) {
+            response.put(static_cast<uint8_t>(TxnStatus::InvalidAccount)).finish();
+            return;
+        }
+
+        TxnStatus status = TxnStatus::InvalidAccount;
+        BalanceChange change;
+        switch (static_cast<WireOp>(op)) {
+        case WireOp::Add: {
+            uint8_t kind;
+            Cents balance;
+            int64_t parameter;
+            if (!request.get(kind) || !request.get(balance) || !request.get(parameter)) break;
+            string_view name = request.remaining();
+            if (!BankSystem::validationError(number, false).empty() || !BankSystem::validationError(name, true).empty()
+                || !resolveAccountParameter(static_cast<AccountKind>(kind), parameter))
+                break;
+            bool inRange = moneyInRange(balance)
+                && (kind == static_cast<uint8_t>(AccountKind::Savings) ? rateInRange(parameter) : moneyInRange(parameter));
+            status = balance < 0 || !inRange ? TxnStatus::InvalidAmount
+                                             : bank.tryAddAccount(static_cast<AccountKind>(kind), number, name, balance, parameter);
+            break;
+        }
+        case WireOp::Search: {
+            Cents balance = 0;
+            status = bank.tryGetBalance(number, balance);
+            response.put(static_cast<uint8_t>(status));
+            if (status == TxnStatus::Ok) response.put(balance);
+            response.finish();
+            return;
+        }
+        case WireOp::Deposit:
+        case WireOp::Withdraw: {
+            Cents amount;
+            if (!request.get(amount)) break;
+            if (!moneyInRange(amount)) {
+                response.put(static_cast<uint8_t>(TxnStatus::InvalidAmount)).finish();
+                return;
+            }
+            status = op == static_cast<uint8_t>(WireOp::Deposit) ? bank.tryDeposit(number, amount, &change)
+                                                                  : bank.tryWithdraw(number, amount, &change);
+            response.put(static_cast<uint8_t>(status));
+            if (status == TxnStatus::Ok || status == TxnStatus::InsufficientFunds) response.put(change.after).put(change.available);
+            response.finish();
+            return;
+        }
+        case WireOp::Delete:
+            status = bank.tryDeleteAccount(number);
+            break;
+        case WireOp::Info:
+            status = bank.withAccount(number, [&](const AccountView& acc) {
+                response.put(static_cast<uint8_t>(TxnStatus::Ok)).put(static_cast<uint8_t>(acc.getKind())).put(acc.getBalance());
+                response.put<int64_t>(acc.getKind() == AccountKind::Savings ? acc.getInterestRate() : acc.getOverdraftLimit());
+                response.putBytes(acc.getCustomerName());
+            });
+            if (status == TxnStatus::Ok) {
+                response.finish();
+                return;
+            }
+            break;
+        }
+        response.put(static_cast<uint8_t>(status)).finish();
+    }
+};
+
+// --serve: the bank's files behind a BankServer at address until SIGINT or SIGTERM
+int runServer(const string& address) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr); // before any thread starts, so only sigwait sees them
+
+    sockaddr_in inet;
+    if (isTcpAddress(address) && !parseTcpAddress(address, inet)) {
+        cout << "Error: " << address << " is not a loopback address; use localhost or 127.x.x.x and a port from 1 to 65535." << endl;
+        return 1;
+    }
+    BankOptions opts;
+    opts.durableAcks = false; // the server waits for the journal once per round instead
+    BankSystem bankSystem(opts);
+    int listenFd = listenAddress(address);
+    if (listenFd < 0) {
+        cout << "Error: Could not listen on " << address << "." << endl;
+        return 1;
     }
+    BankServer server(bankSystem, listenFd);
+    if (!server.ok()) {
+        cout << "Error: Could not start the server." << endl;
+        return 1;
+    }
+    thread loop(&BankServer::run, &server);
+    cout << "Serving on " << address << " (Ctrl-C to stop)." << endl;
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+    loop.join();
+    if (!isTcpAddress(address)) ::unlink(address.c_str());
+    cout << "Server stopped." << endl;
+    return 0;
 }
 
-// amount input with validation
-double getAmount() {
-    double amount;
-    while (true) {
-        cout << "Enter amount: $";
-        if (!(cin >> amount)) {
-            cout << "Error: Invalid input. Please enter a valid number." << endl;
-            clearInputBuffer();
-            if (!askForRetry("amount input")) {
-                return -1;
+// The sample at fraction p of the sorted samples (0.5 is the median), or 0 if there are none
+template <typename T>
+T percentile(const vector<T>& sorted, double p) {
+    return sorted.empty() ? 0 : sorted[min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+// The p50, p99 and p99.9 of sorted nanosecond latencies as three CSV fields, in microseconds
+void printLatencyPercentiles(const vector<uint32_t>& sorted) {
+    cout << percentile(sorted, 0.5) / 1000.0 << "," << percentile(sorted, 0.99) / 1000.0 << ","
+         << percentile(sorted, 0.999) / 1000.0;
+}
+
+// --loadgen: `connections` threads, each with its own connection keeping `depth` requests in
+// flight. Accounts are created first (existing ones are kept); then each connection sends
+// opsPerConnection requests (40% deposits, 40% withdrawals, 15% searches, 5% info) on random
+// accounts and every response's round trip is timed. Reports throughput and latency percentiles.
+int runLoadGenerator(const string& address, size_t connections, size_t depth, size_t opsPerConnection, size_t accounts) {
+    vector<string> numbers(accounts);
+    for (size_t i = 0; i < accounts; i++) numbers[i] = to_string(700000000 + i);
+
+    struct Result {
+        vector<uint32_t> latencies; // ns
+        size_t failed = 0;          // neither Ok nor an expected business outcome
+        bool connected = true;
+    };
+    vector<Result> results(connections);
+
+    // Keeps `depth` of total requests in flight on one connection; request(i, out) writes the i-th
+    auto drive = [&](Result& result, size_t total, const function<void(size_t, string&)>& request, bool timed) {
+        int fd = connectAddress(address);
+        if (fd < 0) {
+            result.connected = false;
+            return;
+        }
+        vector<chrono::steady_clock::time_point> sentAt(depth);
+        string out, in;
+        size_t next = 0, done = 0;
+        auto sendUpTo = [&](size_t limit) {
+            out.clear();
+            for (; next < limit && next < total; next++) {
+                sentAt[next % depth] = chrono::steady_clock::now();
+                request(next, out);
             }
-            continue;
+            return out.empty() || sendAll(fd, out.data(), out.size());
+        };
+        char buffer[64 * 1024];
+        bool ok = sendUpTo(depth);
+        while (ok && done < total) {
+            ssize_t got = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) break;
+            in.append(buffer, static_cast<size_t>(got));
+            size_t offset = 0;
+            uint32_t length;
+            while (in.size() - offset >= sizeof(length)) {
+                memcpy(&length, in.data() + offset, sizeof(length));
+                if (in.size() - offset - sizeof(length) < length) break;
+                uint32_t id = 0;
+                uint8_t status = 0;
+                WireReader response(string_view(in).substr(offset + sizeof(length), length));
+                response.get(id);
+                response.get(status);
+                if (timed) {
+                    result.latencies.push_back(static_cast<uint32_t>(
+                        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - sentAt[id % depth]).count()));
+                }
+                TxnStatus outcome = static_cast<TxnStatus>(status);
+                if (outcome != TxnStatus::Ok && outcome != TxnStatus::InsufficientFunds && outcome != TxnStatus::Duplicate)
+                    result.failed++;
+                offset += sizeof(length) + length;
+                done++;
+            }
+            in.erase(0, offset);
+            ok = sendUpTo(done + depth);
         }
+        if (done < total) result.connected = false;
+        ::close(fd);
+    };
 
-        if (amount <= 0) {
-            cout << "Error: Amount must be positive." << endl;
-            clearInputBuffer(); // Clear the input buffer after detecting negative amount
-            if (!askForRetry("amount input")) {
-                return -1;
+    auto runAll = [&](const function<void(size_t)>& body) {
+        vector<thread> threads;
+        for (size_t c = 0; c < connections; c++) threads.emplace_back(body, c);
+        for (thread& t : threads) t.join();
+    };
+
+    runAll([&](size_t c) {
+        size_t first = accounts * c / connections, last = accounts * (c + 1) / connections;
+        drive(results[c], last - first, [&](size_t i, string& out) {
+            const string& number = numbers[first + i];
+            WireWriter message(out);
+            message.put(static_cast<uint32_t>(i)).put(static_cast<uint8_t>(WireOp::Add)).put(static_cast<uint8_t>(number.size()));
+            message.putBytes(number).put(static_cast<uint8_t>(AccountKind::Checking)).put<Cents>(100000).put<int64_t>(50000);
+            message.putBytes("Load Customer").finish();
+        }, false);
+    });
+
+    auto start = chrono::steady_clock::now();
+    runAll([&](size_t c) {
+        mt19937_64 rng(c + 1);
+        drive(results[c], opsPerConnection, [&](size_t i, string& out) {
+            const string& number = numbers[rng() % accounts];
+            unsigned pick = rng() % 20;
+            WireOp op = pick < 8 ? WireOp::Deposit : pick < 16 ? WireOp::Withdraw : pick < 19 ? WireOp::Search : WireOp::Info;
+            WireWriter message(out);
+            message.put(static_cast<uint32_t>(i)).put(static_cast<uint8_t>(op)).put(static_cast<uint8_t>(number.size())).putBytes(number);
+            if (op == WireOp::Deposit || op == WireOp::Withdraw) message.put<Cents>(100);
+            message.finish();
+        }, true);
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<uint32_t> all;
+    size_t failed = 0;
+    for (const Result& result : results) {
+        if (!result.connected) {
+            cout << "Error: Lost the connection to " << address << "." << endl;
+            return 1;
+        }
+        all.insert(all.end(), result.latencies.begin(), result.latencies.end());
+        failed += result.failed;
+    }
+    sort(all.begin(), all.end());
+    size_t ops = all.size();
+    if (ops == 0) return 1;
+    cout << "connections,depth,ops,seconds,ops_per_sec,p50_us,p99_us,p999_us,max_us,errors\n"
+         << connections << "," << depth << "," << ops << "," << seconds << "," << static_cast<uint64_t>(ops / seconds) << ",";
+    printLatencyPercentiles(all);
+    cout << "," << all.back() / 1000.0 << "," << failed << endl;
+    return failed ? 1 : 0;
+}
+
+// Benchmark builds can count every heap allocation in the program to report allocations per
+// operation: build with -DBANK_COUNT_ALLOCATIONS=1. Other builds keep the standard operator new
+// and the benchmarks leave the allocation columns empty.
+#ifndef BANK_COUNT_ALLOCATIONS
+#define BANK_COUNT_ALLOCATIONS 0
+#endif
+
+#if BANK_COUNT_ALLOCATIONS
+atomic<uint64_t> heapAllocations{0};
+
+// new and delete are kept out of line: once inlined, GCC's -Wmismatched-new-delete sees malloc()
+// or free() meet a new-expression
+__attribute__((noinline)) void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+inline uint64_t heapAllocationCount() { return heapAllocations.load(memory_order_relaxed); }
+#else
+inline uint64_t heapAllocationCount() { return 0; }
+#endif
+
+// BankOptions for a throwaway in-memory bank (benchmarks): no files read or written
+BankOptions inMemoryOptions() {
+    BankOptions opts;
+    opts.autoLoad = false;
+    opts.saveOnExit = false;
+    opts.journaling = false;
+    opts.metricsFile.clear();
+    opts.ledgerFile.clear();
+    return opts;
+}
+
+// Account numbers for a benchmark bank: `count` consecutive numbers from `first`
+vector<string> benchNumbers(size_t count, uint64_t first = 100000000) {
+    vector<string> numbers(count);
+    for (size_t i = 0; i < count; i++) numbers[i] = to_string(first + i);
+    return numbers;
+}
+
+// The mixed benchmark bank: savings, checking and basic accounts in turn
+AccountKind mixedBenchKind(size_t i) {
+    return i % 3 == 0 ? AccountKind::Savings : i % 3 == 1 ? AccountKind::Checking : AccountKind::Basic;
+}
+
+// The default interest rate or overdraft limit for a benchmark account (none for basic)
+int64_t benchParameter(AccountKind kind) {
+    return kind == AccountKind::Savings ? DEFAULT_INTEREST_RATE : kind == AccountKind::Checking ? DEFAULT_OVERDRAFT_LIMIT : 0;
+}
+
+// Opens a "Bench Customer" account for each number with `opening` cents, of type kindOf(i) (all
+// checking if null) and its benchParameter
+void fillBenchBank(BankSystem& bank, const vector<string>& numbers, AccountKind (*kindOf)(size_t) = nullptr,
+                   Cents opening = 100000) {
+    for (size_t i = 0; i < numbers.size(); i++) {
+        AccountKind kind = kindOf ? kindOf(i) : AccountKind::Checking;
+        bank.tryAddAccount(kind, numbers[i], "Bench Customer", opening, benchParameter(kind));
+    }
+}
+
+// The same accounts as Account objects, for the benchmarks that compare against the class hierarchy
+unique_ptr<Account> makeBenchAccount(AccountKind kind, string_view number, string_view name, Cents opening) {
+    switch (kind) {
+    case AccountKind::Savings: return make_unique<SavingsAccount>(number, name, opening, benchParameter(kind));
+    case AccountKind::Checking: return make_unique<CheckingAccount>(number, name, opening, benchParameter(kind));
+    default: return make_unique<Account>(number, name, opening);
+    }
+}
+
+// Wall-clock seconds one call of fn takes
+template <typename Fn>
+double benchSeconds(Fn&& fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// One --bench-threads worker: `ops` deposits and withdrawals of $1 in turn on random accounts
+void depositWithdrawTraffic(BankSystem& bank, const vector<string>& numbers, size_t ops, uint64_t seed) {
+    mt19937_64 rng(seed);
+    for (size_t i = 0; i < ops; i++) {
+        const string& number = numbers[rng() % numbers.size()];
+        if (i & 1) bank.tryWithdraw(number, 100);
+        else bank.tryDeposit(number, 100);
+    }
+}
+
+// Uniform deposit/withdraw traffic from 1, 2, 4 ... maxThreads workers against one BankSystem
+int runThreadBenchmark(size_t accounts, size_t opsPerThread, size_t maxThreads) {
+    BankSystem bankSystem(inMemoryOptions());
+    vector<string> numbers = benchNumbers(accounts);
+    fillBenchBank(bankSystem, numbers);
+
+    cout << "threads,ops,seconds,ops_per_sec" << endl;
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        vector<thread> workers;
+        auto start = chrono::steady_clock::now();
+        for (size_t t = 0; t < threads; t++)
+            workers.emplace_back([&, t] { depositWithdrawTraffic(bankSystem, numbers, opsPerThread, t + 1); });
+        for (thread& worker : workers) worker.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << threads << "," << threads * opsPerThread << "," << seconds << ","
+             << static_cast<uint64_t>(threads * opsPerThread / seconds) << endl;
+    }
+    return 0;
+}
+
+// The --bench-threads traffic three ways: direct try* calls (shared lock + stripe lock each),
+// TxnEngine::execute (one request in flight per thread), and TxnEngine with each thread keeping
+// a window of requests in flight. Every mode must end with the same total balance.
+int runEngineBenchmark(size_t accounts, size_t opsPerThread, size_t maxThreads) {
+    BankSystem bankSystem(inMemoryOptions());
+    vector<string> numbers = benchNumbers(accounts);
+    fillBenchBank(bankSystem, numbers);
+    auto totalBalance = [&] {
+        Cents total = 0;
+        bankSystem.forEachAccount([&](const AccountView& acc) { total += acc.getBalance(); });
+        return total;
+    };
+    Cents expected = totalBalance();
+
+    const size_t WINDOW = 64;
+    cout << "mode,threads,ops,seconds,ops_per_sec" << endl;
+    for (const char* mode : { "locked", "engine", "engine_pipelined" }) {
+        for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+            unique_ptr<TxnEngine> engine;
+            if (mode[0] == 'e') engine = make_unique<TxnEngine>(bankSystem);
+            vector<thread> workers;
+            auto start = chrono::steady_clock::now();
+            for (size_t t = 0; t < threads; t++) {
+                workers.emplace_back([&, t] {
+                    mt19937_64 rng(t + 1);
+                    // Deposits and withdrawals alternate, so every mode leaves the total unchanged
+                    auto next = [&](size_t i) {
+                        return TxnRequest{ i & 1 ? TxnOp::Withdraw : TxnOp::Deposit, AccountNumber(numbers[rng() % accounts]), {}, 100 };
+                    };
+                    if (!engine) {
+                        depositWithdrawTraffic(bankSystem, numbers, opsPerThread, t + 1);
+                    } else if (strcmp(mode, "engine") == 0) {
+                        for (size_t i = 0; i < opsPerThread; i++) engine->execute(next(i));
+                    } else {
+                        vector<TxnCompletion> window(WINDOW);
+                        for (size_t i = 0; i < opsPerThread; i++) {
+                            TxnCompletion& completion = window[i % WINDOW];
+                            completion.wait();
+                            engine->submit(next(i), completion);
+                        }
+                        for (TxnCompletion& completion : window) completion.wait();
+                    }
+                });
             }
-            continue;
+            for (thread& worker : workers) worker.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << mode << "," << threads << "," << threads * opsPerThread << "," << seconds << ","
+                 << static_cast<uint64_t>(threads * opsPerThread / seconds) << endl;
         }
+    }
+    if (totalBalance() != expected) {
+        cout << "Error: total balance changed." << endl;
+        return 1;
+    }
+    return 0;
+}
 
-        clearInputBuffer(); // Clear the input buffer before returning valid amount
-        return amount;
+// Posts `periods` monthly interest runs to savings accounts four ways: one virtual periodInterest
+// call per heap-allocated account, interestFor and accrueInterestKernel over flat arrays, and
+// BankSystem::tryAccrueInterest (which gathers, runs the kernel and scatters). All four must end
+// with identical balances.
+int runInterestBenchmark(size_t accounts, size_t periods) {
+    BankSystem bankSystem(inMemoryOptions());
+    vector<unique_ptr<Account>> objects;
+    vector<Cents> scalarBalances, kernelBalances;
+    vector<RatePpm> rates;
+    vector<string> numbers = benchNumbers(accounts);
+    mt19937_64 rng(42);
+    for (size_t i = 0; i < accounts; i++) {
+        Cents balance = static_cast<Cents>(rng() % 100000000);
+        RatePpm rate = 5000 + static_cast<RatePpm>(rng() % 75000);
+        objects.push_back(make_unique<SavingsAccount>(numbers[i], "Bench Customer", balance, rate));
+        bankSystem.tryAddAccount(AccountKind::Savings, numbers[i], "Bench Customer", balance, rate);
+        scalarBalances.push_back(balance);
+        rates.push_back(rate);
+    }
+    kernelBalances = scalarBalances;
+
+    auto timeRuns = [&](auto run) {
+        return benchSeconds([&] {
+            for (size_t p = 0; p < periods; p++) run();
+        });
+    };
+    double perObject = timeRuns([&] {
+        for (auto& acc : objects) acc->setBalance(acc->getBalance() + acc->periodInterest(12));
+    });
+    double scalar = timeRuns([&] {
+        for (size_t i = 0; i < accounts; i++) scalarBalances[i] += interestFor(scalarBalances[i], rates[i], 12);
+    });
+    double kernel = timeRuns([&] { accrueInterestKernel(kernelBalances.data(), rates.data(), accounts, 12); });
+    double bank = timeRuns([&] { bankSystem.tryAccrueInterest(12); });
+
+    size_t mismatches = 0, i = 0;
+    bankSystem.forEachAccount([&](AccountView acc) {
+        Cents expected = objects[i]->getBalance();
+        if (acc.getBalance() != expected || scalarBalances[i] != expected || kernelBalances[i] != expected) mismatches++;
+        i++;
+    });
+
+    double postings = static_cast<double>(accounts) * periods;
+    cout << "method,seconds,postings_per_sec\n"
+         << "per_object_virtual," << perObject << "," << static_cast<uint64_t>(postings / perObject) << "\n"
+         << "flat_scalar," << scalar << "," << static_cast<uint64_t>(postings / scalar) << "\n"
+         << "flat_kernel," << kernel << "," << static_cast<uint64_t>(postings / kernel) << "\n"
+         << "accrue_interest," << bank << "," << static_cast<uint64_t>(postings / bank) << "\n"
+         << (mismatches ? "Error: " + to_string(mismatches) + " balances differ." : string("Balances match.")) << endl;
+    return mismatches ? 1 : 0;
+}
+
+// Times a full save of the bank against an incremental save after `changed` random deposits, then
+// the compaction that folds the delta file back into the snapshot. After each save a second bank is
+// loaded from the files and compared with the first. Files are written to bench_save.*.
+int runSaveBenchmark(size_t accounts, size_t changed) {
+    BankOptions opts = inMemoryOptions();
+    opts.snapshotFile = "bench_save.snap";
+    opts.deltaFile = "bench_save.delta";
+    opts.compactionRatio = 0; // compacted explicitly below
+    BankOptions reloadOpts = opts;
+    reloadOpts.autoLoad = true;
+
+    BankSystem bankSystem(opts);
+    vector<string> numbers = benchNumbers(accounts, 100000000000ULL);
+    for (size_t i = 0; i < accounts; i++) {
+        AccountKind kind = mixedBenchKind(i);
+        bankSystem.tryAddAccount(kind, numbers[i], "Bench Customer", static_cast<Cents>(i % 100000) * 100, benchParameter(kind));
+    }
+
+    auto balancesOf = [](const BankSystem& bank) {
+        vector<pair<string, Cents>> balances;
+        bank.forEachAccount([&](AccountView acc) { balances.emplace_back(string(acc.getAccountNumber()), acc.getBalance()); });
+        return balances;
+    };
+    size_t mismatches = 0;
+    auto reloadMatches = [&] {
+        BankSystem reloaded(reloadOpts);
+        if (balancesOf(reloaded) != balancesOf(bankSystem)) mismatches++;
+    };
+
+    streambuf* console = cout.rdbuf(nullptr); // drop "N accounts saved." etc.
+    double fullSave = benchSeconds([&] { bankSystem.saveAccounts(); });
+    reloadMatches();
+    mt19937_64 rng(7);
+    for (size_t i = 0; i < changed; i++) bankSystem.tryDeposit(numbers[rng() % accounts], 100);
+    double deltaSave = benchSeconds([&] { bankSystem.saveAccounts(); });
+    reloadMatches();
+    double compaction = benchSeconds([&] { bankSystem.compact(); });
+    reloadMatches();
+    cout.rdbuf(console);
+    cout.clear();
+    remove(opts.snapshotFile.c_str());
+    remove(opts.deltaFile.c_str());
+
+    cout << "save,seconds\n"
+         << "full_snapshot," << fullSave << "\n"
+         << "delta," << deltaSave << "\n"
+         << "compaction," << compaction << "\n"
+         << (mismatches ? "Error: reloaded bank differs." : "Reloaded banks match.") << endl;
+    return mismatches ? 1 : 0;
+}
+
+// Times every deposit of a writer thread while a full snapshot is saved three ways: in process
+// under the exclusive lock (the first save of a bank), by an in-process compaction (rows copied
+// under the lock, written without it) and by a forked child. Reports the writer's latency
+// percentiles over each save and the longest stall. Files are written to bench_checkpoint.*.
+int runCheckpointBenchmark(size_t accounts) {
+    BankOptions opts = inMemoryOptions();
+    opts.snapshotFile = "bench_checkpoint.snap";
+    opts.deltaFile = "bench_checkpoint.delta";
+    opts.compactionRatio = 0; // compacted explicitly below
+    vector<string> numbers = benchNumbers(accounts, 100000000000ULL);
+
+    cout << "method,save_seconds,writer_ops,p50_ns,p99_ns,p999_ns,max_ns" << endl;
+    for (const char* method : { "in_process", "in_process_compaction", "forked" }) {
+        opts.forkSnapshots = strcmp(method, "forked") == 0;
+        remove(opts.snapshotFile.c_str());
+        remove(opts.deltaFile.c_str());
+        BankSystem bankSystem(opts);
+        fillBenchBank(bankSystem, numbers);
+        streambuf* console = cout.rdbuf(nullptr); // drop "N accounts saved."
+        if (strcmp(method, "in_process_compaction") == 0) bankSystem.saveAccounts(); // so compaction has a base
+
+        atomic<bool> recording{ false }, stopping{ false };
+        vector<uint64_t> samples;
+        samples.reserve(1 << 24);
+        thread writer([&] {
+            mt19937_64 rng(1);
+            while (!stopping.load(memory_order_relaxed)) {
+                auto begin = chrono::steady_clock::now();
+                bankSystem.tryDeposit(numbers[rng() % accounts], 100);
+                uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+                if (recording.load(memory_order_relaxed) && samples.size() < samples.capacity()) samples.push_back(ns);
+            }
+        });
+        this_thread::sleep_for(chrono::milliseconds(50));
+        recording = true;
+        auto start = chrono::steady_clock::now();
+        if (strcmp(method, "in_process_compaction") == 0) bankSystem.compact();
+        else bankSystem.saveAccounts();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        recording = false;
+        stopping = true;
+        writer.join();
+        cout.rdbuf(console);
+        cout.clear();
+
+        sort(samples.begin(), samples.end());
+        cout << method << "," << seconds << "," << samples.size() << "," << percentile(samples, 0.5) << ","
+             << percentile(samples, 0.99) << "," << percentile(samples, 0.999) << "," << (samples.empty() ? 0 : samples.back()) << endl;
+    }
+    remove(opts.snapshotFile.c_str());
+    remove(opts.deltaFile.c_str());
+    return 0;
+}
+
+// Fills a ledger with `changes` random deposits, withdrawals and transfers over `accounts` accounts
+// plus one hot account taking part in every eighth change, then times statements for a random account over the
+// middle fifth of the run, a statement from the start of the hot account's long history, and
+// rebuilding every balance from the ledger. The same changes without a ledger give its cost.
+int runLedgerBenchmark(size_t accounts, size_t changes) {
+    vector<string> numbers = benchNumbers(accounts, 100000000000ULL);
+    const string hot = numbers[0];
+
+    double secondsPerChange[2];
+    int64_t runStart = 0, runEnd = 0;
+    unique_ptr<BankSystem> bank;
+    for (bool ledger : { false, true }) {
+        BankOptions opts = inMemoryOptions();
+        opts.ledger = ledger;
+        bank = make_unique<BankSystem>(opts);
+        fillBenchBank(*bank, numbers);
+        mt19937_64 rng(3);
+        runStart = wallClockMicros();
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < changes; i++) {
+            const string& number = i % 8 == 0 ? hot : numbers[rng() % accounts];
+            if (i % 3 == 0) bank->tryDeposit(number, 100);
+            else if (i % 3 == 1) bank->tryWithdraw(number, 100);
+            else bank->tryTransfer(number, numbers[1 + rng() % (accounts - 1)], 100);
+        }
+        secondsPerChange[ledger] = chrono::duration<double>(chrono::steady_clock::now() - start).count() / changes;
+        runEnd = wallClockMicros();
+    }
+
+    const size_t QUERIES = 10000;
+    int64_t span = runEnd - runStart;
+    vector<uint64_t> samples;
+    vector<LedgerEntry> entries;
+    size_t returned = 0;
+    mt19937_64 rng(5);
+    for (size_t q = 0; q < QUERIES; q++) {
+        auto begin = chrono::steady_clock::now();
+        bank->tryStatement(numbers[1 + rng() % (accounts - 1)], runStart + span * 2 / 5, runStart + span * 3 / 5, entries);
+        samples.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count());
+        returned += entries.size();
+    }
+    sort(samples.begin(), samples.end());
+    auto hotStart = chrono::steady_clock::now();
+    bank->tryStatement(hot, runStart, runStart + span / 100, entries);
+    double hotSeconds = chrono::duration<double>(chrono::steady_clock::now() - hotStart).count();
+    size_t hotEntries = entries.size();
+    auto verifyStart = chrono::steady_clock::now();
+    size_t mismatches = bank->verifyLedger();
+    double verifySeconds = chrono::duration<double>(chrono::steady_clock::now() - verifyStart).count();
+    pair<size_t, size_t> size = bank->ledgerSize();
+
+    cout << "metric,value\n"
+         << "ledger_entries," << size.first << "\n"
+         << "bytes_per_entry," << static_cast<double>(size.second) / size.first << "\n"
+         << "change_ns_without_ledger," << secondsPerChange[0] * 1e9 << "\n"
+         << "change_ns_with_ledger," << secondsPerChange[1] * 1e9 << "\n"
+         << "statement_p50_us," << samples[QUERIES / 2] / 1000.0 << "\n"
+         << "statement_p99_us," << samples[QUERIES * 99 / 100] / 1000.0 << "\n"
+         << "statement_entries_avg," << static_cast<double>(returned) / QUERIES << "\n"
+         << "hot_account_statement_us," << hotSeconds * 1e6 << "\n"
+         << "hot_account_statement_entries," << hotEntries << "\n"
+         << "rebuild_balances_seconds," << verifySeconds << "\n"
+         << (mismatches ? "Error: " + to_string(mismatches) + " balances differ from the ledger." : string("Ledger matches every balance.")) << endl;
+    return mismatches ? 1 : 0;
+}
+
+// Importing `accounts` CSV lines (about 1% invalid, 1% repeated numbers) one tryAddAccount call at
+// a time vs one tryAddAccounts batch, plus validation alone: isValid's per-character checks vs the
+// word-at-a-time scan that validationError now starts with
+int runImportBenchmark(size_t accounts) {
+    static const char* const NAMES[] = { "Alice Smith", "Bob Jones", "Carol Van Der Berg", "Dan Li", "Eve Montgomery Clark" };
+    vector<string> lines;
+    lines.reserve(accounts);
+    mt19937_64 rng(21);
+    for (size_t i = 0; i < accounts; i++) {
+        string number = to_string(100000000000ULL + (rng() % 100 == 0 && i ? rng() % i : i));
+        string name = NAMES[i % 5];
+        if (rng() % 100 == 0) name += "42";
+        lines.push_back((i % 3 == 0 ? "SAVINGS," : i % 3 == 1 ? "CHECKING," : "BASIC,") + number + "," + name + ",100.00");
+    }
+
+    auto scalarValid = [](string_view str, bool isName) {
+        if (str.length() < (isName ? 2u : 3u) || (!isName && str.length() > AccountNumber::MAX_DIGITS)) return false;
+        if (isName)
+            return all_of(str.begin(), str.end(), [](char c) { return isalpha(c) || c == ' '; })
+                && any_of(str.begin(), str.end(), [](char c) { return isalpha(c); });
+        return all_of(str.begin(), str.end(), [](char c) { return isdigit(c); });
+    };
+    vector<AccountRequest> requests(accounts);
+    vector<string> errors(accounts);
+    for (size_t i = 0; i < accounts; i++) errors[i] = parseAccountFields(lines[i], requests[i]);
+    double validateSeconds[2];
+    size_t validCount[2] = { 0, 0 };
+    for (int fast = 0; fast < 2; fast++) {
+        auto start = chrono::steady_clock::now();
+        for (const AccountRequest& request : requests) {
+            validCount[fast] += fast ? BankSystem::validationError(request.number, false).empty() && BankSystem::validationError(request.name, true).empty()
+                                     : scalarValid(request.number, false) && scalarValid(request.name, true);
+        }
+        validateSeconds[fast] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    double importSeconds[2];
+    size_t imported[2] = { 0, 0 };
+    for (int bulk = 0; bulk < 2; bulk++) {
+        BankSystem bank(inMemoryOptions());
+        auto start = chrono::steady_clock::now();
+        vector<AccountRequest> batch;
+        for (const string& line : lines) {
+            AccountRequest request;
+            if (!parseAccountFields(line, request).empty()) continue;
+            if (bulk) batch.push_back(request);
+            else imported[0] += bank.tryAddAccount(request.kind, request.number, request.name, request.balance, request.parameter) == TxnStatus::Ok;
+        }
+        if (bulk) {
+            for (TxnStatus status : bank.tryAddAccounts(batch)) imported[1] += status == TxnStatus::Ok;
+        }
+        importSeconds[bulk] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    cout << "metric,value\n"
+         << "accounts," << accounts << "\n"
+         << "validate_ns_scalar," << validateSeconds[0] / accounts * 1e9 << "\n"
+         << "validate_ns_swar," << validateSeconds[1] / accounts * 1e9 << "\n"
+         << "import_per_account_accounts_per_sec," << accounts / importSeconds[0] << "\n"
+         << "import_bulk_accounts_per_sec," << accounts / importSeconds[1] << "\n"
+         << "imported," << imported[1] << "\n"
+         << (validCount[0] != validCount[1] || imported[0] != imported[1]
+                 ? string("Error: the two paths disagree.") : string("Both paths agree.")) << endl;
+    return validCount[0] != validCount[1] || imported[0] != imported[1] ? 1 : 0;
+}
+
+// Mixed traffic (deposits, withdrawals into overdraft, transfers, closures and re-openings, a
+// monthly interest run every tenth of the way) against the portfolio totals: reports the cost per
+// change, the latency of a portfolio() poll against a full scan, and checks the two agree. A
+// second phase polls while threads transfer money around, where liabilities must never move.
+int runPortfolioBenchmark(size_t accounts, size_t changes) {
+    BankSystem bank(inMemoryOptions());
+    vector<string> numbers = benchNumbers(accounts, 100000000000ULL);
+    for (size_t i = 0; i < accounts; i++) {
+        AccountKind kind = mixedBenchKind(i); // savings rates vary so projected interest is a real sum
+        bank.tryAddAccount(kind, numbers[i], "Bench Customer", 100000,
+                           kind == AccountKind::Savings ? 25000 + i % 7 * 1000 : benchParameter(kind));
+    }
+
+    mt19937_64 rng(22);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < changes; i++) {
+        const string& number = numbers[rng() % accounts];
+        switch (rng() % 8) {
+        case 0: case 1: case 2: bank.tryDeposit(number, 1 + rng() % 50000); break;
+        case 3: case 4: case 5: bank.tryWithdraw(number, 1 + rng() % 80000); break;
+        case 6: bank.tryTransfer(number, numbers[rng() % accounts], 1 + rng() % 50000); break;
+        default:
+            if (bank.tryDeleteAccount(number) == TxnStatus::Ok)
+                bank.tryAddAccount(AccountKind::Checking, number, "Bench Customer", rng() % 100000, DEFAULT_OVERDRAFT_LIMIT);
+        }
+        if ((i + 1) % max<size_t>(1, changes / 10) == 0) bank.tryAccrueInterest(12);
+    }
+    double changeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const size_t POLLS = 10000;
+    vector<uint64_t> samples;
+    Portfolio polled;
+    for (size_t q = 0; q < POLLS; q++) {
+        auto begin = chrono::steady_clock::now();
+        polled = bank.portfolio();
+        samples.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count());
+    }
+    sort(samples.begin(), samples.end());
+    auto scanStart = chrono::steady_clock::now();
+    Portfolio scanned = bank.scanPortfolio();
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - scanStart).count();
+    bool matches = polled == scanned;
+
+    // Transfers move money between accounts, so the total held must look the same to every poll
+    auto heldIn = [](const Portfolio& p) { return accumulate(begin(p.liabilities), end(p.liabilities), Cents(0)); };
+    Cents held = heldIn(polled);
+    atomic<bool> running{ true };
+    vector<thread> movers;
+    for (size_t t = 0; t < 2; t++) {
+        movers.emplace_back([&, t] {
+            mt19937_64 local(t + 100);
+            while (running.load(memory_order_relaxed))
+                bank.tryTransfer(numbers[local() % accounts], numbers[local() % accounts], 1 + local() % 1000);
+        });
     }
+    size_t torn = 0;
+    for (size_t q = 0; q < 2000; q++) {
+        torn += heldIn(bank.portfolio()) != held;
+        this_thread::yield();
+    }
+    running = false;
+    for (thread& mover : movers) mover.join();
+    matches = matches && bank.portfolio() == bank.scanPortfolio();
+
+    cout << "metric,value\n"
+         << "change_ns," << changeSeconds / changes * 1e9 << "\n"
+         << "portfolio_p50_us," << samples[POLLS / 2] / 1000.0 << "\n"
+         << "portfolio_p99_us," << samples[POLLS * 99 / 100] / 1000.0 << "\n"
+         << "full_scan_ms," << scanSeconds * 1e3 << "\n"
+         << "deposits," << formatMoney(polled.deposits) << "\n"
+         << "liabilities_basic," << formatMoney(polled.liabilities[static_cast<size_t>(AccountKind::Basic)]) << "\n"
+         << "liabilities_savings," << formatMoney(polled.liabilities[static_cast<size_t>(AccountKind::Savings)]) << "\n"
+         << "liabilities_checking," << formatMoney(polled.liabilities[static_cast<size_t>(AccountKind::Checking)]) << "\n"
+         << "overdrawn," << formatMoney(polled.overdrawn) << "\n"
+         << "projected_interest," << formatMoney(polled.projectedInterest) << "\n"
+         << "torn_polls," << torn << "\n"
+         << (matches && torn == 0 ? string("Running totals match a full scan.")
+                                  : string("Error: running totals differ from a full scan.")) << endl;
+    return matches && torn == 0 ? 0 : 1;
 }
 
-// customer name input
-string getCustomerName() {
-    string custName;
-    while (true) {
-        cout << "Enter customer name: ";
-        getline(cin, custName);
+// The same random withdrawals (mixed account types, some overdrawing) four ways: through the
+// virtual Account hierarchy (canWithdraw, then getBalance/setBalance, getAvailableBalance on a
+// refusal), over columns with a withPolicy switch per call, over columns bucketed by type with one
+// policy loop per type, and through BankSystem, one tryWithdraw per call vs tryWithdrawBatch.
+// All four must end with the same balances.
+int runPolicyBenchmark(size_t accounts, size_t ops) {
+    const Cents OPENING = 50000;
+    vector<string> numbers = benchNumbers(accounts);
+    vector<uint32_t> targets(ops);
+    vector<Cents> amounts(ops);
+    mt19937_64 rng(24);
+    for (size_t i = 0; i < ops; i++) {
+        targets[i] = static_cast<uint32_t>(rng() % accounts);
+        amounts[i] = 1 + rng() % 20000;
+    }
 
-        if (custName.empty() || custName.length() < 2) {
-            cout << "Error: Name must be at least 2 characters long." << endl;
-            if (!askForRetry("account input process")) {
-                return "";
+    vector<unique_ptr<Account>> objects;
+    for (size_t i = 0; i < accounts; i++) objects.push_back(makeBenchAccount(mixedBenchKind(i), numbers[i], "Bench Customer", OPENING));
+    size_t refused = 0;
+    Cents shortfall = 0; // what the refusal message would report
+    double virtualSeconds = benchSeconds([&] {
+        for (size_t i = 0; i < ops; i++) {
+            Account& acc = *objects[targets[i]];
+            if (acc.canWithdraw(amounts[i])) acc.setBalance(acc.getBalance() - amounts[i]);
+            else {
+                refused++;
+                shortfall += amounts[i] - acc.getAvailableBalance();
             }
-            continue;
         }
+    });
 
-        bool validName = all_of(custName.begin(), custName.end(), [](char c) { return isalpha(c) || c == ' '; });
-        bool hasLetter = any_of(custName.begin(), custName.end(), [](char c) { return isalpha(c); });
-
-        if (!validName) {
-            cout << "Error: Name can only contain letters and spaces." << endl;
-            if (!askForRetry("account input process")) {
-                return "";
-            }
-            continue;
+    vector<AccountKind> kinds(accounts);
+    vector<Cents> limits(accounts);
+    for (size_t i = 0; i < accounts; i++) {
+        kinds[i] = mixedBenchKind(i);
+        limits[i] = kinds[i] == AccountKind::Checking ? DEFAULT_OVERDRAFT_LIMIT : 0;
+    }
+    auto withdrawWith = [&](auto policy, vector<Cents>& balances, size_t i) {
+        using Policy = decltype(policy);
+        uint32_t a = targets[i];
+        Cents limit = 0;
+        if constexpr (Policy::hasOverdraft) limit = limits[a];
+        if (amounts[i] <= Policy::available(balances[a], limit)) balances[a] -= amounts[i];
+    };
+    vector<Cents> perCall(accounts, OPENING), perType(accounts, OPENING);
+    double perCallSeconds = benchSeconds([&] {
+        for (size_t i = 0; i < ops; i++)
+            withPolicy(kinds[targets[i]], [&](auto policy) { withdrawWith(policy, perCall, i); });
+    });
+    double perTypeSeconds = benchSeconds([&] {
+        array<vector<uint32_t>, 4> byKind;
+        for (vector<uint32_t>& bucket : byKind) bucket.reserve(ops / 3 + 1);
+        for (size_t i = 0; i < ops; i++) byKind[static_cast<size_t>(kinds[targets[i]])].push_back(static_cast<uint32_t>(i));
+        for (AccountKind kind : { AccountKind::Basic, AccountKind::Savings, AccountKind::Checking }) {
+            withPolicy(kind, [&](auto policy) {
+                for (uint32_t i : byKind[static_cast<size_t>(kind)]) withdrawWith(policy, perType, i);
+            });
         }
+    });
 
-        if (!hasLetter) {
-            cout << "Error: Name must contain at least one letter." << endl;
-            if (!askForRetry("account input process")) {
-                return "";
+    double bankSeconds[2];
+    vector<Cents> bankBalances[2];
+    for (int batched = 0; batched < 2; batched++) {
+        BankSystem bank(inMemoryOptions());
+        fillBenchBank(bank, numbers, mixedBenchKind, OPENING);
+        bankSeconds[batched] = benchSeconds([&] {
+            if (!batched) {
+                for (size_t i = 0; i < ops; i++) bank.tryWithdraw(numbers[targets[i]], amounts[i]);
+                return;
             }
-            continue;
-        }
+            const size_t BATCH = 4096;
+            vector<WithdrawRequest> requests;
+            for (size_t i = 0; i < ops; i += BATCH) {
+                requests.clear();
+                for (size_t j = i; j < min(ops, i + BATCH); j++) requests.push_back({ numbers[targets[j]], amounts[j] });
+                bank.tryWithdrawBatch(requests);
+            }
+        });
+        bankBalances[batched].resize(accounts);
+        for (size_t i = 0; i < accounts; i++) bank.tryGetBalance(numbers[i], bankBalances[batched][i]);
+    }
 
-        return custName;
+    bool agree = perCall == perType && perCall == bankBalances[0] && perCall == bankBalances[1];
+    for (size_t i = 0; i < accounts; i++) agree = agree && objects[i]->getBalance() == perCall[i];
+    cout << "path,ns_per_withdrawal\n"
+         << "virtual_objects," << virtualSeconds / ops * 1e9 << "\n"
+         << "policy_per_call," << perCallSeconds / ops * 1e9 << "\n"
+         << "policy_per_type," << perTypeSeconds / ops * 1e9 << "\n"
+         << "bank_try_withdraw," << bankSeconds[0] / ops * 1e9 << "\n"
+         << "bank_withdraw_batch," << bankSeconds[1] / ops * 1e9 << "\n"
+         << (agree ? "All paths end with the same balances" : "Error: the paths disagree")
+         << " (" << refused << " refused, $" << formatMoney(shortfall) << " short)." << endl;
+    return agree ? 0 : 1;
+}
+
+// Heap bytes per account for `accounts` accounts, `perCustomer` to each customer, measured from the
+// allocator (mallinfo2): one heap object per account through the Account classes, then the
+// columnar store with interned names. The names are also costed as they were stored before
+// interning (a 16-byte pointer and length per row plus a private copy rounded up to 8 bytes), and
+// the store's total is shown with that cost in place of the pool's.
+int runMemoryBenchmark(size_t accounts, size_t perCustomer) {
+    auto heapBytes = [] {
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+    };
+    auto customerName = [](size_t customer) {
+        string name = "Customer ";
+        for (size_t i = 0; i < 6; i++, customer /= 26) name += static_cast<char>((i ? 'a' : 'A') + customer % 26);
+        return name;
+    };
+    vector<string> numbers = benchNumbers(accounts, 100000000000ULL), names(accounts);
+    size_t privateNameBytes = 0;
+    for (size_t i = 0; i < accounts; i++) {
+        names[i] = customerName(i / perCustomer);
+        privateNameBytes += (names[i].size() + 7) / 8 * 8;
+    }
+
+    size_t start = heapBytes();
+    vector<unique_ptr<Account>> objects;
+    objects.reserve(accounts);
+    for (size_t i = 0; i < accounts; i++) objects.push_back(makeBenchAccount(mixedBenchKind(i), numbers[i], names[i], 100000));
+    double objectBytes = static_cast<double>(heapBytes() - start) / accounts;
+    objects.clear();
+    objects.shrink_to_fit();
+
+    BankOptions opts = inMemoryOptions();
+    opts.ledger = false;
+    BankSystem bank(opts);
+    start = heapBytes();
+    for (size_t i = 0; i < accounts; i++) {
+        AccountKind kind = mixedBenchKind(i);
+        bank.tryAddAccount(kind, numbers[i], names[i], 100000, benchParameter(kind));
     }
+    double storeBytes = static_cast<double>(heapBytes() - start) / accounts;
+    MemoryUsage usage = bank.memoryUsage();
+    double pooledNames = static_cast<double>(usage.nameBytes) / accounts + sizeof(NamePool::Handle);
+    double privateNames = static_cast<double>(privateNameBytes) / accounts + sizeof(NameArena::Ref);
+
+    cout << "metric,value\n"
+         << "accounts," << accounts << "\n"
+         << "distinct_names," << usage.distinctNames << "\n"
+         << "objects_bytes_per_account," << objectBytes << "\n"
+         << "store_bytes_per_account," << storeBytes << "\n"
+         << "store_bytes_per_account_without_interning," << storeBytes - pooledNames + privateNames << "\n"
+         << "columns_bytes_per_account," << static_cast<double>(usage.columnBytes) / accounts << "\n"
+         << "index_bytes_per_account," << static_cast<double>(usage.indexBytes) / accounts << "\n"
+         << "name_bytes_per_account_interned," << pooledNames << "\n"
+         << "name_bytes_per_account_private," << privateNames << endl;
+    return 0;
 }
 
-// initial balance input
-double getInitialBalance() {
-    double balance;
-    while (true) {
-        cout << "Enter initial balance: $";
-        if (!(cin >> balance)) {
-            cout << "Error: Invalid input. Please enter a valid number." << endl;
-            clearInputBuffer();
-            if (!askForRetry("account input process")) {
-                return -1;
-            }
-            continue;
-        }
+// Daily compounding over `days` simulated days from 2024-01-01 (a leap year) for `accounts`
+// savings accounts, timed with one interest thread and with `threads`. Both banks must end with
+// the same balances as a flat interestFor loop over the same calendar; the checksum covers every
+// balance in display order. The ledger is off: a year of daily postings would hold one entry per
+// account per day.
+int runCompoundBenchmark(size_t accounts, size_t days, size_t threads) {
+    int64_t from;
+    parseDate("2024-01-01", from);
+    vector<Cents> expected(accounts);
+    vector<RatePpm> rates(accounts);
+    vector<AccountRequest> requests(accounts);
+    vector<string> numbers = benchNumbers(accounts);
+    mt19937_64 rng(42);
+    for (size_t i = 0; i < accounts; i++) {
+        expected[i] = static_cast<Cents>(rng() % 100000000);
+        rates[i] = 5000 + static_cast<RatePpm>(rng() % 75000);
+        requests[i] = { AccountKind::Savings, numbers[i], "Bench Customer", expected[i], rates[i] };
+    }
+    for (size_t day = 0; day < days; day++) {
+        time_t seconds = static_cast<time_t>(from / 1000000) + static_cast<time_t>(day) * 86400;
+        tm date;
+        gmtime_r(&seconds, &date);
+        int year = date.tm_year + 1900;
+        int periods = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0 ? 366 : 365;
+        for (size_t i = 0; i < accounts; i++) expected[i] += interestFor(expected[i], rates[i], periods);
+    }
 
-        if (balance < 0) {
-            cout << "Error: Balance cannot be negative." << endl;
-            clearInputBuffer(); // Clear the input buffer after detecting negative balance
-            if (!askForRetry("account input process")) {
-                return -1;
-            }
-            continue;
-        }
+    uint64_t expectedSum = 0;
+    for (Cents balance : expected) expectedSum = (expectedSum ^ static_cast<uint64_t>(balance)) * 0x100000001b3ULL;
 
-        clearInputBuffer(); // Clear the input buffer before returning valid balance
-        return balance;
+    vector<size_t> threadCounts = { 1 };
+    if (threads > 1) threadCounts.push_back(threads);
+    cout << "threads,seconds,postings_per_sec,checksum\n";
+    size_t mismatches = 0;
+    for (size_t count : threadCounts) {
+        BankOptions opts = inMemoryOptions();
+        opts.ledger = false;
+        opts.interestThreads = count;
+        BankSystem bankSystem(opts);
+        bankSystem.tryAddAccounts(requests);
+        auto start = chrono::steady_clock::now();
+        bankSystem.fastForwardInterest(from, days, InterestSchedule::Daily);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        uint64_t sum = 0;
+        size_t i = 0;
+        bankSystem.forEachAccount([&](AccountView acc) {
+            if (acc.getBalance() != expected[i++]) mismatches++;
+            sum = (sum ^ static_cast<uint64_t>(acc.getBalance())) * 0x100000001b3ULL;
+        });
+        cout << count << "," << seconds << "," << static_cast<uint64_t>(static_cast<double>(accounts) * days / seconds)
+             << "," << hex << sum << dec << "\n";
     }
+    cout << "reference,,," << hex << expectedSum << dec << "\n"
+         << (mismatches ? "Error: " + to_string(mismatches) + " balances differ." : string("Balances match.")) << endl;
+    return mismatches ? 1 : 0;
 }
 
-//  account type selection
-int getAccountType() {
-    int type;
-    while (true) {
-        cout << "\n1. Basic Account\n2. Savings Account\n3. Checking Account\n";
-        cout << "Enter account type: ";
+// The same client traffic against 1, 2, 4 ... maxShards in-memory shards behind a router: each
+// client thread sends deposits, withdrawals and transfers between random accounts one at a time,
+// and the run reports throughput and round-trip latency. Afterwards every balance is read back
+// and must add up to the opening total plus the net of the deposits and withdrawals that succeeded.
+int runShardBenchmark(size_t accounts, size_t opsPerClient, size_t clients, size_t maxShards) {
+    char dirTemplate[] = "/tmp/bank_shards_XXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        cout << "Error: Could not create a directory for the shard sockets." << endl;
+        return 1;
+    }
+    string dir = dirTemplate;
+    vector<string> numbers = benchNumbers(accounts);
+    const Cents OPENING = 100000, AMOUNT = 100;
 
-        if (!(cin >> type) || type < 1 || type > 3) {
-            cout << "Error: Invalid choice. Please enter 1, 2, or 3." << endl;
-            clearInputBuffer();
-            if (!askForRetry("account input process")) {
-                return -1;
+    // Runs body(client, connection) on every client thread; false if a client could not connect
+    auto onClients = [&](const ShardRouter& router, const function<void(size_t, ShardClient&)>& body) {
+        atomic<bool> connected{ true };
+        vector<thread> threads;
+        for (size_t c = 0; c < clients; c++) {
+            threads.emplace_back([&, c] {
+                ShardClient client(router.socketPath());
+                if (client.connected()) body(c, client);
+                else connected = false;
+            });
+        }
+        for (thread& t : threads) t.join();
+        return connected.load();
+    };
+
+    int result = 0;
+    cout << "shards,clients,ops,seconds,ops_per_sec,p50_us,p99_us,p999_us,cross_shard_transfers" << endl;
+    for (size_t shards = 1; shards <= maxShards && result == 0; shards *= 2) {
+        ShardRouter router(shards, dir, false);
+        if (!router.ok()) {
+            cout << "Error: Could not start " << shards << " shards." << endl;
+            return 1;
+        }
+        bool connected = onClients(router, [&](size_t c, ShardClient& client) {
+            for (size_t i = c; i < accounts; i += clients)
+                client.addAccount(AccountKind::Basic, numbers[i], "Bench Customer", OPENING, 0);
+        });
+
+        vector<vector<uint32_t>> latencies(clients);
+        atomic<int64_t> net{ 0 };
+        atomic<size_t> crossShard{ 0 };
+        auto start = chrono::steady_clock::now();
+        connected = connected && onClients(router, [&](size_t c, ShardClient& client) {
+            mt19937_64 rng(c + 1);
+            vector<uint32_t>& samples = latencies[c];
+            samples.reserve(opsPerClient);
+            int64_t change = 0;
+            size_t crossed = 0;
+            for (size_t i = 0; i < opsPerClient; i++) {
+                const string& number = numbers[rng() % accounts];
+                auto begin = chrono::steady_clock::now();
+                switch (i % 3) {
+                case 0:
+                    if (client.deposit(number, AMOUNT) == TxnStatus::Ok) change += AMOUNT;
+                    break;
+                case 1:
+                    if (client.withdraw(number, AMOUNT) == TxnStatus::Ok) change -= AMOUNT;
+                    break;
+                default: {
+                    const string& target = numbers[rng() % accounts];
+                    client.transfer(number, target, AMOUNT);
+                    crossed += shardOf(AccountNumber(number).key(), shards) != shardOf(AccountNumber(target).key(), shards);
+                }
+                }
+                samples.push_back(static_cast<uint32_t>(
+                    chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count()));
             }
-            continue;
+            net += change;
+            crossShard += crossed;
+        });
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        atomic<int64_t> total{ 0 };
+        connected = connected && onClients(router, [&](size_t c, ShardClient& client) {
+            int64_t sum = 0;
+            for (size_t i = c; i < accounts; i += clients) {
+                Cents balance = 0;
+                client.getBalance(numbers[i], balance);
+                sum += balance;
+            }
+            total += sum;
+        });
+        router.stop();
+
+        vector<uint32_t> all;
+        for (const vector<uint32_t>& samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+        sort(all.begin(), all.end());
+        size_t ops = all.size();
+        if (!connected || ops == 0) {
+            cout << "Error: Could not connect to the router." << endl;
+            result = 1;
+            break;
+        }
+        cout << shards << "," << clients << "," << ops << "," << seconds << "," << static_cast<uint64_t>(ops / seconds) << ",";
+        printLatencyPercentiles(all);
+        cout << "," << crossShard.load() << endl;
+        if (total.load() != static_cast<int64_t>(accounts) * OPENING + net.load()) {
+            cout << "Error: balances add up to " << formatMoney(total.load()) << ", expected "
+                 << formatMoney(static_cast<int64_t>(accounts) * OPENING + net.load()) << "." << endl;
+            result = 1;
         }
-        cin.ignore(); // Clear the newline after numeric input
-        return type;
     }
+    ::rmdir(dir.c_str());
+    return result;
 }
 
-// account creation process
-bool createNewAccount(BankSystem& bankSystem) {
-    while (true) {
-        cout << "\n=== Add New Account ===" << endl;
+// Crash-recovery checks (--check-recovery). Each case kills a process that is changing the bank
+// with SIGKILL partway through and loads what it left on disk. Writers report every change over a
+// pipe once it is acknowledged, so a reloaded balance must hold each acknowledged change and at
+// most the one change its writer still had in flight.
+const size_t RECOVERY_WRITERS = 4;
+const size_t RECOVERY_ACCOUNTS = 4096; // writer w deposits into accounts w, w + RECOVERY_WRITERS, ...
 
-        // Get account type
-        int type = getAccountType();
-        if (type == -1) return false; // User chose not to retry
+// An acknowledged change: the writer's account (or writer) and how many of its changes are acknowledged
+struct RecoveryAck {
+    uint32_t slot;
+    uint32_t count;
+};
 
-        // Get account number
-        string accNum = getAccountNumber(bankSystem, false); // false = should not exist
-        if (accNum.empty()) return false; // User chose not to retry
+BankOptions recoveryOptions(const string& dir) {
+    BankOptions opts;
+    opts.textFile = dir + "/bank.txt";
+    opts.snapshotFile = dir + "/bank.snap";
+    opts.journalFile = dir + "/bank.journal";
+    opts.deltaFile = dir + "/bank.delta";
+    opts.ledgerFile = dir + "/bank.ledger";
+    opts.metricsFile.clear();
+    return opts;
+}
 
-        // Get customer name
-        string custName = getCustomerName();
-        if (custName.empty()) return false; // User chose not to retry
+string recoveryNumber(size_t account) { return to_string(500000 + account); }
 
-        // Get initial balance
-        double balance = getInitialBalance();
-        if (balance == -1) return false; // User chose not to retry
+// Requests for the RECOVERY_ACCOUNTS empty basic accounts every case starts from; they point into
+// numbers, which receives the accounts' numbers
+vector<AccountRequest> recoveryRequests(vector<string>& numbers) {
+    numbers.resize(RECOVERY_ACCOUNTS);
+    vector<AccountRequest> requests;
+    for (size_t a = 0; a < RECOVERY_ACCOUNTS; a++) {
+        numbers[a] = recoveryNumber(a);
+        requests.push_back({ AccountKind::Basic, numbers[a], "Recovery Check", 0, 0 });
+    }
+    return requests;
+}
 
-        // Create and add account
-        auto acc = bankSystem.createAccount(type, accNum, custName, balance);
-        if (acc && bankSystem.addAccount(std::move(acc))) {
-            cout << "Account added successfully!" << endl;
-            return true;
-        } else {
-            cout << "Error: Failed to create account." << endl;
-            if (!askForRetry("account input process")) {
-                return false;
-            }
-            // Continue the loop to retry the entire process
-        }
+// Removes the files a case may leave under dir, and nothing else there
+void removeRecoveryFiles(const string& dir) {
+    BankOptions opts = recoveryOptions(dir);
+    for (const string& path : { opts.textFile, opts.snapshotFile, opts.journalFile, opts.deltaFile, opts.ledgerFile }) {
+        ::unlink(path.c_str());
+        ::unlink((path + ".tmp").c_str());
     }
 }
 
-// account search
-bool searchAccount(BankSystem& bankSystem) {
+// Runs child(ackFd) in a child process and kills it once `acks` changes are acknowledged; `acked`
+// receives the highest count acknowledged per slot, including acks written before it died. False
+// if the child stopped on its own first.
+bool crashAfter(size_t acks, const function<void(int)>& child, vector<uint32_t>& acked) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    cout.flush(); // or the child would flush the parent's pending output again
+    pid_t pid = fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        cout.rdbuf(nullptr); // the bank's own messages
+        child(fds[1]);
+        _exit(1);
+    }
+    ::close(fds[1]);
+    if (pid < 0) {
+        ::close(fds[0]);
+        return false;
+    }
+    // Acks are written whole (far below PIPE_BUF), so the pipe only ever holds whole ones; the
+    // last reads drain what the child wrote before SIGKILL, until every copy of the write end is
+    // gone (processes the child forked die with it)
+    size_t seen = 0;
+    bool killed = false;
+    RecoveryAck batch[256];
     while (true) {
-        string accNum = getAccountNumber(bankSystem, true); // true = should exist
-        if (accNum.empty()) return false; // User chose not to retry
+        ssize_t got = ::read(fds[0], batch, sizeof(batch));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        for (size_t i = 0; i < static_cast<size_t>(got) / sizeof(RecoveryAck); i++) {
+            if (batch[i].slot < acked.size()) acked[batch[i].slot] = max(acked[batch[i].slot], batch[i].count);
+            seen++;
+        }
+        if (!killed && seen >= acks) killed = ::kill(pid, SIGKILL) == 0;
+    }
+    ::close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return killed;
+}
 
-        Account* acc = bankSystem.searchByAccountNumber(accNum);
-        if (acc) {
-            cout << "\nAccount found:" << endl;
-            acc->displayDetails();
-            return true;
-        } else {
-            cout << "Error: Account not found." << endl;
-            if (!askForRetry("account search")) {
-                return false;
+// Child side: opens the bank, adds RECOVERY_ACCOUNTS empty accounts in one batch, then deposits a
+// cent at a time from RECOVERY_WRITERS threads, each acknowledging its deposits; `background`
+// (if any) runs alongside. Returns only if something failed.
+void depositUntilKilled(const BankOptions& opts, int ackFd, const function<void(BankSystem&)>& background = nullptr) {
+    BankSystem bank(opts);
+    vector<string> numbers;
+    for (TxnStatus status : bank.tryAddAccounts(recoveryRequests(numbers))) {
+        if (status != TxnStatus::Ok) return;
+    }
+    vector<thread> threads;
+    for (size_t w = 0; w < RECOVERY_WRITERS; w++) {
+        threads.emplace_back([&, w] {
+            vector<uint32_t> counts(RECOVERY_ACCOUNTS);
+            for (size_t i = 0;; i++) {
+                size_t account = w + RECOVERY_WRITERS * (i % (RECOVERY_ACCOUNTS / RECOVERY_WRITERS));
+                if (bank.tryDeposit(numbers[account], 1) != TxnStatus::Ok) return;
+                RecoveryAck ack = { static_cast<uint32_t>(account), ++counts[account] };
+                if (::write(ackFd, &ack, sizeof(ack)) != static_cast<ssize_t>(sizeof(ack))) return;
             }
-            // Continue the loop to retry
+        });
+    }
+    if (background) background(bank);
+    for (thread& t : threads) t.join();
+}
+
+// Loads the bank read-only and checks that every account holds between expected and expected +
+// slack cents; `kept` counts the cents above expected. Returns what is wrong, or "".
+string checkRecovered(const BankOptions& opts, const vector<uint32_t>& expected, Cents slack, Cents& kept) {
+    BankOptions view = opts;
+    view.readOnly = true;
+    streambuf* console = cout.rdbuf(nullptr);
+    string problem;
+    kept = 0;
+    {
+        BankSystem bank(view);
+        for (size_t a = 0; a < expected.size() && problem.empty(); a++) {
+            Cents balance = 0;
+            if (bank.tryGetBalance(recoveryNumber(a), balance) != TxnStatus::Ok) problem = "account " + recoveryNumber(a) + " was lost";
+            else if (balance < expected[a] || balance > expected[a] + slack)
+                problem = "account " + recoveryNumber(a) + " holds " + to_string(balance) + " cents, expected "
+                    + to_string(expected[a]) + (slack ? " to " + to_string(expected[a] + slack) : string());
+            else kept += balance - expected[a];
         }
     }
+    cout.rdbuf(console);
+    return problem;
 }
 
-// deposit process
-bool performDeposit(BankSystem& bankSystem) {
-    while (true) {
-        string accNum = getAccountNumber(bankSystem, true);
-        if (accNum.empty()) return false;
+// A crash while writers are depositing, with the bank configured by `opts`; at most one deposit
+// per writer may survive unacknowledged
+string checkCrash(const BankOptions& opts, size_t acks, Cents& kept,
+                  const function<void(BankSystem&)>& background = nullptr) {
+    vector<uint32_t> acked(RECOVERY_ACCOUNTS);
+    if (!crashAfter(acks, [&](int ackFd) { depositUntilKilled(opts, ackFd, background); }, acked))
+        return "the writers stopped before the crash";
+    string problem = checkRecovered(opts, acked, 1, kept);
+    if (problem.empty() && kept > static_cast<Cents>(RECOVERY_WRITERS)) problem = "more deposits survived than were in flight";
+    return problem;
+}
 
-        double amount = getAmount();
-        if (amount == -1) return false;
+// Journal replay: no checkpoints, so everything comes back from the journal
+string checkJournalReplay(const string& dir, Cents& kept) {
+    BankOptions opts = recoveryOptions(dir);
+    opts.checkpointInterval = 0;
+    return checkCrash(opts, 4000, kept);
+}
 
-        if (bankSystem.deposit(accNum, amount)) {
-            return true;
-        } else {
-            cout << "Error: Deposit failed." << endl;
-            if (!askForRetry("amount input")) {
-                return false;
-            }
-            // Continue the loop to retry
+// Checkpoints, forked snapshots and compactions running back to back while writers deposit, so
+// the crash lands in the middle of one
+string checkCheckpointCrash(const string& dir, Cents& kept) {
+    BankOptions opts = recoveryOptions(dir);
+    opts.checkpointInterval = 500;
+    return checkCrash(opts, 6000, kept, [](BankSystem& bank) {
+        for (size_t i = 0;; i++) {
+            if (!(i % 2 ? bank.compact() : bank.checkpoint())) return;
         }
-    }
+    });
 }
 
-// withdrawal process
-bool performWithdrawal(BankSystem& bankSystem) {
-    while (true) {
-        string accNum = getAccountNumber(bankSystem, true);
-        if (accNum.empty()) return false;
+// A journal cut off inside a record, or with a corrupt one: replay keeps exactly the records
+// before it
+string checkTornJournal(const string& dir, Cents& kept) {
+    const size_t DEPOSITS = 300;
+    BankOptions opts = recoveryOptions(dir);
+    opts.checkpointInterval = 0;
+    opts.saveOnExit = false;
+    opts.forkSnapshots = false; // a forked snapshot leaves the journal in place and records a skip count
+    streambuf* console = cout.rdbuf(nullptr);
+    {
+        BankSystem bank(opts);
+        vector<string> numbers;
+        bank.tryAddAccounts(recoveryRequests(numbers));
+        bank.checkpoint(); // the journal now holds only its header
+        for (size_t i = 0; i < DEPOSITS; i++) bank.tryDeposit(numbers[i % RECOVERY_ACCOUNTS], static_cast<Cents>(i + 1));
+    }
+    cout.rdbuf(console);
+    MappedFile mapped(opts.journalFile);
+    string journal(mapped.data(), mapped.size());
+    if (journal.size() != sizeof(JournalHeader) + DEPOSITS * sizeof(JournalRecord)) return "the journal does not hold one record per deposit";
 
-        double amount = getAmount();
-        if (amount == -1) return false;
+    for (size_t whole : { size_t{ 0 }, DEPOSITS / 3, DEPOSITS - 1 }) {
+        for (bool corrupt : { false, true }) {
+            size_t end = sizeof(JournalHeader) + whole * sizeof(JournalRecord);
+            string bytes = journal.substr(0, end + (corrupt ? sizeof(JournalRecord) : sizeof(JournalRecord) / 2));
+            if (corrupt) bytes.back() ^= 0x5a; // inside the next record's checksummed time
+            int fd = ::open(opts.journalFile.c_str(), O_WRONLY | O_TRUNC);
+            bool written = fd >= 0 && ::write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size());
+            if (fd >= 0) ::close(fd);
+            if (!written) return "could not rewrite the journal";
+            vector<uint32_t> expected(RECOVERY_ACCOUNTS);
+            for (size_t i = 0; i < whole; i++) expected[i % RECOVERY_ACCOUNTS] += static_cast<uint32_t>(i + 1);
+            string problem = checkRecovered(opts, expected, 0, kept);
+            if (!problem.empty()) return problem + (corrupt ? " after a corrupt record" : " after a torn record");
+        }
+    }
+    return "";
+}
 
-        if (bankSystem.withdraw(accNum, amount)) {
-            return true;
-        } else {
-            if (!askForRetry("withdrawal process")) {
-                return false;
-            }
-            // Continue the loop to retry
+// A journal that cannot be written from the start (a symlink to /dev/full): the bank must run
+// without it, neither hanging on a change nor crashing on exit, and save everything on exit
+string checkUnwritableJournal(const string& dir, Cents& kept) {
+    BankOptions opts = recoveryOptions(dir);
+    if (::symlink("/dev/full", opts.journalFile.c_str()) != 0) return "could not link the journal to /dev/full";
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        cout.rdbuf(nullptr);
+        bool ok;
+        {
+            BankSystem bank(opts);
+            vector<string> numbers;
+            vector<TxnStatus> added = bank.tryAddAccounts(recoveryRequests(numbers));
+            ok = all_of(added.begin(), added.end(), [](TxnStatus status) { return status == TxnStatus::Ok; });
+            for (size_t a = 0; a < RECOVERY_ACCOUNTS && ok; a++) ok = bank.tryDeposit(numbers[a], 1) == TxnStatus::Ok;
+        }
+        _exit(ok ? 0 : 2);
+    }
+    if (pid < 0) return "could not fork";
+    int status = 0;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (chrono::steady_clock::now() > deadline) {
+            ::kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            return "a change hung on the unwritable journal";
         }
+        this_thread::sleep_for(chrono::milliseconds(10));
     }
+    if (!WIFEXITED(status)) return "the bank crashed with an unwritable journal";
+    if (WEXITSTATUS(status) != 0) return "changes were refused without a journal";
+    return checkRecovered(opts, vector<uint32_t>(RECOVERY_ACCOUNTS, 1), 0, kept);
 }
 
-// account deletion
-bool deleteAccount(BankSystem& bankSystem) {
-    while (true) {
-        string accNum = getAccountNumber(bankSystem, true);
-        if (accNum.empty()) return false;
+// --check-recovery: runs every case under dir (a new directory under /tmp if empty); 1 if any failed
+int runRecoveryCheck(const string& where) {
+    string dir = where;
+    if (dir.empty()) {
+        char dirTemplate[] = "/tmp/bank_recovery_XXXXXX";
+        if (!mkdtemp(dirTemplate)) {
+            cout << "Error: Could not create a directory for the check." << endl;
+            return 1;
+        }
+        dir = dirTemplate;
+    } else if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cout << "Error: Could not create " << dir << "." << endl;
+        return 1;
+    }
 
-        cout << "Delete account " << accNum << "? (y/n): ";
-        string confirm;
-        getline(cin, confirm);
-        if (confirm == "y" || confirm == "Y") {
-            bankSystem.deleteAccount(accNum);
-            return true;
-        } else {
-            cout << "Account deletion cancelled." << endl;
-            return true;
+    static const pair<const char*, string (*)(const string&, Cents&)> cases[] = {
+        { "journal_replay", checkJournalReplay },
+        { "checkpoint_crash", checkCheckpointCrash },
+        { "torn_journal", checkTornJournal },
+        { "unwritable_journal", checkUnwritableJournal },
+    };
+    int result = 0;
+    cout << "case,seconds,unacknowledged_kept,result" << endl;
+    for (const auto& check : cases) {
+        removeRecoveryFiles(dir);
+        Cents kept = 0;
+        auto start = chrono::steady_clock::now();
+        string problem = check.second(dir, kept);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << check.first << "," << seconds << "," << kept << "," << (problem.empty() ? "ok" : "FAILED") << endl;
+        if (!problem.empty()) {
+            cout << "Error: " << problem << "." << endl;
+            result = 1;
         }
     }
+    removeRecoveryFiles(dir);
+    if (where.empty()) ::rmdir(dir.c_str());
+    return result;
 }
 
-// Enhanced show account info
-bool showAccountInfo(BankSystem& bankSystem) {
-    while (true) {
-        string accNum = getAccountNumber(bankSystem, true);
-        if (accNum.empty()) return false;
+// Latency samples and allocation count for one operation at one bank size
+struct BenchResult {
+    size_t accounts = 0;
+    string operation;
+    vector<uint64_t> samples; // nanoseconds per call
+    uint64_t allocations = 0;
+    double seconds = 0;
+};
 
-        bankSystem.showAccountInfo(accNum);
-        return true;
+// Times fn(i) for i in [0, count) one call at a time (each sample includes ~20 ns of clock overhead)
+template <typename Fn>
+BenchResult timeEach(size_t accounts, const string& operation, size_t count, Fn fn) {
+    BenchResult result;
+    result.accounts = accounts;
+    result.operation = operation;
+    result.samples.reserve(count);
+    uint64_t allocationsBefore = heapAllocationCount();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        auto begin = chrono::steady_clock::now();
+        fn(i);
+        result.samples.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count());
     }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    // The sample vector was reserved up front, so it adds nothing here
+    result.allocations = heapAllocationCount() - allocationsBefore;
+    return result;
 }
 
-// Main system function
-int runBankSystem() {
-    BankSystem bankSystem;
-    int choice;
+void printBenchResults(vector<BenchResult>& results, bool json) {
+    if (!json) cout << "accounts,operation,count,seconds,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,allocations,allocations_per_op\n";
+    else cout << "[\n";
+    for (size_t r = 0; r < results.size(); r++) {
+        BenchResult& result = results[r];
+        sort(result.samples.begin(), result.samples.end());
+        size_t count = result.samples.size();
+        uint64_t total = 0;
+        for (uint64_t sample : result.samples) total += sample;
+        double perOp = count ? static_cast<double>(result.allocations) / count : 0;
+        uint64_t fields[] = { count ? total / count : 0, percentile(result.samples, 0.5), percentile(result.samples, 0.9),
+                              percentile(result.samples, 0.99), percentile(result.samples, 0.999),
+                              count ? result.samples.back() : 0 };
+        double opsPerSec = result.seconds > 0 ? count / result.seconds : 0;
+        if (json) {
+            static const char* const names[] = { "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns" };
+            cout << "  {\"accounts\": " << result.accounts << ", \"operation\": \"" << result.operation << "\", \"count\": " << count
+                 << ", \"seconds\": " << result.seconds << ", \"ops_per_sec\": " << fixed << setprecision(1) << opsPerSec
+                 << defaultfloat << setprecision(6);
+            for (size_t f = 0; f < 6; f++) cout << ", \"" << names[f] << "\": " << fields[f];
+            if (BANK_COUNT_ALLOCATIONS) cout << ", \"allocations\": " << result.allocations << ", \"allocations_per_op\": " << perOp;
+            else cout << ", \"allocations\": null, \"allocations_per_op\": null";
+            cout << "}" << (r + 1 < results.size() ? "," : "") << "\n";
+        } else {
+            cout << result.accounts << "," << result.operation << "," << count << "," << result.seconds << ","
+                 << fixed << setprecision(1) << opsPerSec << defaultfloat << setprecision(6);
+            for (uint64_t field : fields) cout << "," << field;
+            if (BANK_COUNT_ALLOCATIONS) cout << "," << result.allocations << "," << perOp << "\n";
+            else cout << ",,\n";
+        }
+    }
+    if (json) cout << "]\n";
+    cout << flush;
+}
 
-    do {
-        choice = getMenuChoice();
-        if (choice == -1) {
-            cout << "Operation cancelled. Returning to main menu." << endl;
-            continue;
+// Builds a bank of each size with a mix of basic, savings and checking accounts and times every
+// operation separately: add, search, deposit, withdraw, text save, text load, index queries,
+// deposits with the indexes maintained, and delete.
+// Lookups and updates hit accounts in random order. Console messages from the bank are muted.
+int runBenchmarkSuite(const vector<size_t>& sizes, bool json) {
+    const string textPath = "bench_accounts.txt";
+    vector<BenchResult> results;
+    streambuf* console = cout.rdbuf(nullptr); // drop "N accounts saved." etc.
+
+    for (size_t accounts : sizes) {
+        mt19937_64 rng(accounts);
+        vector<string> numbers = benchNumbers(accounts, 100000000000ULL);
+        vector<uint32_t> order(accounts);
+        for (size_t i = 0; i < accounts; i++) order[i] = static_cast<uint32_t>(i);
+        shuffle(order.begin(), order.end(), rng);
+
+        BankSystem bankSystem(inMemoryOptions());
+        results.push_back(timeEach(accounts, "add", accounts, [&](size_t i) {
+            AccountKind kind = mixedBenchKind(i);
+            bankSystem.tryAddAccount(kind, numbers[i], "Bench Customer", static_cast<Cents>(i % 100000) * 100, benchParameter(kind));
+        }));
+        size_t found = 0;
+        results.push_back(timeEach(accounts, "search", accounts, [&](size_t i) {
+            if (bankSystem.searchByAccountNumber(numbers[order[i]])) found++;
+        }));
+        results.push_back(timeEach(accounts, "deposit", accounts, [&](size_t i) {
+            bankSystem.tryDeposit(numbers[order[i]], 2500);
+        }));
+        results.push_back(timeEach(accounts, "withdraw", accounts, [&](size_t i) {
+            bankSystem.tryWithdraw(numbers[order[i]], 1000);
+        }));
+        results.push_back(timeEach(accounts, "save_text", 1, [&](size_t) { bankSystem.saveAccountsToFile(textPath); }));
+        {
+            BankSystem loaded(inMemoryOptions());
+            results.push_back(timeEach(accounts, "load_text", 1, [&](size_t) { loaded.loadAccountsFromFile(textPath); }));
+            if (loaded.accountCount() != accounts) found = 0;
         }
+        // Secondary indexes: built by the first query, then kept up to date by every update
+        results.push_back(timeEach(accounts, "index_build", 1, [&](size_t) { bankSystem.topBalances(1); }));
+        size_t queries = min<size_t>(accounts, 10000);
+        results.push_back(timeEach(accounts, "top_100", queries, [&](size_t) { bankSystem.topBalances(100); }));
+        results.push_back(timeEach(accounts, "balance_range", queries, [&](size_t i) {
+            Cents low = static_cast<Cents>(order[i] % 100000) * 100;
+            bankSystem.findByBalance(low, low + 1000, 100);
+        }));
+        results.push_back(timeEach(accounts, "name_prefix", queries, [&](size_t) { bankSystem.findByNamePrefix("Bench C", 100); }));
+        results.push_back(timeEach(accounts, "deposit_indexed", accounts, [&](size_t i) {
+            bankSystem.tryDeposit(numbers[order[i]], 2500);
+        }));
+        results.push_back(timeEach(accounts, "delete", accounts, [&](size_t i) {
+            bankSystem.tryDeleteAccount(numbers[order[i]]);
+        }));
+        remove(textPath.c_str());
 
-        switch (choice) {
-        case 1:
-            createNewAccount(bankSystem);
-            break;
-        case 2:
-            bankSystem.displayAllAccounts();
-            break;
-        case 3:
-            searchAccount(bankSystem);
-            break;
-        case 4:
-            performDeposit(bankSystem);
-            break;
-        case 5:
-            performWithdrawal(bankSystem);
-            break;
-        case 6:
-            deleteAccount(bankSystem);
-            break;
-        case 7:
-            showAccountInfo(bankSystem);
-            break;
-        case 8:
-            cout << "Thank you for using Bank Account Management System!" << endl;
-            break;
+        if (found != accounts || bankSystem.accountCount() != 0) {
+            cout.rdbuf(console);
+            cout << "Error: benchmark bank of " << accounts << " accounts lost data." << endl;
+            return 1;
         }
-    } while (choice != 8);
+    }
 
-    return 1;
+    cout.rdbuf(console);
+    cout.clear();
+    printBenchResults(results, json);
+    return 0;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        string mode = argv[1];
+        // Numeric arguments are checked before a mode runs, so a typo prints the usage below
+        auto countsFrom = [&](int first, int last) {
+            size_t value;
+            for (int i = first; i < last; i++) {
+                if (!parseCount(argv[i], value)) return false;
+            }
+            return true;
+        };
+        auto count = [&](int i, size_t fallback) {
+            size_t value = fallback;
+            if (i < argc) parseCount(argv[i], value);
+            return value;
+        };
+        if ((mode == "--to-binary" || mode == "--to-text") && argc == 4)
+            return runConversion(mode, argv[2], argv[3]);
+        if (mode == "--batch" && (argc == 3 || argc == 4))
+            return runBatch(argv[2], argc == 4 ? argv[3] : string(argv[2]) + ".rejects");
+        if (mode == "--import" && (argc == 3 || argc == 4))
+            return runImport(argv[2], argc == 4 ? argv[3] : string(argv[2]) + ".rejects");
+        if (mode == "--bench-threads" && argc <= 5 && countsFrom(2, argc)) {
+            size_t hardware = max<size_t>(1, thread::hardware_concurrency());
+            return runThreadBenchmark(count(2, 1000000), count(3, 1000000),
+                                      count(4, hardware));
+        }
+        if (mode == "--bench-engine" && argc <= 5 && countsFrom(2, argc)) {
+            size_t hardware = max<size_t>(1, thread::hardware_concurrency());
+            return runEngineBenchmark(count(2, 1000000), count(3, 1000000),
+                                      count(4, hardware));
+        }
+        if (mode == "--bench" && countsFrom(argc > 2 && (string(argv[2]) == "json" || string(argv[2]) == "csv") ? 3 : 2, argc)) {
+            bool json = argc > 2 && string(argv[2]) == "json";
+            int first = argc > 2 && (json || string(argv[2]) == "csv") ? 3 : 2;
+            vector<size_t> sizes;
+            for (int i = first; i < argc; i++) sizes.push_back(count(i, 0));
+            if (sizes.empty()) sizes = { 1000, 100000, 1000000 };
+            return runBenchmarkSuite(sizes, json);
+        }
+        if (mode == "--bench-interest" && argc <= 4 && countsFrom(2, argc))
+            return runInterestBenchmark(count(2, 1000000), count(3, 12));
+        if (mode == "--bench-save" && argc <= 4 && countsFrom(2, argc))
+            return runSaveBenchmark(count(2, 1000000), count(3, 1000));
+        if (mode == "--bench-checkpoint" && argc <= 3 && countsFrom(2, argc))
+            return runCheckpointBenchmark(count(2, 1000000));
+        if (mode == "--bench-ledger" && argc <= 4 && countsFrom(2, argc))
+            return runLedgerBenchmark(max<size_t>(2, count(2, 1000000)), count(3, 10000000));
+        if (mode == "--bench-portfolio" && argc <= 4 && countsFrom(2, argc))
+            return runPortfolioBenchmark(max<size_t>(1, count(2, 1000000)), count(3, 1000000));
+        if (mode == "--bench-policies" && argc <= 4 && countsFrom(2, argc))
+            return runPolicyBenchmark(max<size_t>(1, count(2, 1000000)), count(3, 10000000));
+        if (mode == "--bench-memory" && argc <= 4 && countsFrom(2, argc))
+            return runMemoryBenchmark(max<size_t>(1, count(2, 1000000)), max<size_t>(1, count(3, 3)));
+        if (mode == "--bench-compound" && argc <= 5 && countsFrom(2, argc)) {
+            size_t hardware = max<size_t>(1, thread::hardware_concurrency());
+            return runCompoundBenchmark(max<size_t>(1, count(2, 1000000)), count(3, 365),
+                                        max<size_t>(1, count(4, hardware)));
+        }
+        if (mode == "--bench-import" && argc <= 3 && countsFrom(2, argc))
+            return runImportBenchmark(max<size_t>(1, count(2, 1000000)));
+        if (mode == "--fast-forward" && argc >= 3 && argc <= 5 && countsFrom(2, 3))
+            return runFastForward(count(2, 0), argc > 3 ? argv[3] : "daily", argc > 4 ? argv[4] : "");
+        if (mode == "--shards" && (argc == 3 || argc == 4) && countsFrom(2, 3))
+            return runShardRouter(max<size_t>(1, count(2, 1)), argc == 4 ? argv[3] : ".");
+        if (mode == "--serve" && argc == 3)
+            return runServer(argv[2]);
+        if (mode == "--loadgen" && argc >= 3 && argc <= 7 && countsFrom(3, argc))
+            return runLoadGenerator(argv[2], max<size_t>(1, count(3, 4)), max<size_t>(1, count(4, 32)),
+                                    count(5, 100000), max<size_t>(1, count(6, 100000)));
+        if (mode == "--check-recovery" && argc <= 3)
+            return runRecoveryCheck(argc == 3 ? argv[2] : "");
+        if (mode == "--bench-shards" && argc <= 6 && countsFrom(2, argc)) {
+            size_t hardware = max<size_t>(1, thread::hardware_concurrency());
+            return runShardBenchmark(max<size_t>(1, count(2, 100000)), count(3, 20000),
+                                     max<size_t>(1, count(4, hardware)), max<size_t>(1, count(5, 8)));
+        }
+
+        static const char* const usage[][2] = {
+            { "", "interactive menu" },
+            { "--to-binary <in.txt> <out.snap>", "convert text data to a snapshot" },
+            { "--to-text <in.snap> <out.txt>", "convert a snapshot to text data" },
+            { "--batch <txns.csv> [rejects.txt]", "apply a transaction file without prompts" },
+            { "--import <accounts.csv> [rejects.txt]", "bulk-add accounts from a CSV file" },
+            { "--fast-forward <days> [daily|monthly] [date]", "post scheduled interest over simulated days" },
+            { "--bench [csv|json] [accts...]", "per-operation latency and allocation suite" },
+            { "--bench-threads [accts] [ops] [thr]", "concurrent deposit/withdraw throughput" },
+            { "--bench-engine [accts] [ops] [thr]", "locked calls vs the single-writer engine" },
+            { "--bench-interest [accts] [periods]", "monthly interest posting throughput" },
+            { "--bench-compound [accts] [days] [threads]", "parallel daily compounding, checked exactly" },
+            { "--bench-save [accts] [changed]", "full snapshot vs incremental save" },
+            { "--bench-checkpoint [accts]", "writer latency during in-process vs forked saves" },
+            { "--bench-ledger [accts] [changes]", "ledger cost, statement and rebuild times" },
+            { "--bench-portfolio [accts] [changes]", "running portfolio totals vs a full scan" },
+            { "--bench-policies [accts] [ops]", "virtual calls vs per-type policy dispatch" },
+            { "--bench-memory [accts] [per customer]", "bytes per account, objects vs interned store" },
+            { "--bench-import [accts]", "per-account adds vs bulk import, SWAR validation" },
+            { "--shards <count> [dir]", "serve accounts from sharded worker processes" },
+            { "--bench-shards [accts] [ops] [cl] [max]", "throughput as the shard count grows" },
+            { "--serve <socket|host:port>", "binary request server (epoll)" },
+            { "--loadgen <addr> [conns] [depth] [ops] [accts]", "throughput and latency against --serve" },
+            { "--check-recovery [dir]", "crash a bank on purpose and check what reloads" },
+        };
+        for (size_t i = 0; i < sizeof(usage) / sizeof(usage[0]); i++) {
+            cout << (i == 0 ? "Usage: " : "       ") << argv[0] << " " << left << setw(48) << usage[i][0]
+                 << usage[i][1] << "\n";
+        }
+        return 1;
+    }
+
     cout << "Welcome to Bank Account Management System!" << endl;
     runBankSystem();
     return 0;